@@ -65,35 +65,43 @@ class rwaveclient:
             print(f' [SERVER] {message}')
 
         
-    def download(self):
+    def __recv_all__(self, data_size):
+        raw_data = bytearray(data_size)
+        view = memoryview(raw_data)
+        received = 0
+        while received < data_size:
+            n = self.socket.recv_into(view[received:], data_size - received)
+            if n == 0:  # If no data is received, connection is closed
+                raise ConnectionError('server closed the connection')
+            received += n
+        return raw_data
+
+
+    def download(self, sized=False):
+        ### receive section sizes (5 * uint64_t), only for 'download sized'
+        if sized:
+            sizes = struct.unpack('<QQQQQ', self.__recv_all__(5 * 8))
+            self.__print_msg__(f'received sizes: {sizes}')
         ### receive header (4 * uint16_t)
         data_size = 4 * 2
-        raw_data = self.socket.recv(data_size)
-        if len(raw_data) < data_size:
-            raise ValueError('received less than the expected {data_size} bytes')
+        raw_data = self.__recv_all__(data_size)
         header = struct.unpack('<HHHH', raw_data)
         n_events, n_channels, record_length, frequency = header
         self.__print_msg__(f'received header: {n_events} events, {n_channels} channels, {record_length} record length, {frequency} MHz sampling')
         ### receive channels (n_channels * uint8_t)
         data_size = n_channels
-        raw_data = self.socket.recv(data_size)
-        if len(raw_data) < data_size:
-            raise ValueError('received less than the expected {data_size} bytes')
+        raw_data = self.__recv_all__(data_size)
         channels = struct.unpack('<' + n_channels * 'B', raw_data)
         self.__print_msg__(f'received channels: {channels}')
         ### receive trigger tags (n_events * 2 * uint32_t)
         data_size = n_events * 2 * 4
-        raw_data = self.socket.recv(data_size)
-        if len(raw_data) < data_size:
-            raise ValueError('received less than the expected {data_size} bytes')
+        raw_data = self.__recv_all__(data_size)
         trigger_tags = struct.unpack('<' + n_events * 2 * 'I', raw_data)
         trigger_tags = tuple(zip(trigger_tags[::2], trigger_tags[1::2]))
         self.__print_msg__(f'received trigger tags: {data_size} bytes')
         ### receive first cell indices (n_events * 2 * uint16_t)
         data_size = n_events * 2 * 2
-        raw_data = self.socket.recv(data_size)
-        if len(raw_data) < data_size:
-            raise ValueError('received less than the expected {data_size} bytes')
+        raw_data = self.__recv_all__(data_size)
         first_cells = struct.unpack('<' + n_events * 2 * 'H', raw_data)
         first_cells = tuple(zip(first_cells[::2], first_cells[1::2]))
         self.__print_msg__(f'received first_cells: {data_size} bytes')
@@ -101,12 +109,7 @@ class rwaveclient:
         waveform_size = record_length * 4
         event_size = n_channels * waveform_size
         data_size = n_events * event_size
-        raw_data = b''
-        while len(raw_data) < data_size:
-            chunk = self.socket.recv(data_size - len(raw_data))
-            if not chunk:  # If no data is received, connection is closed
-                raise ConnectionError('server closed the connection')
-            raw_data += chunk
+        raw_data = self.__recv_all__(data_size)
         self.__print_msg__(f'received data: {data_size} bytes')
         ### unpack data 
         self.__print_msg__('unpacking data')
@@ -117,12 +120,113 @@ class rwaveclient:
         for event in range(n_events):
             event_data = {}
             for channel in channels:
+                ### ids 16 and 17 are the digitized TR0/TR1 of groups 0 and 1
+                group = channel // 8 if channel < 16 else channel - 16
                 event_data[channel] = {}
                 unpacked = waveform_struct.unpack(raw_data[index:index + waveform_size])
                 index += waveform_size
                 waveform_data = np.array(unpacked, dtype = float)
                 event_data[channel]['waveform'] = waveform_data
-                event_data[channel]['trigger_tag'] = trigger_tags[event][channel // 8]
-                event_data[channel]['first_cell'] = first_cells[event][channel // 8]
+                event_data[channel]['trigger_tag'] = trigger_tags[event][group]
+                event_data[channel]['first_cell'] = first_cells[event][group]
             data.append(event_data)
         return data
+
+
+    def download_v2(self):
+        ### receive the self-describing v2 header (64 bytes), after 'download v2'
+        return self.__recv_v2__(self.__recv_all__(8))
+
+
+    def acquire(self, n_events, swtrg=False):
+        ### one transaction: the server starts, triggers, reads out and stops,
+        ### streaming v2 blocks as they are read, then a 64-byte trailer
+        self.send_cmd(f'acquire {n_events}' + (' swtrg' if swtrg else ''))
+        trailer_fmt = '<IHHIIQQQQQQ'
+        blocks = []
+        while True:
+            raw_magic = self.__recv_all__(4)
+            magic, = struct.unpack('<I', raw_magic)
+            if magic == 0x45415752:
+                raw_data = raw_magic + self.__recv_all__(struct.calcsize(trailer_fmt) - 4)
+                (magic, header_size, status, n_blocks, reserved,
+                 n_triggers, n_read, n_sent, n_bytes, first_ns, total_ns) = struct.unpack(trailer_fmt, raw_data)
+                trailer = {
+                    'status': ('completed', 'timeout', 'error')[status],
+                    'blocks': n_blocks,
+                    'triggers': n_triggers,
+                    'read': n_read,
+                    'sent': n_sent,
+                    'bytes': n_bytes,
+                    'first_s': first_ns * 1.e-9,
+                    'total_s': total_ns * 1.e-9
+                }
+                self.__print_msg__(f'acquire {trailer["status"]}: {n_read} events read, {n_sent} sent in {n_blocks} blocks, {trailer["total_s"]:.3f} s')
+                return blocks, trailer
+            blocks.append(self.__recv_v2__(raw_magic + self.__recv_all__(4)))
+
+
+    def __recv_v2__(self, raw_data):
+        ### raw_data holds magic, version and header_size, the rest of the header follows
+        magic, version, header_size = struct.unpack('<IHH', raw_data)
+        if magic != 0x32574152 or version != 2:
+            raise ValueError(f'invalid v2 header: magic {magic:#x}, version {version}')
+        raw_data += self.__recv_all__(header_size - 8)
+        header_fmt = '<IHHIHHHBBBBHQQQQ'
+        (magic, version, header_size, n_events, n_channels, record_length, frequency,
+         group_mask, sample_type, layout, tag_type, sample_step_ps,
+         channels_size, trigger_tags_size, start_cells_size, data_size) = struct.unpack_from(header_fmt, raw_data)
+        ### wall clock of the block transfer, in headers of 64 bytes and more
+        host_ns, = struct.unpack_from('<Q', raw_data, 56) if header_size >= 64 else (0,)
+        if sample_type != 0:
+            raise ValueError(f'unsupported sample type: {sample_type}')
+        layout_name = 'channel' if layout == 1 else 'event'
+        self.__print_msg__(f'received v2 header: {n_events} events, {n_channels} channels, {record_length} record length, {frequency} MHz sampling, {layout_name}-major')
+        ### receive sections, as numpy views of the received buffers
+        channels = tuple(self.__recv_all__(channels_size))
+        ### tag_type 1: trigger time tags unwrapped into 64-bit counts of 8.5 ns since the start
+        trigger_tags = np.frombuffer(self.__recv_all__(trigger_tags_size), dtype='<u8' if tag_type == 1 else '<u4').reshape(n_events, 2)
+        start_cells = np.frombuffer(self.__recv_all__(start_cells_size), dtype='<u2').reshape(n_events, 2)
+        waveforms = np.frombuffer(self.__recv_all__(data_size), dtype='<f4')
+        self.__print_msg__(f'received data: {data_size} bytes')
+        ### event-major: [event][channel][sample], channel-major: [channel][event][sample]
+        if layout == 1:
+            waveforms = waveforms.reshape(n_channels, n_events, record_length)
+        else:
+            waveforms = waveforms.reshape(n_events, n_channels, record_length)
+        return {
+            'frequency': frequency,
+            ### resampled data: samples on a grid of this step, otherwise 0 and samples at the DRS4 cell times
+            'sample_step_ps': sample_step_ps,
+            'group_mask': group_mask,
+            'layout': layout_name,
+            'channels': channels,
+            'trigger_tags': trigger_tags,
+            'host_ns': host_ns,
+            'start_cells': start_cells,
+            'waveforms': waveforms
+        }
+
+
+    def preview_frame(self):
+        ### receive one frame of the stream started with 'preview envelope|decimate'
+        header_fmt = '<IHBBIIQHHI'
+        raw_data = self.__recv_all__(struct.calcsize(header_fmt))
+        (magic, header_size, mode, n_channels, frame, n_points, sequence,
+         record_length, frequency, reserved) = struct.unpack(header_fmt, raw_data)
+        if magic != 0x56505752:
+            raise ValueError(f'invalid preview frame: magic {magic:#x}')
+        channels = tuple(self.__recv_all__(n_channels))
+        ### envelope: [channel][point][min, max], decimate: [channel][point]
+        values = 2 if mode == 0 else 1
+        points = np.frombuffer(self.__recv_all__(n_channels * n_points * values * 4), dtype='<f4')
+        points = points.reshape(n_channels, n_points, 2) if mode == 0 else points.reshape(n_channels, n_points)
+        return {
+            'mode': 'envelope' if mode == 0 else 'decimate',
+            'frame': frame,
+            'sequence': sequence,
+            'record_length': record_length,
+            'frequency': frequency,
+            'channels': channels,
+            'points': points
+        }
@@ -13,6 +13,8 @@ current_frame = 0
 
 frequency = 750
 channels = [0, 1, 12]
+### resample onto a uniform time grid of the nominal period, 'off' to plot against the cell number
+resample = 'cubic'
 
 def collect_data():
 
@@ -22,20 +24,28 @@ def collect_data():
         grmask |= 1 << ch // 8 
         chmask |= 1 << ch
     
-    data = None
+    block = None
     with rwaveclient(host, port, verbose=True) as rwc:
         if rwc is None:
             return
         rwc.send_cmd(f'sampling {frequency}')
         rwc.send_cmd(f'grmask {grmask}')
         rwc.send_cmd(f'chmask {chmask}')
+        rwc.send_cmd(f'resample {resample}')
         rwc.send_cmd("start")
         rwc.send_cmd('swtrg 1024')
         rwc.send_cmd('readout')
-        rwc.send_cmd('download')
-        data = rwc.download()
+        ### resampled data come only with the v2 download
+        rwc.send_cmd('download v2')
+        block = rwc.download_v2()
         rwc.send_cmd('stop')
-    return data
+    if block is None:
+        return
+    ### one {channel: waveform} per event
+    waveforms = block['waveforms']
+    if block['layout'] == 'channel':
+        waveforms = waveforms.transpose(1, 0, 2)
+    return [dict(zip(block['channels'], event)) for event in waveforms]
 
 
 def update(frame, data, lines, ax):
@@ -71,14 +81,14 @@ def main():
     data = collect_data()
 
     fig, ax = plt.subplots()
-    x_data = np.arange(1024)
+    x_data = np.arange(1024) * (1000. / frequency if resample != 'off' else 1.)
     y_data = np.zeros(1024)
     lines = {}
     for ch in channels:
         lines[ch], = ax.plot(x_data, y_data, label=f'ch-{ch}')
 
     ax.set_ylim(0, 4096)
-    ax.set_xlabel("cell")
+    ax.set_xlabel("time (ns)" if resample != 'off' else "cell")
     ax.set_ylabel("ADC")
     ax.set_title(f'event {current_frame}')
     ax.grid()
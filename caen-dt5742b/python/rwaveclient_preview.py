@@ -0,0 +1,47 @@
+#! /usr/bin/env python
+
+### live display of the preview stream, while another client
+### (or a server-side recording) drives the acquisition
+
+from rwave import rwaveclient
+import numpy as np
+import matplotlib.pyplot as plt
+
+host = 'localhost'
+port = 30001
+
+width = 256
+fps = 10
+
+def main():
+
+    with rwaveclient(host, port, verbose=True) as rwc:
+        if rwc is None:
+            return
+        rwc.send_cmd(f'preview envelope {width} {fps}')
+
+        plt.ion()
+        fig, ax = plt.subplots()
+        bands = {}
+        ax.set_ylim(0, 4096)
+        ax.set_xlabel("cell")
+        ax.set_ylabel("ADC")
+        ax.grid()
+
+        while plt.fignum_exists(fig.number):
+            frame = rwc.preview_frame()
+            points = frame['points']
+            x_data = np.arange(points.shape[1]) * frame['record_length'] / points.shape[1]
+            for i, ch in enumerate(frame['channels']):
+                if ch in bands:
+                    bands[ch].remove()
+                bands[ch] = ax.fill_between(x_data, points[i, :, 0], points[i, :, 1], step='post', alpha=0.5, label=f'ch-{ch}')
+            ax.set_title(f'frame {frame["frame"]}, snapshot {frame["sequence"]}')
+            if frame['frame'] == 0:
+                ax.legend()
+            fig.canvas.draw()
+            fig.canvas.flush_events()
+
+        
+if __name__ == '__main__':
+    main()
@@ -1,95 +1,352 @@
 #pragma once
 
-class rwavedump
-{
-  
-public:
+#include <algorithm>
+#include <map>
+#include <list>
+#include <memory>
+#include <vector>
+#include <sys/stat.h>
 
-  rwavedump(std::string filename);
-  bool next_event() { ++current_event; return prepare(); };
-  bool goto_event(int event) { current_event = event; return prepare(); };
-  void rewind_events() { current_event = -1; };
-  TGraph *get_graph(int group, int channel) { return graphs[group][channel]; };
-  bool calibrate(std::string calibfilename);
-  
-private:
+/** process-wide cache shared by all rwavedump instances:
+    open files and parsed calibration tables keyed by path and modification
+    time, decoded events in an LRU filled with read-ahead **/
+
+namespace rwavecache {
+
+const int lru_capacity = 512; // events
+const int read_ahead = 16;    // events read after a miss
 
+struct file_t {
   TFile *file = nullptr;
-  TTree *trees[2][9] = {nullptr};
-  TGraph *graphs[2][9] = {nullptr};
-  Long64_t n_events = -1, current_event = -1;
+  TTree *trees[2][9] = {{nullptr}};
+  Long64_t n_events = -1;
+  Long64_t mtime = 0;
+  float sample_step = 0.;    // grid step of resampled files (ns), 0 = samples at the DRS4 cell times
+  /** branch buffers **/
   int size;
+  unsigned short strt;
+  ULong64_t ttag64 = 0, host = 0;
   float data[1024];
+  /** time index, sorted by ttag64, empty in files written without it **/
+  std::vector<ULong64_t> index_ttag64;
+  std::vector<Long64_t> index_entry;
+};
 
-  bool calib[2][9] = {false};
-  float adc_calib[2][9][1024][2] = {0.};
+struct calib_t {
+  Long64_t mtime = 0;
+  bool cell_indexed = false; // calibration tables indexed by DRS4 cell rather than by sample
+  bool calib[2][9] = {{false}};
+  float adc_calib[2][9][1024][2] = {{{{0.}}}};
+};
 
-  bool prepare();
- 
+struct event_t {
+  ULong64_t ttag64 = 0; // unwrapped trigger time tag, 8.5 ns ticks since the start
+  ULong64_t host = 0;   // wall clock of the block transfer, ns since the epoch
+  bool present[2][9] = {{false}};
+  unsigned short strt[2][9] = {{0}};
+  std::vector<float> data[2][9];
 };
 
-rwavedump::rwavedump(std::string filename)
+typedef std::pair<std::string, Long64_t> event_key_t;
+typedef std::list<std::pair<event_key_t, std::shared_ptr<const event_t>>> lru_t;
+
+inline std::map<std::string, std::shared_ptr<file_t>> &files() { static std::map<std::string, std::shared_ptr<file_t>> m; return m; }
+inline std::map<std::string, std::shared_ptr<const calib_t>> &calibs() { static std::map<std::string, std::shared_ptr<const calib_t>> m; return m; }
+inline lru_t &lru() { static lru_t l; return l; }
+inline std::map<event_key_t, lru_t::iterator> &lru_index() { static std::map<event_key_t, lru_t::iterator> m; return m; }
+
+inline Long64_t
+mtime_of(const std::string &path)
+{
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) return -1;
+  return (Long64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+}
+
+inline void
+drop_events(const std::string &filename)
+{
+  auto &l = lru();
+  for (auto it = l.begin(); it != l.end(); ) {
+    if (it->first.first != filename) { ++it; continue; }
+    lru_index().erase(it->first);
+    it = l.erase(it);
+  }
+}
+
+inline void
+close_file(const std::string &filename)
+{
+  auto it = files().find(filename);
+  if (it == files().end()) return;
+  if (it->second->file) {
+    it->second->file->Close();
+    delete it->second->file;
+  }
+  files().erase(it);
+  drop_events(filename);
+}
+
+/** open file, or the cached one if it did not change on disk **/
+inline std::shared_ptr<file_t>
+open_file(const std::string &filename)
 {
+  auto mtime = mtime_of(filename);
+  auto it = files().find(filename);
+  if (it != files().end() && it->second->mtime == mtime) return it->second;
+  if (it != files().end()) std::cout << " --- file changed on disk, reopening: " << filename << std::endl;
+  close_file(filename);
+
   std::cout << " --- opening file: " << filename << std::endl;
-  file = TFile::Open(filename.c_str());
-  if (!file || !file->IsOpen()) {
+  auto f = std::make_shared<file_t>();
+  f->mtime = mtime;
+  f->file = TFile::Open(filename.c_str());
+  if (!f->file || !f->file->IsOpen()) {
     std::cout << " --- could not open file: " << filename << std::endl;
-    return;
+    return nullptr;
   }
   for (int igr = 0; igr < 2; ++igr) {
     for (int ich = 0; ich < 9; ++ich) {
       std::string treename = Form("gr%d_ch%d", igr, ich);
-      trees[igr][ich] = (TTree *)file->Get(treename.c_str());
-      if (!trees[igr][ich]) continue;
-      graphs[igr][ich] = new TGraph;
-      if (n_events == -1) n_events = trees[igr][ich]->GetEntries();
-      std::cout << " --- found data for " << treename << ": " << trees[igr][ich]->GetEntries() << " events " << std::endl;
-      if (trees[igr][ich]->GetEntries() != n_events) std::cout << "     number of events mismatch " << std::endl;
+      auto t = (TTree *)f->file->Get(treename.c_str());
+      f->trees[igr][ich] = t;
+      if (!t) continue;
+      t->SetBranchAddress("size", &f->size);
+      t->SetBranchAddress("strt", &f->strt);
+      t->SetBranchAddress("data", &f->data);
+      if (t->GetBranch("ttag64")) t->SetBranchAddress("ttag64", &f->ttag64);
+      if (t->GetBranch("host")) t->SetBranchAddress("host", &f->host);
+      t->SetCacheSize(16000000);
+      if (f->n_events == -1) f->n_events = t->GetEntries();
+      std::cout << " --- found data for " << treename << ": " << t->GetEntries() << " events " << std::endl;
+      if (t->GetEntries() != f->n_events) std::cout << "     number of events mismatch " << std::endl;
     }}
+  auto pstep = (TParameter<float> *)f->file->Get("sample_step");
+  f->sample_step = pstep ? pstep->GetVal() : 0.;
+  /** the time index is small, it is read into memory once **/
+  if (auto t = (TTree *)f->file->Get("time_index")) {
+    ULong64_t ttag64;
+    Long64_t entry;
+    t->SetBranchAddress("ttag64", &ttag64);
+    t->SetBranchAddress("entry", &entry);
+    for (Long64_t i = 0; i < t->GetEntries(); ++i) {
+      t->GetEntry(i);
+      f->index_ttag64.push_back(ttag64);
+      f->index_entry.push_back(entry);
+    }
+    std::cout << " --- found time index: " << f->index_ttag64.size() << " events " << std::endl;
+  }
+  files()[filename] = f;
+  return f;
 }
 
-bool
-rwavedump::calibrate(std::string calibfilename)
+/** calibration tables, parsed once per file version **/
+inline std::shared_ptr<const calib_t>
+load_calib(const std::string &calibfilename)
 {
+  auto mtime = mtime_of(calibfilename);
+  auto it = calibs().find(calibfilename);
+  if (it != calibs().end() && it->second->mtime == mtime) return it->second;
+
   std::cout << " --- loading calibration data: " << calibfilename << std::endl;
   auto fcalib = TFile::Open(calibfilename.c_str());
+  if (!fcalib || !fcalib->IsOpen()) {
+    std::cout << " --- could not open file: " << calibfilename << std::endl;
+    return nullptr;
+  }
+  auto c = std::make_shared<calib_t>();
+  c->mtime = mtime;
+  auto pcell = (TParameter<int> *)fcalib->Get("cell_indexed");
+  c->cell_indexed = pcell && pcell->GetVal();
   for (int igr = 0; igr < 2; ++igr) {
     for (int ich = 0; ich < 9; ++ich) {
       auto hp0 = (TH1 *)fcalib->Get(Form("hCalib_gr%d_ch%d_p0", igr, ich));
       auto hp1 = (TH1 *)fcalib->Get(Form("hCalib_gr%d_ch%d_p1", igr, ich));
-      calib[igr][ich] = (hp0 && hp1);
-      if (calib[igr][ich]) {
+      c->calib[igr][ich] = (hp0 && hp1);
+      if (c->calib[igr][ich]) {
 	std::cout << " --- found calibration data for " << Form("gr%d_ch%d", igr, ich) << std::endl;
 	for (int i = 0; i < 1024; ++i) {
-	  adc_calib[igr][ich][i][0] = hp0->GetBinContent(i + 1);
-	  adc_calib[igr][ich][i][1] = hp1->GetBinContent(i + 1);
+	  c->adc_calib[igr][ich][i][0] = hp0->GetBinContent(i + 1);
+	  c->adc_calib[igr][ich][i][1] = hp1->GetBinContent(i + 1);
 	}
       }
     }}
-  
-  return true;
+  fcalib->Close();
+  delete fcalib;
+  calibs()[calibfilename] = c;
+  return c;
+}
+
+inline std::shared_ptr<const event_t>
+read_event(file_t &f, Long64_t event)
+{
+  auto ev = std::make_shared<event_t>();
+  for (int igr = 0; igr < 2; ++igr) {
+    for (int ich = 0; ich < 9; ++ich) {
+      auto t = f.trees[igr][ich];
+      if (!t || t->GetEntry(event) <= 0) continue;
+      ev->present[igr][ich] = true;
+      ev->ttag64 = f.ttag64;
+      ev->host = f.host;
+      ev->strt[igr][ich] = f.strt;
+      ev->data[igr][ich].assign(f.data, f.data + f.size);
+    }}
+  return ev;
+}
+
+inline void
+insert_event(const event_key_t &key, std::shared_ptr<const event_t> ev)
+{
+  auto &l = lru();
+  l.emplace_front(key, ev);
+  lru_index()[key] = l.begin();
+  while ((int)l.size() > lru_capacity) {
+    lru_index().erase(l.back().first);
+    l.pop_back();
+  }
+}
+
+/** decoded event from the LRU; a miss reads it together with the following
+    read_ahead events and the previous one, so that stepping either way hits **/
+inline std::shared_ptr<const event_t>
+get_event(const std::string &filename, Long64_t event)
+{
+  auto f = open_file(filename);
+  if (!f || event < 0 || event >= f->n_events) return nullptr;
+  event_key_t key(filename, event);
+  auto it = lru_index().find(key);
+  if (it != lru_index().end()) {
+    lru().splice(lru().begin(), lru(), it->second);
+    return it->second->second;
+  }
+  std::shared_ptr<const event_t> requested;
+  Long64_t first = std::max(0LL, event - 1), last = std::min(f->n_events, event + 1 + read_ahead);
+  /** insert the requested event last, it must be the most recent **/
+  for (Long64_t iev = first; iev < last; ++iev) {
+    event_key_t k(filename, iev);
+    if (iev == event) {
+      requested = read_event(*f, iev);
+      continue;
+    }
+    if (lru_index().count(k)) continue;
+    insert_event(k, read_event(*f, iev));
+  }
+  insert_event(key, requested);
+  return requested;
+}
+
+/** entry with the ttag64 closest to t, -1 without a time index **/
+inline Long64_t
+find_time(const std::string &filename, ULong64_t t)
+{
+  auto f = open_file(filename);
+  if (!f || f->index_ttag64.empty()) return -1;
+  auto &tags = f->index_ttag64;
+  auto i = std::lower_bound(tags.begin(), tags.end(), t) - tags.begin();
+  if (i == (Long64_t)tags.size() || (i > 0 && t - tags[i - 1] < tags[i] - t)) --i;
+  return f->index_entry[i];
+}
+
+/** entries with t0 <= ttag64 < t1, in time order **/
+inline std::vector<Long64_t>
+select_time(const std::string &filename, ULong64_t t0, ULong64_t t1)
+{
+  auto f = open_file(filename);
+  if (!f) return {};
+  auto &tags = f->index_ttag64;
+  auto first = std::lower_bound(tags.begin(), tags.end(), t0) - tags.begin();
+  auto last = std::lower_bound(tags.begin() + first, tags.end(), t1) - tags.begin();
+  return std::vector<Long64_t>(f->index_entry.begin() + first, f->index_entry.begin() + last);
+}
+
+inline void
+clear()
+{
+  while (!files().empty()) close_file(files().begin()->first);
+  calibs().clear();
+  lru().clear();
+  lru_index().clear();
+}
+
+}
+
+class rwavedump
+{
+
+public:
+
+  rwavedump(std::string filename);
+  bool next_event() { ++current_event; return prepare(); };
+  bool goto_event(int event) { current_event = event; return prepare(); };
+  void rewind_events() { current_event = -1; };
+  TGraph *get_graph(int group, int channel) { return graphs[group][channel]; };
+  /** time of the current event: unwrapped trigger time tag (8.5 ns ticks) and host wall clock (ns) **/
+  ULong64_t get_ttag64() { return ttag64; };
+  ULong64_t get_host() { return host; };
+  /** binary searches on the time index of the file **/
+  bool goto_time(ULong64_t t) { auto event = rwavecache::find_time(filename, t); return event >= 0 && goto_event(event); };
+  std::vector<Long64_t> select_time(ULong64_t t0, ULong64_t t1) { return rwavecache::select_time(filename, t0, t1); };
+  bool calibrate(std::string calibfilename);
+  static void clear_cache() { rwavecache::clear(); };
+
+private:
+
+  std::string filename;
+  TGraph *graphs[2][9] = {nullptr};
+  Long64_t n_events = -1, current_event = -1;
+  ULong64_t ttag64 = 0, host = 0;
+  std::shared_ptr<const rwavecache::calib_t> calib;
+
+  bool prepare();
+
+};
+
+rwavedump::rwavedump(std::string filename) : filename(filename)
+{
+  auto f = rwavecache::open_file(filename);
+  if (!f) return;
+  n_events = f->n_events;
+  for (int igr = 0; igr < 2; ++igr)
+    for (int ich = 0; ich < 9; ++ich)
+      if (f->trees[igr][ich]) graphs[igr][ich] = new TGraph;
+}
+
+bool
+rwavedump::calibrate(std::string calibfilename)
+{
+  calib = rwavecache::load_calib(calibfilename);
+  return calib != nullptr;
 }
 
 bool
 rwavedump::prepare()
 {
+  /** the file may have been reopened if it changed on disk **/
+  auto f = rwavecache::open_file(filename);
+  if (f) n_events = f->n_events;
   if (current_event >= n_events) return false;
+  /** resampled files are on a time grid, where samples no longer follow the cells **/
+  float step = f ? f->sample_step : 0.;
+  auto ev = rwavecache::get_event(filename, current_event);
+  if (!ev) return false;
+  ttag64 = ev->ttag64;
+  host = ev->host;
   for (int igr = 0; igr < 2; ++igr) {
     for (int ich = 0; ich < 9; ++ich) {
-      if (!trees[igr][ich]) continue;
-      auto t = trees[igr][ich];
+      if (!ev->present[igr][ich] || !graphs[igr][ich]) continue;
       auto g = graphs[igr][ich];
-      g->Set(0);
-      t->SetBranchAddress("size", &size);
-      t->SetBranchAddress("data", &data);
-      t->GetEntry(current_event);
+      auto &data = ev->data[igr][ich];
+      auto strt = ev->strt[igr][ich];
+      bool calibrated = calib && calib->calib[igr][ich] && !(step > 0. && calib->cell_indexed);
+      int size = data.size();
+      g->Set(size);
       for (int i = 0; i < size; ++i) {
-	auto valx = i;
-	auto valy = calib[igr][ich] ? ( data[i] - adc_calib[igr][ich][i][0] ) / adc_calib[igr][ich][i][1] : data[i];
+	auto valx = step > 0. ? i * step : i;
+	auto icell = calib && calib->cell_indexed ? (strt + i) % 1024 : i;
+	auto valy = calibrated ? ( data[i] - calib->adc_calib[igr][ich][icell][0] ) / calib->adc_calib[igr][ich][icell][1] : data[i];
 	g->SetPoint(i, valx, valy);
       }
-      g->SetTitle(Form("gr %d ch %d: ev %lld;cell number;amplitude (%s)", igr, ich, current_event, calib[igr][ich] ? "V" : "ADC"));
+      g->SetTitle(Form("gr %d ch %d: ev %lld;%s;amplitude (%s)", igr, ich, current_event, step > 0. ? "time (ns)" : "cell number", calibrated ? "V" : "ADC"));
     }}
   return true;
 }
-  
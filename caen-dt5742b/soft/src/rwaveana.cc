@@ -0,0 +1,455 @@
+#include <boost/program_options.hpp>
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <glob.h>
+#include "rwavefile.hh"
+#include "rwavepool.hh"
+#include "TROOT.h"
+#include "TFile.h"
+#include "TTree.h"
+#include "TH1D.h"
+#include "TParameter.h"
+
+/** batch analysis of rwavedump output files.
+    the files are split in tasks (one per file, or per event range) run on a
+    work-stealing pool; every task fills plain accumulators which are merged
+    in task order as soon as all the previous tasks are done, so that the
+    output does not depend on the number of threads **/
+
+const int n_groups = rwf::max_groups;
+const int n_channels = rwf::max_channels;
+const int n_samples = rwf::max_length;
+
+struct options_t {
+  std::string output;
+  std::vector<std::string> inputs;
+  std::string list;
+  std::string calib;
+  int threads = 0;
+  long long events_per_task = 0; // 0 = one task per file
+  int polarity = -1;
+  int baseline_samples = 16;
+  int window_min = 0, window_max = n_samples;
+  int amp_bins = 1000;
+  double amp_max = 4000.;
+  int charge_bins = 1000;
+  double charge_max = 100000.;
+};
+
+/** per-event quantities of one channel **/
+struct moments_t {
+  double n = 0., sum = 0., sum2 = 0.;
+  void add(double x) { n += 1.; sum += x; sum2 += x * x; };
+  void merge(const moments_t &other) { n += other.n; sum += other.sum; sum2 += other.sum2; };
+  double mean() const { return n > 0. ? sum / n : 0.; };
+  double rms() const { return n > 1. ? std::sqrt(std::max(0., (sum2 - sum * sum / n) / (n - 1.))) : 0.; };
+};
+
+struct channel_t {
+  int length = 0;
+  std::vector<double> wave_sum, wave_sum2;
+  std::vector<double> amp_hist, charge_hist; // with underflow/overflow bins
+  moments_t baseline, noise, amplitude, charge;
+  void init(const options_t &opt) {
+    wave_sum.assign(n_samples, 0.);
+    wave_sum2.assign(n_samples, 0.);
+    amp_hist.assign(opt.amp_bins + 2, 0.);
+    charge_hist.assign(opt.charge_bins + 2, 0.);
+  };
+  void merge(const channel_t &other) {
+    length = std::max(length, other.length);
+    for (int i = 0; i < n_samples; ++i) {
+      wave_sum[i] += other.wave_sum[i];
+      wave_sum2[i] += other.wave_sum2[i];
+    }
+    for (size_t i = 0; i < amp_hist.size(); ++i) amp_hist[i] += other.amp_hist[i];
+    for (size_t i = 0; i < charge_hist.size(); ++i) charge_hist[i] += other.charge_hist[i];
+    baseline.merge(other.baseline);
+    noise.merge(other.noise);
+    amplitude.merge(other.amplitude);
+    charge.merge(other.charge);
+  };
+};
+
+/** accumulators of one task, channels allocated on first use **/
+struct result_t {
+  std::unique_ptr<channel_t> channels[n_groups][n_channels];
+  channel_t &at(int group, int channel, const options_t &opt) {
+    auto &ptr = channels[group][channel];
+    if (!ptr) {
+      ptr.reset(new channel_t);
+      ptr->init(opt);
+    }
+    return *ptr;
+  };
+  void merge(const result_t &other, const options_t &opt) {
+    for (int igr = 0; igr < n_groups; ++igr)
+      for (int ich = 0; ich < n_channels; ++ich)
+	if (other.channels[igr][ich]) at(igr, ich, opt).merge(*other.channels[igr][ich]);
+  };
+};
+
+struct task_t {
+  int file;
+  long long first, last;
+};
+
+/** one summary entry per file and channel **/
+struct summary_t {
+  int file, group, channel;
+  long long n;
+  double baseline, noise, amplitude, amplitude_rms, charge, charge_rms;
+};
+
+struct calib_t {
+  bool present[n_groups][n_channels] = {{false}};
+  bool cell_indexed = false;
+  float table[n_groups][n_channels][n_samples][2];
+};
+
+void process_program_options(int argc, char *argv[], options_t &opt);
+bool expand_inputs(const options_t &opt, std::vector<std::string> &files);
+bool load_calibration(const std::string &filename, calib_t &calib);
+void analyse(rwf::file_t &f, const task_t &task, const options_t &opt, const calib_t &calib, result_t &result);
+void summarise(int file, const result_t &result, std::vector<summary_t> &summary);
+bool write_output(const options_t &opt, const std::vector<std::string> &files, const result_t &total, const std::vector<summary_t> &summary, bool calibrated);
+
+int main(int argc, char *argv[])
+{
+  std::cout << " --- welcome to rwaveana " << std::endl;
+  options_t opt;
+  process_program_options(argc, argv, opt);
+  ROOT::EnableThreadSafety();
+
+  std::vector<std::string> files;
+  if (!expand_inputs(opt, files)) return 1;
+  std::cout << " --- " << files.size() << " input files " << std::endl;
+
+  calib_t calib;
+  if (!opt.calib.empty() && !load_calibration(opt.calib, calib)) return 1;
+
+  auto t_start = std::chrono::steady_clock::now();
+  pool::pool_t pool(opt.threads);
+
+  /** first pass: number of events per file **/
+  std::vector<long long> n_events(files.size(), -1);
+  for (size_t ifile = 0; ifile < files.size(); ++ifile) {
+    pool.submit([&, ifile] {
+      rwf::file_t f;
+      if (!rwf::open(f, files[ifile])) return;
+      n_events[ifile] = f.n_events;
+      rwf::close(f);
+    });
+  }
+  pool.wait();
+
+  std::vector<task_t> tasks;
+  for (size_t ifile = 0; ifile < files.size(); ++ifile) {
+    if (n_events[ifile] < 0) {
+      std::cout << " --- skipping unreadable file: " << files[ifile] << std::endl;
+      continue;
+    }
+    long long step = opt.events_per_task > 0 ? opt.events_per_task : std::max(1LL, n_events[ifile]);
+    for (long long first = 0; first < n_events[ifile]; first += step)
+      tasks.push_back({ (int)ifile, first, std::min(first + step, n_events[ifile]) });
+  }
+  std::cout << " --- " << tasks.size() << " tasks on " << pool.size() << " threads " << std::endl;
+
+  /** second pass: analysis, the last opened file is kept per worker **/
+  std::vector<rwf::file_t> cache(pool.size());
+  std::vector<std::unique_ptr<result_t>> results(tasks.size());
+  std::vector<char> done(tasks.size(), 0);
+  size_t merged = 0;
+  std::mutex merge_mutex;
+  result_t total, file_total;
+  std::vector<summary_t> summary;
+
+  for (size_t itask = 0; itask < tasks.size(); ++itask) {
+    pool.submit([&, itask] {
+      auto &task = tasks[itask];
+      auto &f = cache[pool::pool_t::worker_id()];
+      std::unique_ptr<result_t> result(new result_t);
+      if (f.filename != files[task.file] || !f.file) {
+	rwf::close(f);
+	rwf::open(f, files[task.file]);
+      }
+      if (f.file) analyse(f, task, opt, calib, *result);
+
+      /** merge the completed prefix of the task list, in order **/
+      std::lock_guard<std::mutex> lock(merge_mutex);
+      results[itask] = std::move(result);
+      done[itask] = 1;
+      while (merged < tasks.size() && done[merged]) {
+	file_total.merge(*results[merged], opt);
+	total.merge(*results[merged], opt);
+	results[merged].reset();
+	if (merged + 1 == tasks.size() || tasks[merged + 1].file != tasks[merged].file) {
+	  summarise(tasks[merged].file, file_total, summary);
+	  file_total = result_t();
+	}
+	++merged;
+      }
+    });
+  }
+  pool.wait();
+  for (auto &f : cache) rwf::close(f);
+
+  auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+  long long n_total = 0;
+  for (auto &task : tasks) n_total += task.last - task.first;
+  std::cout << " --- analysed " << n_total << " events in " << elapsed << " s ("
+	    << (elapsed > 0. ? n_total / elapsed : 0.) << " events/s) " << std::endl;
+
+  if (!write_output(opt, files, total, summary, !opt.calib.empty())) return 1;
+  return 0;
+}
+
+void
+process_program_options(int argc, char *argv[], options_t &opt)
+{
+  /** process arguments **/
+  namespace po = boost::program_options;
+  po::options_description desc("Options");
+  po::positional_options_description pos;
+  pos.add("input", -1);
+  try {
+    desc.add_options()
+      ("help"             , "Print help messages")
+      ("output"           , po::value<std::string>(&opt.output)->required(), "Output filename")
+      ("input"            , po::value<std::vector<std::string>>(&opt.inputs), "Input filenames or glob patterns")
+      ("list"             , po::value<std::string>(&opt.list), "Text file with one input filename per line")
+      ("calib"            , po::value<std::string>(&opt.calib), "Calibration filename (from rwavecalib)")
+      ("threads"          , po::value<int>(&opt.threads)->default_value(0), "Number of threads (0 = all cores)")
+      ("events_per_task"  , po::value<long long>(&opt.events_per_task)->default_value(0), "Events per task (0 = one task per file)")
+      ("polarity"         , po::value<int>(&opt.polarity)->default_value(-1), "Signal polarity [-1, 1]")
+      ("baseline_samples" , po::value<int>(&opt.baseline_samples)->default_value(16), "Samples used for the baseline")
+      ("window_min"       , po::value<int>(&opt.window_min)->default_value(0), "First sample of the signal window")
+      ("window_max"       , po::value<int>(&opt.window_max)->default_value(n_samples), "Last sample (excluded) of the signal window")
+      ("amp_bins"         , po::value<int>(&opt.amp_bins)->default_value(1000), "Amplitude spectrum bins")
+      ("amp_max"          , po::value<double>(&opt.amp_max)->default_value(4000.), "Amplitude spectrum maximum")
+      ("charge_bins"      , po::value<int>(&opt.charge_bins)->default_value(1000), "Charge spectrum bins")
+      ("charge_max"       , po::value<double>(&opt.charge_max)->default_value(100000.), "Charge spectrum maximum")
+      ;
+
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).options(desc).positional(pos).run(), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+      std::cout << desc << std::endl;
+      exit(1);
+    }
+    if (opt.polarity != -1 && opt.polarity != 1) throw std::invalid_argument("polarity must be -1 or 1");
+    if (opt.amp_bins < 1 || opt.charge_bins < 1) throw std::invalid_argument("spectra need at least one bin");
+  }
+  catch(std::exception& e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    std::cout << desc << std::endl;
+    exit(1);
+  }
+}
+
+bool
+expand_inputs(const options_t &opt, std::vector<std::string> &files)
+{
+  auto patterns = opt.inputs;
+  if (!opt.list.empty()) {
+    std::ifstream fin(opt.list);
+    if (!fin.is_open()) {
+      std::cout << " --- cannot open list file: " << opt.list << std::endl;
+      return false;
+    }
+    std::string line;
+    while (fin >> line) patterns.push_back(line);
+  }
+  for (const auto &pattern : patterns) {
+    glob_t g;
+    if (glob(pattern.c_str(), GLOB_NOCHECK, nullptr, &g) == 0)
+      for (size_t i = 0; i < g.gl_pathc; ++i) files.push_back(g.gl_pathv[i]);
+    globfree(&g);
+  }
+  if (files.empty()) {
+    std::cout << " --- no input files given " << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool
+load_calibration(const std::string &filename, calib_t &calib)
+{
+  std::cout << " --- loading calibration data: " << filename << std::endl;
+  auto fcalib = TFile::Open(filename.c_str());
+  if (!fcalib || !fcalib->IsOpen()) {
+    std::cout << " --- could not open file: " << filename << std::endl;
+    return false;
+  }
+  auto pcell = (TParameter<int> *)fcalib->Get("cell_indexed");
+  calib.cell_indexed = pcell && pcell->GetVal();
+  for (int igr = 0; igr < n_groups; ++igr) {
+    for (int ich = 0; ich < n_channels; ++ich) {
+      std::string name = "hCalib_gr" + std::to_string(igr) + "_ch" + std::to_string(ich);
+      auto hp0 = (TH1 *)fcalib->Get((name + "_p0").c_str());
+      auto hp1 = (TH1 *)fcalib->Get((name + "_p1").c_str());
+      calib.present[igr][ich] = hp0 && hp1;
+      if (!calib.present[igr][ich]) continue;
+      for (int i = 0; i < n_samples; ++i) {
+	calib.table[igr][ich][i][0] = hp0->GetBinContent(i + 1);
+	calib.table[igr][ich][i][1] = hp1->GetBinContent(i + 1);
+      }
+    }
+  }
+  fcalib->Close();
+  return true;
+}
+
+static void
+fill_hist(std::vector<double> &hist, double value, double max)
+{
+  int nbins = hist.size() - 2;
+  int bin = value < 0. ? 0 : value >= max ? nbins + 1 : 1 + (int)(value / max * nbins);
+  hist[std::min(bin, nbins + 1)] += 1.;
+}
+
+void
+analyse(rwf::file_t &f, const task_t &task, const options_t &opt, const calib_t &calib, result_t &result)
+{
+  float wave[n_samples];
+  for (int igr = 0; igr < n_groups; ++igr) {
+    for (int ich = 0; ich < n_channels; ++ich) {
+      if (!rwf::has_channel(f, igr, ich)) continue;
+      auto &res = result.at(igr, ich, opt);
+      /** one channel at a time, reads stay sequential within the tree **/
+      for (long long iev = task.first; iev < task.last; ++iev) {
+	if (!rwf::read(f, igr, ich, iev)) continue;
+	int size = std::min(f.size, n_samples);
+	for (int i = 0; i < size; ++i) {
+	  if (!calib.present[igr][ich]) {
+	    wave[i] = f.data[i];
+	    continue;
+	  }
+	  int icell = calib.cell_indexed ? (f.strt + i) % n_samples : i;
+	  auto &c = calib.table[igr][ich][icell];
+	  wave[i] = (f.data[i] - c[0]) / c[1];
+	}
+	res.length = std::max(res.length, size);
+	for (int i = 0; i < size; ++i) {
+	  res.wave_sum[i] += wave[i];
+	  res.wave_sum2[i] += wave[i] * wave[i];
+	}
+	moments_t base;
+	for (int i = 0; i < std::min(opt.baseline_samples, size); ++i) base.add(wave[i]);
+	double baseline = base.mean();
+	double amplitude = 0., charge = 0.;
+	for (int i = std::max(0, opt.window_min); i < std::min(opt.window_max, size); ++i) {
+	  double y = opt.polarity * (wave[i] - baseline);
+	  amplitude = std::max(amplitude, y);
+	  charge += y;
+	}
+	res.baseline.add(baseline);
+	res.noise.add(base.rms());
+	res.amplitude.add(amplitude);
+	res.charge.add(charge);
+	fill_hist(res.amp_hist, amplitude, opt.amp_max);
+	fill_hist(res.charge_hist, charge, opt.charge_max);
+      }
+    }
+  }
+}
+
+void
+summarise(int file, const result_t &result, std::vector<summary_t> &summary)
+{
+  for (int igr = 0; igr < n_groups; ++igr) {
+    for (int ich = 0; ich < n_channels; ++ich) {
+      auto &res = result.channels[igr][ich];
+      if (!res) continue;
+      summary.push_back({ file, igr, ich, (long long)res->amplitude.n,
+	    res->baseline.mean(), res->noise.mean(),
+	    res->amplitude.mean(), res->amplitude.rms(),
+	    res->charge.mean(), res->charge.rms() });
+    }
+  }
+}
+
+bool
+write_output(const options_t &opt, const std::vector<std::string> &files, const result_t &total, const std::vector<summary_t> &summary, bool calibrated)
+{
+  auto fout = TFile::Open(opt.output.c_str(), "RECREATE");
+  if (!fout || !fout->IsOpen()) {
+    std::cout << " --- cannot open output file: " << opt.output << std::endl;
+    return false;
+  }
+  std::string unit = calibrated ? "V" : "ADC";
+
+  std::cout << " --- channel      events     baseline        noise    amplitude       charge " << std::endl;
+  for (int igr = 0; igr < n_groups; ++igr) {
+    for (int ich = 0; ich < n_channels; ++ich) {
+      auto &res = total.channels[igr][ich];
+      if (!res) continue;
+      std::string name = "gr" + std::to_string(igr) + "_ch" + std::to_string(ich);
+      double n = res->amplitude.n;
+
+      /** average waveform, the error is the standard deviation of the mean **/
+      auto havg = new TH1D(("hAverage_" + name).c_str(), (name + ";cell number;amplitude (" + unit + ")").c_str(), res->length, 0., res->length);
+      for (int i = 0; i < res->length; ++i) {
+	if (n <= 0.) break;
+	double mean = res->wave_sum[i] / n;
+	double var = n > 1. ? std::max(0., (res->wave_sum2[i] - mean * res->wave_sum[i]) / (n - 1.)) : 0.;
+	havg->SetBinContent(i + 1, mean);
+	havg->SetBinError(i + 1, std::sqrt(var / n));
+      }
+      auto hamp = new TH1D(("hAmplitude_" + name).c_str(), (name + ";amplitude (" + unit + ");counts").c_str(), opt.amp_bins, 0., opt.amp_max);
+      for (size_t i = 0; i < res->amp_hist.size(); ++i) hamp->SetBinContent(i, res->amp_hist[i]);
+      hamp->SetEntries(n);
+      auto hcharge = new TH1D(("hCharge_" + name).c_str(), (name + ";charge (" + unit + " x sample);counts").c_str(), opt.charge_bins, 0., opt.charge_max);
+      for (size_t i = 0; i < res->charge_hist.size(); ++i) hcharge->SetBinContent(i, res->charge_hist[i]);
+      hcharge->SetEntries(n);
+      havg->Write();
+      hamp->Write();
+      hcharge->Write();
+
+      std::cout << " --- " << std::left << std::setw(8) << name << std::right
+		<< std::setw(12) << (long long)n
+		<< std::setw(13) << res->baseline.mean()
+		<< std::setw(13) << res->noise.mean()
+		<< std::setw(13) << res->amplitude.mean()
+		<< std::setw(13) << res->charge.mean() << std::endl;
+    }
+  }
+
+  /** per-file, per-channel summary table **/
+  auto tsummary = new TTree("summary", "rwaveana summary");
+  summary_t row;
+  char filename[1024];
+  tsummary->Branch("file", &row.file, "file/I");
+  tsummary->Branch("filename", filename, "filename/C");
+  tsummary->Branch("group", &row.group, "group/I");
+  tsummary->Branch("channel", &row.channel, "channel/I");
+  tsummary->Branch("n", &row.n, "n/L");
+  tsummary->Branch("baseline", &row.baseline, "baseline/D");
+  tsummary->Branch("noise", &row.noise, "noise/D");
+  tsummary->Branch("amplitude", &row.amplitude, "amplitude/D");
+  tsummary->Branch("amplitude_rms", &row.amplitude_rms, "amplitude_rms/D");
+  tsummary->Branch("charge", &row.charge, "charge/D");
+  tsummary->Branch("charge_rms", &row.charge_rms, "charge_rms/D");
+  for (const auto &entry : summary) {
+    row = entry;
+    std::strncpy(filename, files[row.file].c_str(), sizeof(filename) - 1);
+    filename[sizeof(filename) - 1] = '\0';
+    tsummary->Fill();
+  }
+  tsummary->Write();
+  TParameter<int>("calibrated", calibrated).Write();
+  fout->Close();
+  std::cout << " --- output written to " << opt.output << std::endl;
+  return true;
+}
@@ -0,0 +1,347 @@
+#include <boost/program_options.hpp>
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <unistd.h>
+#include "rwavefile.hh"
+#include "rwavenet.hh"
+#include "TROOT.h"
+#include "TFile.h"
+#include "TH1F.h"
+#include "TParameter.h"
+
+/** DRS4 amplitude calibration builder.
+    accumulates the per-cell (start-cell rotated) ADC mean of pedestal and
+    DC-level runs and fits, for each cell, ADC = p0 + p1 * V. the output
+    file holds the hCalib_gr[N]_ch[M]_p0/p1 histograms read by
+    rwavedump::calibrate, indexed by DRS4 cell **/
+
+const int n_cells = rwf::max_length;
+
+/** running mean and variance **/
+struct welford_t {
+  double n = 0., mean = 0., m2 = 0.;
+  void add(double x) {
+    n += 1.;
+    double delta = x - mean;
+    mean += delta / n;
+    m2 += delta * (x - mean);
+  };
+  void merge(const welford_t &other) {
+    if (other.n == 0.) return;
+    double total = n + other.n;
+    double delta = other.mean - mean;
+    mean += delta * other.n / total;
+    m2 += other.m2 + delta * delta * n * other.n / total;
+    n = total;
+  };
+  double variance() const { return n > 1. ? m2 / (n - 1.) : 0.; };
+};
+
+/** accumulators of one run, one per group/channel/cell **/
+struct accumulator_t {
+  std::vector<welford_t> cells = std::vector<welford_t>(rwf::max_groups * rwf::max_channels * n_cells);
+  welford_t &at(int group, int channel, int cell) { return cells[(group * rwf::max_channels + channel) * n_cells + cell]; };
+  void merge(const accumulator_t &other) {
+    for (size_t i = 0; i < cells.size(); ++i) cells[i].merge(other.cells[i]);
+  };
+  void add(int group, int channel, uint16_t strt, const float *data, int size) {
+    welford_t *acc = &cells[(group * rwf::max_channels + channel) * n_cells];
+    for (int i = 0; i < size; ++i)
+      acc[(strt + i) % n_cells].add(data[i]);
+  };
+};
+
+struct run_t {
+  std::string source;
+  double voltage = 0.;
+  accumulator_t acc;
+};
+
+struct options_t {
+  std::string output;
+  std::vector<std::string> runs;
+  int threads = 0;
+  double gain = 4096.;      // nominal ADC counts per volt, used with a single level
+  int live_events = 10000;
+  int frequency = 5000;
+  int channel_mask = 0xFFFF;
+};
+
+void process_program_options(int argc, char *argv[], options_t &opt);
+bool parse_run(const std::string &spec, run_t &run);
+bool accumulate_file(run_t &run, int nthreads);
+bool accumulate_live(run_t &run, const options_t &opt, int nthreads);
+bool write_calibration(std::vector<run_t> &runs, const options_t &opt);
+
+int main(int argc, char *argv[])
+{
+  std::cout << " --- welcome to rwavecalib " << std::endl;
+  options_t opt;
+  process_program_options(argc, argv, opt);
+  int nthreads = opt.threads > 0 ? opt.threads : std::max(1u, std::thread::hardware_concurrency());
+  ROOT::EnableThreadSafety();
+
+  std::vector<run_t> runs(opt.runs.size());
+  for (size_t irun = 0; irun < runs.size(); ++irun)
+    if (!parse_run(opt.runs[irun], runs[irun])) return 1;
+
+  auto t_start = std::chrono::steady_clock::now();
+  for (auto &run : runs) {
+    std::cout << " --- accumulating run: " << run.source << " at " << run.voltage << " V " << std::endl;
+    bool live = run.source.find("live://") == 0;
+    if (!(live ? accumulate_live(run, opt, nthreads) : accumulate_file(run, nthreads))) return 1;
+  }
+  if (!write_calibration(runs, opt)) return 1;
+  auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+  std::cout << " --- calibration done in " << elapsed << " s with " << nthreads << " threads " << std::endl;
+  return 0;
+}
+
+void
+process_program_options(int argc, char *argv[], options_t &opt)
+{
+  /** process arguments **/
+  namespace po = boost::program_options;
+  po::options_description desc("Options");
+  try {
+    desc.add_options()
+      ("help"             , "Print help messages")
+      ("output"           , po::value<std::string>(&opt.output)->required(), "Output calibration filename")
+      ("run"              , po::value<std::vector<std::string>>(&opt.runs)->required(), "Calibration run [file.root:volts] or [live://host:port:volts], repeat for each level")
+      ("threads"          , po::value<int>(&opt.threads)->default_value(0), "Number of threads (0 = all cores)")
+      ("gain"             , po::value<double>(&opt.gain)->default_value(4096.), "Nominal gain (ADC/V), used when a single level is given")
+      ("live_events"      , po::value<int>(&opt.live_events)->default_value(10000), "Number of events per live run")
+      ("frequency"        , po::value<int>(&opt.frequency)->default_value(5000), "DRS4 sampling frequency (MHz) of live runs")
+      ("channel_mask"     , po::value<int>(&opt.channel_mask)->default_value(0xFFFF), "Channel mask of live runs")
+      ;
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+      std::cout << desc << std::endl;
+      exit(1);
+    }
+  }
+  catch(std::exception& e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    std::cout << desc << std::endl;
+    exit(1);
+  }
+}
+
+bool
+parse_run(const std::string &spec, run_t &run)
+{
+  auto colon = spec.rfind(':');
+  if (colon == std::string::npos) {
+    std::cout << " --- invalid run, expected [source:volts]: " << spec << std::endl;
+    return false;
+  }
+  run.source = spec.substr(0, colon);
+  try {
+    run.voltage = std::stod(spec.substr(colon + 1));
+  }
+  catch (std::exception &e) {
+    std::cout << " --- invalid run voltage: " << spec << std::endl;
+    return false;
+  }
+  return true;
+}
+
+/** split the events of a file across threads, each with its own file handle and accumulators **/
+bool
+accumulate_file(run_t &run, int nthreads)
+{
+  rwf::file_t f;
+  if (!rwf::open(f, run.source)) return false;
+  auto n_events = f.n_events;
+  rwf::close(f);
+  std::cout << " --- " << n_events << " events " << std::endl;
+
+  std::vector<accumulator_t> accs(nthreads);
+  std::vector<std::thread> workers;
+  std::vector<char> ok(nthreads, 1);
+  for (int ith = 0; ith < nthreads; ++ith) {
+    workers.emplace_back([&, ith] {
+      long long first = n_events * ith / nthreads;
+      long long last = n_events * (ith + 1) / nthreads;
+      rwf::file_t f;
+      if (!rwf::open(f, run.source)) {
+	ok[ith] = 0;
+	return;
+      }
+      for (long long iev = first; iev < last; ++iev) {
+	for (int igr = 0; igr < rwf::max_groups; ++igr) {
+	  for (int ich = 0; ich < rwf::max_channels; ++ich) {
+	    if (!rwf::read(f, igr, ich, iev)) continue;
+	    accs[ith].add(igr, ich, f.strt, f.data, f.size);
+	  }
+	}
+      }
+      rwf::close(f);
+    });
+  }
+  for (auto &worker : workers) worker.join();
+
+  /** merge in thread order, for reproducible results **/
+  for (int ith = 0; ith < nthreads; ++ith) {
+    if (!ok[ith]) return false;
+    run.acc.merge(accs[ith]);
+  }
+  return true;
+}
+
+/** acquire from rwaveserver, accumulate each downloaded block in parallel over events **/
+bool
+accumulate_live(run_t &run, const options_t &opt, int nthreads)
+{
+  auto address = run.source.substr(7);
+  auto colon = address.rfind(':');
+  std::string host = colon == std::string::npos ? address : address.substr(0, colon);
+  int port = colon == std::string::npos ? 30001 : std::stoi(address.substr(colon + 1));
+  int fd = net::connect(host, port);
+  if (fd < 0) return false;
+
+  std::string reply;
+  int grmask = (opt.channel_mask & 0xFF ? 0x1 : 0x0) | (opt.channel_mask & 0xFF00 ? 0x2 : 0x0);
+  /** the v1 download below expects raw, unfiltered events in event-major layout **/
+  for (auto cmd : { "sampling " + std::to_string(opt.frequency),
+	"grmask " + std::to_string(grmask),
+	"chmask " + std::to_string(opt.channel_mask),
+	std::string("layout event"),
+	std::string("resample off"),
+	std::string("filter off"),
+	std::string("start") }) {
+    if (!net::command(fd, cmd, reply)) return false;
+    std::cout << " [SERVER] " << reply << std::endl;
+    if (reply.find("[ERROR]") == 0 || reply.find("cannot") == 0) {
+      net::command(fd, "stop", reply);
+      ::close(fd);
+      return false;
+    }
+  }
+
+  struct header_t { uint16_t n_events, n_channels, record_length, frequency; } header;
+  std::vector<uint8_t> channels;
+  std::vector<uint32_t> trigger_tags;
+  std::vector<uint16_t> start_cells;
+  std::vector<float> buffer;
+  std::vector<accumulator_t> accs(nthreads);
+  int collected = 0;
+  while (collected < opt.live_events) {
+    if (!net::command(fd, "swtrg 1024", reply)) return false;
+    if (!net::command(fd, "readout", reply)) return false;
+    if (reply.find("readout completed") != 0) {
+      std::cout << " [SERVER] " << reply << std::endl;
+      continue;
+    }
+    if (!net::command(fd, "download", reply)) return false;
+    if (!net::recv_all(fd, &header, sizeof(header))) return false;
+    channels.resize(header.n_channels);
+    trigger_tags.resize(header.n_events * 2);
+    start_cells.resize(header.n_events * 2);
+    buffer.resize((size_t)header.n_events * header.n_channels * header.record_length);
+    if (!net::recv_all(fd, channels.data(), channels.size()) ||
+	!net::recv_all(fd, trigger_tags.data(), trigger_tags.size() * sizeof(uint32_t)) ||
+	!net::recv_all(fd, start_cells.data(), start_cells.size() * sizeof(uint16_t)) ||
+	!net::recv_all(fd, buffer.data(), buffer.size() * sizeof(float))) return false;
+
+    std::vector<std::thread> workers;
+    for (int ith = 0; ith < nthreads; ++ith) {
+      workers.emplace_back([&, ith] {
+	int first = header.n_events * ith / nthreads;
+	int last = header.n_events * (ith + 1) / nthreads;
+	for (int iev = first; iev < last; ++iev) {
+	  for (int ich = 0; ich < header.n_channels; ++ich) {
+	    /** ids 16 and 17 are the digitized TR0/TR1, channel 8 of their group **/
+	    int id = channels[ich];
+	    int group = id < 16 ? id / 8 : id - 16, channel = id < 16 ? id % 8 : 8;
+	    const float *data = &buffer[((size_t)iev * header.n_channels + ich) * header.record_length];
+	    accs[ith].add(group, channel, start_cells[iev * 2 + group], data, header.record_length);
+	  }
+	}
+      });
+    }
+    for (auto &worker : workers) worker.join();
+    collected += header.n_events;
+    std::cout << " --- collected " << collected << " events " << std::endl;
+  }
+  net::command(fd, "stop", reply);
+  ::close(fd);
+
+  for (auto &acc : accs) run.acc.merge(acc);
+  return true;
+}
+
+bool
+write_calibration(std::vector<run_t> &runs, const options_t &opt)
+{
+  auto fout = TFile::Open(opt.output.c_str(), "RECREATE");
+  if (!fout || !fout->IsOpen()) {
+    std::cout << " --- cannot open output file: " << opt.output << std::endl;
+    return false;
+  }
+  if (runs.size() < 2)
+    std::cout << " --- single level given, using nominal gain " << opt.gain << " ADC/V " << std::endl;
+
+  /** the pedestal noise is taken from the level closest to 0 V **/
+  size_t ipedestal = 0;
+  for (size_t irun = 1; irun < runs.size(); ++irun)
+    if (std::fabs(runs[irun].voltage) < std::fabs(runs[ipedestal].voltage)) ipedestal = irun;
+
+  for (int igr = 0; igr < rwf::max_groups; ++igr) {
+    for (int ich = 0; ich < rwf::max_channels; ++ich) {
+      /** a channel is calibrated only when every level has data for it **/
+      size_t n_present = 0;
+      for (auto &run : runs) {
+	bool present = false;
+	for (int icell = 0; icell < n_cells && !present; ++icell)
+	  present = run.acc.at(igr, ich, icell).n > 0.;
+	if (present) ++n_present;
+      }
+      if (n_present == 0) continue;
+      std::string name = "gr" + std::to_string(igr) + "_ch" + std::to_string(ich);
+      if (n_present != runs.size()) {
+	std::cout << " --- skipping " << name << ", present in " << n_present << " of " << runs.size() << " runs " << std::endl;
+	continue;
+      }
+      auto hp0 = new TH1F(("hCalib_" + name + "_p0").c_str(), (name + ";cell;offset (ADC)").c_str(), n_cells, 0., n_cells);
+      auto hp1 = new TH1F(("hCalib_" + name + "_p1").c_str(), (name + ";cell;gain (ADC/V)").c_str(), n_cells, 0., n_cells);
+      auto hnoise = new TH1F(("hNoise_" + name).c_str(), (name + ";cell;pedestal RMS (ADC)").c_str(), n_cells, 0., n_cells);
+      for (int icell = 0; icell < n_cells; ++icell) {
+	/** least-squares line through the per-level cell means **/
+	double sv = 0., sm = 0., svv = 0., svm = 0., k = 0.;
+	for (auto &run : runs) {
+	  auto &w = run.acc.at(igr, ich, icell);
+	  if (w.n == 0.) continue;
+	  sv += run.voltage;
+	  sm += w.mean;
+	  svv += run.voltage * run.voltage;
+	  svm += run.voltage * w.mean;
+	  k += 1.;
+	}
+	double p1 = opt.gain, p0 = 0.;
+	if (k >= 2. && k * svv - sv * sv != 0.) p1 = (k * svm - sv * sm) / (k * svv - sv * sv);
+	if (k > 0.) p0 = (sm - p1 * sv) / k;
+	auto &ped = runs[ipedestal].acc.at(igr, ich, icell);
+	hp0->SetBinContent(icell + 1, p0);
+	hp1->SetBinContent(icell + 1, p1);
+	hnoise->SetBinContent(icell + 1, std::sqrt(ped.variance()));
+      }
+      std::cout << " --- writing calibration for " << name << std::endl;
+      hp0->Write();
+      hp1->Write();
+      hnoise->Write();
+    }
+  }
+  /** tells rwavedump::calibrate that the tables are indexed by DRS4 cell, not by sample **/
+  TParameter<int>("cell_indexed", 1).Write();
+  fout->Close();
+  return true;
+}
@@ -1,31 +1,36 @@
 #pragma once
 
+#include "rwaveformat.hh"
+
 /** send "readout [nevents]" command
     receive number of readout events
     then receive all the data and deal with it **/
 
 namespace data {
 
-const int max_events = 1024;
-const int max_groups = 2;
-const int max_channels = 8;
-const int max_length = 1024;
-  
-struct header_t {
-  uint16_t n_events;
-  uint16_t n_channels;
-  uint16_t record_length;
-  uint16_t frequency;
-} header;
+header_t header;
+
+/** layout built by fill_buffer, selected with the "layout" command **/
+int layout = layout_event;
+/** layout of the data currently in the buffer **/
+int buffer_layout = layout_event;
+/** events reserved per channel in the channel-major layout of the current readout **/
+int slot_events = 0;
+uint8_t group_mask;
 
 uint32_t trigger_tags[max_events][max_groups];
+/** unwrapped tags (8.5 ns ticks since the start) sent in v2 blocks, and the wall clock of the block **/
+uint64_t trigger_tags64[max_events][max_groups];
+uint64_t host_ns;
+/** grid step of the resampled data in the buffer (ps), 0 = not resampled **/
+uint16_t sample_step_ps = 0;
 uint16_t start_cells[max_events][max_groups];
   
-uint8_t channels[max_groups * max_channels];
-bool has_channel[max_groups * max_channels];
+uint8_t channels[max_ids];
+bool has_channel[max_ids];
    
 int buffer_size;
-float buffer[max_events * max_groups * max_channels * max_length];
+float buffer[max_events * max_ids * max_length];
 
 
 }
@@ -1,63 +1,172 @@
 #include <boost/program_options.hpp>
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+#include <spawn.h>
+#include <sys/wait.h>
 #include "rwavelib.hh"
+#include "rwavert.hh"
+#include "rwavestats.hh"
+#include "rwaveresample.hh"
 #include "TFile.h"
 #include "TTree.h"
+#include "TParameter.h"
 
 using namespace dgz;
 
+extern char **environ;
+
+/** continuous runs: rollover to numbered files, hand-off of the finished ones **/
+struct rollover_t {
+  bool continuous = false;      // run until SIGINT/SIGTERM
+  int events = 0;               // rollover after this many events, 0 = no limit
+  double mb = 0.;               // rollover after this file size (MB), 0 = no limit
+  double seconds = 0.;          // rollover after this time (s), 0 = no limit
+  double memory_mb = 256.;      // bound of the buffered baskets and of the time index
+  double autosave_mb = 64.;     // write the tree headers every this many MB
+  std::string on_complete;      // run "<command> <file>" for every finished file
+  std::string manifest;         // append one line for every finished file
+  bool numbered() const { return continuous || events > 0 || mb > 0. || seconds > 0.; }
+};
+
 // tree stuff
 struct output_t {
   std::string output;
+  rollover_t roll;
+  int number = 0;               // of the current file, numbered output only
+  std::string filename;         // current file
+  Long64_t file_events = 0;
+  uint64_t file_start = 0;      // stats::now() at the opening of the current file
   TFile *fout = nullptr;
   TTree *tout[MAX_X742_GROUP_SIZE][MAX_X742_CHANNEL_SIZE] = {nullptr};
   int size;
   uint32_t ttag; // trigger time tag
+  uint64_t ttag64; // unwrapped trigger time tag, 8.5 ns ticks since the start
+  uint64_t host; // wall clock of the block transfer (ns since the epoch)
+  uint64_t mono; // monotonic clock of the block transfer, for the tag unwrapping
   uint16_t strt; // start index cell
   float data[1024];
+  /** resampling onto a uniform time grid **/
+  resample::options_t resample;
+  resample::resampler_t resampler;
+  float scratch[1024];
+  /** time index: ttag64, host, entry of every event, sorted by ttag64 when written **/
+  struct index_t { uint64_t ttag64, host; Long64_t entry; };
+  std::vector<index_t> index;
+};
+
+struct tune_t {
+  bool enabled = false;
+  tune_options_t opt;
+};
+
+struct stats_t {
+  std::string file;
+  double interval = 10.;
+};
+
+struct logging_t {
+  std::string level = "info";
+  logger::options_t opt;
 };
 
-void process_program_options(int argc, char *argv[], options_t &opt, output_t &out);
+void process_program_options(int argc, char *argv[], options_t &opt, output_t &out, tune_t &tune, rt::options_t &rtopt, stats_t &st, logging_t &lg);
 
-bool readout(digitizer_t &dgz, output_t &out);
+bool readout(digitizer_t &dgz, output_t &out, const rt::options_t &rtopt);
 
 bool init_output(output_t &out);
 bool fill_output(digitizer_t &dgz, output_t &out);
 bool write_output(output_t &out);
+bool write_index(output_t &out);
+bool rollover_due(const output_t &out);
+bool rollover(output_t &out);
+bool complete_output(const output_t &out, const output_t::index_t *first, const output_t::index_t *last);
+
+/** set by SIGINT/SIGTERM, ends the readout at the next block **/
+static std::atomic<bool> stop_requested{false};
+
+static void
+on_signal(int sig)
+{
+  stop_requested = true;
+  /** a second signal kills as usual **/
+  std::signal(sig, SIG_DFL);
+}
 
 int main(int argc, char *argv[])
 {
-  std::cout << " --- welcome to rwavedump " << std::endl;
+  log("welcome to rwavedump");
   digitizer_t dgz;
   output_t out;
-  process_program_options(argc, argv, dgz.opt, out);
+  tune_t tuner;
+  rt::options_t rtopt;
+  stats_t st;
+  logging_t lg;
+  process_program_options(argc, argv, dgz.opt, out, tuner, rtopt, st, lg);
+  if (!logger::start(lg.opt)) {     /** log from a background thread **/
+    error("cannot open log file: " << lg.opt.file);
+    return 1;
+  }
 
   if (!init_output(out))            /** initialize output **/
     return 1;
+  std::signal(SIGINT, on_signal);   /** stop cleanly, writing the output **/
+  std::signal(SIGTERM, on_signal);
   
   open(dgz);                        /** open digitizer **/
   config(dgz);                      /** configure digitizer **/
 
-  start(dgz);                       /** start acquisition **/
-  readout(dgz, out);                /** readout data **/
+  if (out.resample.method != kern::interp_off &&   /** cell times for the resampling **/
+      !resample::setup(out.resampler, out.resample, dgz.handle, dgz.opt.frequency, dgz.opt.record_length))
+    return 1;
+
+  if (tuner.enabled) {              /** tune readout settings **/
+    std::vector<tune_point_t> curve;
+    tune_point_t best;
+    if (!tune(dgz, tuner.opt, curve, best)) log("tuning failed, keeping the configured settings");
+  }
+
+  if (!st.file.empty())             /** periodic statistics file **/
+    stats::start_file(st.file, st.interval);
+
+  if (!start(dgz)) {                /** start acquisition **/
+    close(dgz);
+    return 1;
+  }
+  readout(dgz, out, rtopt);         /** readout data **/
   stop(dgz);                        /** stop acquisition **/
 
-  write_output(out);                /** write output data **/
+  {
+    stats::scope_t timer(stats::stage_write);
+    write_output(out);              /** write output data **/
+  }
   close(dgz);                       /** close digitizer **/
+  while (waitpid(-1, nullptr, WNOHANG) > 0);
+
+  stats::stop_file();
+  stats::snapshot_t snap;
+  stats::snapshot(snap);
+  log("statistics: " << stats::describe(snap, nullptr));
   
   return 0;
 }
 
 void
-process_program_options(int argc, char *argv[], options_t &opt, output_t &out)
+process_program_options(int argc, char *argv[], options_t &opt, output_t &out, tune_t &tune, rt::options_t &rtopt, stats_t &st, logging_t &lg)
 {
   /** process arguments **/
   namespace po = boost::program_options;
   po::options_description desc("Options");
+  std::string resample_method;
   try {
     desc.add_options()
       ("help"             , "Print help messages")
       ("output"           , po::value<std::string>(&out.output)->required(), "Output data filename")      
-      ("nevents"          , po::value<int>(&opt.nevents)->required(), "Number of events to readout")
+      ("nevents"          , po::value<int>(&opt.nevents)->default_value(0), "Number of events to readout (0 = no limit, with --continuous)")
       ("frequency"        , po::value<int>(&opt.frequency)->required(), "DRS4 sampling frequency (MHz)")
       ("max_blt"          , po::value<int>(&opt.max_blt)->default_value(1024), "Maximum number of events for BLT transfer")
       ("record_length"    , po::value<int>(&opt.record_length)->default_value(1024), "Acquisition record length")
@@ -65,9 +174,36 @@ process_program_options(int argc, char *argv[], options_t &opt, output_t &out)
       ("trigger_thr"      , po::value<int>(&opt.trigger_thr)->default_value(20934), "Fast trigger threshold")
       ("trigger_sw"       , po::value<int>(&opt.trigger_sw)->default_value(0), "Send software triggers")
       ("trigger_sw_usleep" , po::value<int>(&opt.trigger_sw_usleep)->default_value(1000), "Delay between software triggers (microseconds)")
+      ("trigger_ext"      , po::value<bool>(&opt.trigger_ext)->default_value(true), "Trigger on the external input")
+      ("trigger_fast"     , po::bool_switch(&opt.trigger_fast), "Trigger on the TR0/TR1 fast trigger inputs, digitized as channel 8")
+      ("trigger_polarity" , po::value<int>(&opt.trigger_polarity)->default_value(0), "Fast and self-trigger edge (0 = rising, 1 = falling)")
+      ("self_trigger_mask", po::value<int>(&opt.self_trigger_mask)->default_value(0), "Channels (group * 8 + channel) generating a self-trigger")
+      ("self_trigger_thr" , po::value<int>(&opt.self_trigger_thr)->default_value(2048), "Self-trigger threshold (ADC counts)")
+      ("trigger_majority" , po::value<int>(&opt.trigger_majority)->default_value(1), "Group self-triggers required to trigger the board (1 = OR, 2 = AND)")
       ("channel_mask"     , po::value<int>(&opt.channel_mask)->default_value(0x01FF01FF), "Output save channel mask")
       ("readout_msleep"   , po::value<int>(&opt.readout_msleep)->default_value(1), "Readout sleep (ms)")
       ("readout_timeout"  , po::value<int>(&opt.readout_timeout)->default_value(1000), "Readout timeout (ms)")
+      ("readout_irq"      , po::value<int>(&opt.readout_irq)->default_value(0), "Wait for IRQ with this event threshold instead of polling (0 = poll)")
+      ("tune"             , po::bool_switch(&tune.enabled), "Tune max_blt and polling/IRQ before the readout, apply the best setting")
+      ("tune_seconds"     , po::value<double>(&tune.opt.seconds)->default_value(1.), "Measurement time per tuning point (s)")
+      ("rt"               , po::bool_switch(&rtopt.enabled), "Real-time readout: SCHED_FIFO, locked and prefaulted memory, no per-BLT logging")
+      ("rt_cpu"           , po::value<int>(&rtopt.cpu)->default_value(-1), "Pin the readout to this CPU in real-time mode (-1 = no pinning)")
+      ("rt_priority"      , po::value<int>(&rtopt.priority)->default_value(50), "SCHED_FIFO priority in real-time mode (0 = default scheduler)")
+      ("rt_hugepages"     , po::bool_switch(&rtopt.hugepages), "Back the readout buffer with transparent hugepages in real-time mode")
+      ("stats_file"       , po::value<std::string>(&st.file), "Rewrite this file with \"name value\" statistics lines during the readout")
+      ("stats_interval"   , po::value<double>(&st.interval)->default_value(10.), "Statistics file update period (s)")
+      ("log_level"        , po::value<std::string>(&lg.level)->default_value("info"), "Log level (debug, info, warning, error)")
+      ("log_file"         , po::value<std::string>(&lg.opt.file), "Also write the log to this file, with timestamps")
+      ("resample"         , po::value<std::string>(&resample_method)->default_value("off"), "Resample the records onto a uniform time grid (off, linear, cubic)")
+      ("resample_step"    , po::value<float>(&out.resample.step)->default_value(0.), "Resampling grid step (ns, 0 = nominal sampling period)")
+      ("continuous"       , po::bool_switch(&out.roll.continuous), "Run until SIGINT/SIGTERM, with numbered output files")
+      ("rollover_events"  , po::value<int>(&out.roll.events)->default_value(0), "Start a new numbered file after this many events (0 = no limit)")
+      ("rollover_mb"      , po::value<double>(&out.roll.mb)->default_value(0.), "Start a new numbered file after this file size (MB, 0 = no limit)")
+      ("rollover_seconds" , po::value<double>(&out.roll.seconds)->default_value(0.), "Start a new numbered file after this time (s, 0 = no limit)")
+      ("memory_mb"        , po::value<double>(&out.roll.memory_mb)->default_value(256.), "Memory bound of the buffered trees and time index (MB), numbered files roll over to keep it")
+      ("autosave_mb"      , po::value<double>(&out.roll.autosave_mb)->default_value(64.), "Write the tree headers every this many MB, readable after a crash")
+      ("on_complete"      , po::value<std::string>(&out.roll.on_complete), "Run this shell command with the name of every finished file as argument")
+      ("manifest"         , po::value<std::string>(&out.roll.manifest), "Append one line for every finished file to this manifest")
       ;
     
     po::variables_map vm;
@@ -78,6 +214,19 @@ process_program_options(int argc, char *argv[], options_t &opt, output_t &out)
       std::cout << desc << std::endl;
       exit(1);
     }
+    tune.opt.trigger_sw = opt.trigger_sw > 0;
+    if (!kern::parse_interp(resample_method, out.resample.method))
+      throw std::runtime_error("invalid resampling method: " + resample_method);
+    if (out.resample.step != 0. && (out.resample.step < resample::min_step || out.resample.step > resample::max_step))
+      throw std::runtime_error("--resample_step must be 0 or within [0.001, 65.535] ns");
+    if (opt.trigger_majority < 1 || opt.trigger_majority > 2)
+      throw std::runtime_error("--trigger_majority must be within [1, 2], the number of groups");
+    if (!out.roll.continuous && opt.nevents <= 0)
+      throw std::runtime_error("--nevents is required without --continuous");
+    if (out.roll.memory_mb <= 0. || out.roll.autosave_mb <= 0.)
+      throw std::runtime_error("--memory_mb and --autosave_mb must be positive");
+    if (!logger::parse_level(lg.level, lg.opt.level))
+      throw std::runtime_error("invalid log level: " + lg.level);
   }
   catch(std::exception& e) {
     std::cerr << "Error: " << e.what() << std::endl;
@@ -87,88 +236,239 @@ process_program_options(int argc, char *argv[], options_t &opt, output_t &out)
 }
 
 bool
-readout(digitizer_t &dgz, output_t &out)
+readout(digitizer_t &dgz, output_t &out, const rt::options_t &rtopt)
 {
 
   auto opt = dgz.opt;
-  std::uint32_t buffer_size = 0, num_events = 0, tot_events = 0;
+  std::uint32_t buffer_size = 0, num_events = 0;
+  uint64_t tot_events = 0;
+  auto limit = [&]() { return opt.nevents > 0 && tot_events >= (uint64_t)opt.nevents; };
 
-  std::cout << " --- readout data " << std::endl;
-  while (tot_events < opt.nevents) {
+  log("readout data");
+  if (rtopt.enabled) {
+    log("real-time readout: " << rt::describe(rtopt));
+    rt::lock_memory(true);
+    rt::prefault(dgz.buffer, dgz.allocated_size, rtopt.hugepages);
+  }
+  rt::scope_t rt_scope(rtopt);
+  while (!stop_requested && !limit()) {
   
     /** send software triggers **/
     for (int iswtrg = 0; iswtrg < opt.trigger_sw; ++iswtrg) {
       if (CAEN_DGTZ_SendSWtrigger(dgz.handle))  error("CAEN_DGTZ_SendSWtrigger");
+      stats::add(stats::counter_triggers);
       usleep(opt.trigger_sw_usleep);
     }
 
-    /** poll for event ready **/
-    bool timeout = true;
-    for (int ipoll = 0; ipoll < opt.readout_timeout; ipoll += opt.readout_msleep) {
-      msleep(opt.readout_msleep);
-      if (!event_ready(dgz)) continue;
-      //      if (!event_full(dgz)) continue;
-      timeout = false;
-      break;
-    }
-
-    /** check readout timeout **/
-    if (timeout) {
-      std::cout << " --- readout timeout " << std::endl;
-      break;
+    /** wait for event ready **/
+    if (!wait_event(dgz, opt.readout_timeout)) {
+      if (!out.roll.continuous) {
+	log("readout timeout");
+	break;
+      }
+      /** no triggers for a while is normal in a continuous run **/
+      debug("readout timeout");
+      if (rollover_due(out)) {
+	stats::scope_t timer(stats::stage_write);
+	if (!rollover(out)) return false;
+      }
+      continue;
     }
   
     /** data available to be read **/
-    if (CAEN_DGTZ_ReadData(dgz.handle, CAEN_DGTZ_SLAVE_TERMINATED_READOUT_MBLT, dgz.buffer, &buffer_size))  error("CAEN_DGTZ_ReadData");
+    {
+      stats::scope_t timer(stats::stage_readout);
+      if (CAEN_DGTZ_ReadData(dgz.handle, CAEN_DGTZ_SLAVE_TERMINATED_READOUT_MBLT, dgz.buffer, &buffer_size))  error("CAEN_DGTZ_ReadData");
+    }
     if (CAEN_DGTZ_GetNumEvents(dgz.handle, dgz.buffer, buffer_size, &num_events))  error("CAEN_DGTZ_GetNumEvents");
-    std::cout << " --- readout " << num_events << " events " << std::endl;
+    out.host = host_ns();
+    out.mono = mono_ns();
+    if (num_events > 0) stats::add(stats::counter_blocks);
+    stats::add(stats::counter_events, num_events);
+    stats::add(stats::counter_bytes_read, buffer_size);
+    if (!rtopt.enabled) log("readout " << num_events << " events");
 
     /** decode events and write to file **/
     CAEN_DGTZ_EventInfo_t event_info;
     char *event_ptr = nullptr;
-    for (int iev = 0; iev < num_events && tot_events < opt.nevents; ++iev) {
+    uint64_t decode_ns = 0;
+    for (int iev = 0; iev < num_events && !limit(); ++iev) {
+      auto t_decode = stats::now();
       if (CAEN_DGTZ_GetEventInfo(dgz.handle, dgz.buffer, buffer_size, iev, &event_info, &event_ptr))  error("CAEN_DGTZ_GetEventInfo");
       if (CAEN_DGTZ_DecodeEvent(dgz.handle, event_ptr, (void **)&dgz.event))  error("CAEN_DGTZ_DecodeEvent");
+      decode_ns += stats::now() - t_decode;
+      /** close the file and open the next one **/
+      if (rollover_due(out)) {
+	stats::scope_t timer(stats::stage_write);
+	if (!rollover(out)) return false;
+      }
       /** fill output tree **/
+      stats::scope_t timer(stats::stage_fill);
       fill_output(dgz, out);
+      ++out.file_events;
       ++tot_events;
     }
+    if (num_events > 0) stats::record(stats::stage_decode, decode_ns);
     
   }
 
-  std::cout << " --- readout done: collected " << tot_events << " events " << std::endl;
+  if (stop_requested) log("readout stopped by signal");
+  log("readout done: collected " << tot_events << " events");
   
   return true;
 }
 
+/** "run.root" becomes "run_0000.root", "run_0001.root", ... with numbered output **/
+static std::string
+output_filename(const output_t &out)
+{
+  if (!out.roll.numbered()) return out.output;
+  auto base = out.output;
+  const std::string ext = ".root";
+  if (base.size() > ext.size() && base.compare(base.size() - ext.size(), ext.size(), ext) == 0)
+    base.resize(base.size() - ext.size());
+  char number[16];
+  snprintf(number, sizeof(number), "_%04d", out.number);
+  return base + number + ext;
+}
+
+/** most events that keep the time index within a quarter of the memory bound **/
+static size_t
+max_index_events(const rollover_t &roll)
+{
+  return roll.memory_mb * 1048576. / 4. / sizeof(output_t::index_t);
+}
+
 bool
 init_output(output_t &out)
 {
-  auto filename = out.output;
+  auto filename = output_filename(out);
   out.fout = TFile::Open(filename.c_str(), "RECREATE");
   if (!out.fout || !out.fout->IsOpen()) {
-    std::cout << " --- cannot open output file: " << filename << std::endl;
+    log("cannot open output file: " << filename);
     return false;
   }
+  out.filename = filename;
+  out.file_events = 0;
+  out.file_start = stats::now();
+  out.index.clear();
+  out.index.reserve(std::min<size_t>(max_index_events(out.roll), 1 << 20));
   return true;
 }
 
+/** time to move to the next file: never with single file output, never on an empty file **/
+bool
+rollover_due(const output_t &out)
+{
+  auto &roll = out.roll;
+  if (!roll.numbered() || out.file_events == 0) return false;
+  if (roll.events > 0 && out.file_events >= roll.events) return true;
+  if (roll.mb > 0. && out.fout->GetEND() >= roll.mb * 1048576.) return true;
+  if (roll.seconds > 0. && (stats::now() - out.file_start) * 1.e-9 >= roll.seconds) return true;
+  return out.index.size() >= max_index_events(roll);
+}
+
+bool
+rollover(output_t &out)
+{
+  if (!write_output(out)) return false;
+  ++out.number;
+  return init_output(out);
+}
+
 bool
 write_output(output_t &out)
 {
-  auto filename = out.output;
+  auto filename = out.filename;
   if (!out.fout || !out.fout->IsOpen()) return false;
   out.fout->cd();
-  std::cout << " --- writing output: " << filename << std::endl;
+  log("writing output: " << filename);
   for (int igr = 0; igr < MAX_X742_GROUP_SIZE; ++igr) {
     for (int ich = 0; ich < MAX_X742_CHANNEL_SIZE; ++ich) {
       auto tout = out.tout[igr][ich];
       if (!tout) continue;
-      std::cout << " --- writing output tree: " << tout->GetName() << std::endl;
+      log("writing output tree: " << tout->GetName());
       tout->Write();
     }
   }
+  write_index(out);
+  /** tells rwavedump::prepare that the samples are on a grid of this step (ns) **/
+  if (out.resample.method != kern::interp_off)
+    TParameter<float>("sample_step", out.resampler.step).Write();
   out.fout->Close();
+  /** the file owns the trees and deletes them when closed **/
+  delete out.fout;
+  out.fout = nullptr;
+  for (auto &tgr : out.tout)
+    for (auto &tout : tgr) tout = nullptr;
+  /** a numbered file left empty by the stop is not worth handing off **/
+  if (out.roll.numbered() && out.file_events == 0) {
+    std::remove(filename.c_str());
+    return true;
+  }
+  /** the index is sorted by ttag64 now **/
+  auto first = out.index.empty() ? nullptr : &out.index.front();
+  auto last = out.index.empty() ? nullptr : &out.index.back();
+  return complete_output(out, first, last);
+}
+
+/** hand the finished file off: one manifest line
+    "<file> <events> <bytes> <first ttag64> <last ttag64> <first host> <last host>"
+    and the completion command, run in the background **/
+bool
+complete_output(const output_t &out, const output_t::index_t *first, const output_t::index_t *last)
+{
+  auto &roll = out.roll;
+  bool ok = true;
+  if (!roll.manifest.empty()) {
+    uint64_t bytes = 0;
+    if (auto f = std::fopen(out.filename.c_str(), "rb")) {
+      std::fseek(f, 0, SEEK_END);
+      bytes = std::ftell(f);
+      std::fclose(f);
+    }
+    std::ofstream manifest(roll.manifest, std::ios::app);
+    manifest << out.filename << " " << out.file_events << " " << bytes << " "
+	     << (first ? first->ttag64 : 0) << " " << (last ? last->ttag64 : 0) << " "
+	     << (first ? first->host : 0) << " " << (last ? last->host : 0) << std::endl;
+    if (!manifest) {
+      error("cannot append to manifest: " << roll.manifest);
+      ok = false;
+    }
+  }
+  if (!roll.on_complete.empty()) {
+    /** the file name is passed as "$1", never parsed by the shell **/
+    auto command = roll.on_complete + " \"$1\"";
+    const char *argv[] = { "sh", "-c", command.c_str(), "rwavedump", out.filename.c_str(), nullptr };
+    pid_t pid;
+    if (int err = posix_spawn(&pid, "/bin/sh", nullptr, nullptr, (char **)argv, environ)) {
+      error("cannot run completion command: " << std::strerror(err));
+      ok = false;
+    }
+    else log("completion command started for " << out.filename << " (pid " << pid << ")");
+  }
+  /** reap the commands that are done **/
+  while (waitpid(-1, nullptr, WNOHANG) > 0);
+  return ok;
+}
+
+/** the time index tree: one entry per event sorted by ttag64, for binary searches by time **/
+bool
+write_index(output_t &out)
+{
+  auto &index = out.index;
+  std::stable_sort(index.begin(), index.end(), [](const output_t::index_t &a, const output_t::index_t &b) { return a.ttag64 < b.ttag64; });
+  output_t::index_t row;
+  auto tindex = new TTree("time_index", "rwavedump");
+  tindex->Branch("ttag64", &row.ttag64, "ttag64/l");
+  tindex->Branch("host", &row.host, "host/l");
+  tindex->Branch("entry", &row.entry, "entry/L");
+  for (auto &r : index) {
+    row = r;
+    tindex->Fill();
+  }
+  log("writing time index: " << index.size() << " events");
+  tindex->Write();
   return true;
 }
 
@@ -177,6 +477,17 @@ fill_output(digitizer_t &dgz, output_t &out)
 {
   auto opt = dgz.opt;
   auto channel_mask = opt.channel_mask;
+  /** unwrap the tags of every group, the index gets the first group present **/
+  Long64_t entry = out.index.size();
+  bool indexed = false;
+  uint64_t ttag64[MAX_X742_GROUP_SIZE] = {0};
+  for (int igr = 0; igr < MAX_X742_GROUP_SIZE; ++igr) {
+    if (dgz.event->GrPresent[igr] == 0) continue;
+    ttag64[igr] = extend_ttag(dgz.ttag_clock[igr], dgz.event->DataGroup[igr].TriggerTimeTag, out.mono);
+    if (indexed) continue;
+    out.index.push_back({ ttag64[igr], out.host, entry });
+    indexed = true;
+  }
   /** loop over groups **/
   for (int igr = 0; igr < MAX_X742_GROUP_SIZE; ++igr) {
     if (dgz.event->GrPresent[igr] == 0) continue;
@@ -188,17 +499,30 @@ fill_output(digitizer_t &dgz, output_t &out)
       if (!out.tout[igr][ich]) {
 	std::string tname = "gr" + std::to_string(igr) + "_ch" + std::to_string(ich);
 	out.tout[igr][ich] = new TTree(tname.c_str(), "rwavedump");
+	/** flush the baskets within a share of the memory bound, save the headers for crash recovery **/
+	auto ntrees = std::max(1, __builtin_popcount(channel_mask & 0x01FF01FF));
+	auto flush_bytes = (Long64_t)(out.roll.memory_mb * 1048576. / 2. / ntrees);
+	out.tout[igr][ich]->SetAutoFlush(-flush_bytes);
+	out.tout[igr][ich]->SetMaxVirtualSize(flush_bytes);
+	out.tout[igr][ich]->SetAutoSave(-(Long64_t)(out.roll.autosave_mb * 1048576.));
 	out.tout[igr][ich]->Branch("size", &out.size, "size/I");
 	out.tout[igr][ich]->Branch("ttag", &out.ttag, "ttag/i");
+	out.tout[igr][ich]->Branch("ttag64", &out.ttag64, "ttag64/l");
+	out.tout[igr][ich]->Branch("host", &out.host, "host/l");
 	out.tout[igr][ich]->Branch("strt", &out.strt, "strt/s");
 	out.tout[igr][ich]->Branch("data", &out.data, "data[size]/F");
       }
       /** store size and data **/
       out.size = dgz.event->DataGroup[igr].ChSize[ich];
       out.ttag = dgz.event->DataGroup[igr].TriggerTimeTag;
+      out.ttag64 = ttag64[igr];
       out.strt = dgz.event->DataGroup[igr].StartIndexCell;
       for (int i = 0; i < out.size; ++i)
 	out.data[i] = dgz.event->DataGroup[igr].DataChannel[ich][i];
+      if (out.resample.method != kern::interp_off && out.size == out.resampler.record_length) {
+	stats::scope_t timer(stats::stage_resample);
+	resample::apply(out.resampler, igr, out.strt, out.data, out.scratch);
+      }
       /** fill the tree **/
       out.tout[igr][ich]->Fill();
     }
@@ -0,0 +1,129 @@
+#include <algorithm>
+#include <iostream>
+#include "rwavefile.hh"
+#include "TFile.h"
+#include "TTree.h"
+
+namespace rwf {
+
+/** the index tree is small, it is read into memory once **/
+static void
+load_index(file_t &f)
+{
+  f.index_ttag64.clear();
+  f.index_host.clear();
+  f.index_entry.clear();
+  auto t = (TTree *)f.file->Get("time_index");
+  if (!t) return;
+  unsigned long long ttag64 = 0, host = 0; // ULong64_t
+  long long entry = 0;
+  t->SetBranchAddress("ttag64", &ttag64);
+  t->SetBranchAddress("host", &host);
+  t->SetBranchAddress("entry", &entry);
+  auto n = t->GetEntries();
+  f.index_ttag64.reserve(n);
+  f.index_host.reserve(n);
+  f.index_entry.reserve(n);
+  for (long long i = 0; i < n; ++i) {
+    t->GetEntry(i);
+    f.index_ttag64.push_back(ttag64);
+    f.index_host.push_back(host);
+    f.index_entry.push_back(entry);
+  }
+}
+
+bool
+open(file_t &f, const std::string &filename)
+{
+  f.filename = filename;
+  f.file = TFile::Open(filename.c_str());
+  if (!f.file || !f.file->IsOpen()) {
+    std::cout << " --- could not open file: " << filename << std::endl;
+    f.file = nullptr;
+    return false;
+  }
+  f.n_events = -1;
+  for (int igr = 0; igr < max_groups; ++igr) {
+    for (int ich = 0; ich < max_channels; ++ich) {
+      std::string treename = "gr" + std::to_string(igr) + "_ch" + std::to_string(ich);
+      auto t = (TTree *)f.file->Get(treename.c_str());
+      f.trees[igr][ich] = t;
+      if (!t) continue;
+      t->SetBranchAddress("size", &f.size);
+      t->SetBranchAddress("ttag", &f.ttag);
+      if (t->GetBranch("ttag64")) t->SetBranchAddress("ttag64", &f.ttag64);
+      if (t->GetBranch("host")) t->SetBranchAddress("host", &f.host);
+      t->SetBranchAddress("strt", &f.strt);
+      t->SetBranchAddress("data", &f.data);
+      if (f.n_events == -1 || t->GetEntries() < f.n_events) f.n_events = t->GetEntries();
+    }
+  }
+  if (f.n_events < 0) f.n_events = 0;
+  load_index(f);
+  return true;
+}
+
+bool
+close(file_t &f)
+{
+  if (!f.file) return true;
+  f.file->Close();
+  delete f.file;
+  f.file = nullptr;
+  for (auto &group : f.trees)
+    for (auto &tree : group) tree = nullptr;
+  f.index_ttag64.clear();
+  f.index_host.clear();
+  f.index_entry.clear();
+  return true;
+}
+
+bool
+has_channel(const file_t &f, int group, int channel)
+{
+  return f.trees[group][channel] != nullptr;
+}
+
+bool
+read(file_t &f, int group, int channel, long long event)
+{
+  auto t = f.trees[group][channel];
+  if (!t || event < 0 || event >= f.n_events) return false;
+  return t->GetEntry(event) > 0;
+}
+
+bool
+has_index(const file_t &f)
+{
+  return !f.index_ttag64.empty();
+}
+
+std::vector<long long>
+select(const file_t &f, uint64_t t0, uint64_t t1)
+{
+  auto &t = f.index_ttag64;
+  auto first = std::lower_bound(t.begin(), t.end(), t0) - t.begin();
+  auto last = std::lower_bound(t.begin() + first, t.end(), t1) - t.begin();
+  return std::vector<long long>(f.index_entry.begin() + first, f.index_entry.begin() + last);
+}
+
+long long
+nearest(const file_t &f, uint64_t t)
+{
+  auto &tags = f.index_ttag64;
+  if (tags.empty()) return -1;
+  auto i = std::lower_bound(tags.begin(), tags.end(), t) - tags.begin();
+  if (i == (long)tags.size() || (i > 0 && t - tags[i - 1] < tags[i] - t)) --i;
+  return f.index_entry[i];
+}
+
+long long
+at_host(const file_t &f, uint64_t host_ns)
+{
+  /** the host clock of the blocks grows with ttag64, barring wall clock steps **/
+  auto &h = f.index_host;
+  auto i = std::lower_bound(h.begin(), h.end(), host_ns) - h.begin();
+  return i < (long)h.size() ? f.index_entry[i] : -1;
+}
+
+}
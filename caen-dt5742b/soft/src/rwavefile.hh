@@ -0,0 +1,52 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <vector>
+
+class TFile;
+class TTree;
+
+/** reader of rwavedump output files, for compiled analysis tools **/
+
+namespace rwf {
+
+const int max_groups = 2;
+const int max_channels = 9;
+const int max_length = 1024;
+const double ttag_ns = 8.5; // tick of ttag64
+
+struct file_t {
+  std::string filename;
+  TFile *file = nullptr;
+  TTree *trees[max_groups][max_channels] = {{nullptr}};
+  long long n_events = 0;
+  /** current entry **/
+  int size = 0;
+  uint32_t ttag = 0;
+  unsigned long long ttag64 = 0;  // unwrapped trigger time tag, 0 in files written before it existed
+  unsigned long long host = 0;    // wall clock of the block transfer, ns since the epoch
+  uint16_t strt = 0;
+  float data[max_length];
+  /** time index, sorted by ttag64, empty if the file has none **/
+  std::vector<uint64_t> index_ttag64;
+  std::vector<uint64_t> index_host;
+  std::vector<long long> index_entry;
+};
+
+bool open(file_t &f, const std::string &filename);
+bool close(file_t &f);
+bool has_channel(const file_t &f, int group, int channel);
+/** read the waveform of group/channel for the given event into f.size/ttag/ttag64/host/strt/data **/
+bool read(file_t &f, int group, int channel, long long event);
+
+/** time lookups on the index, O(log n) **/
+bool has_index(const file_t &f);
+/** entries with t0 <= ttag64 < t1, in time order **/
+std::vector<long long> select(const file_t &f, uint64_t t0, uint64_t t1);
+/** entry with the ttag64 closest to t, -1 if the index is empty **/
+long long nearest(const file_t &f, uint64_t t);
+/** entry of the first event read out at or after the wall clock host_ns, -1 if none **/
+long long at_host(const file_t &f, uint64_t host_ns);
+
+}
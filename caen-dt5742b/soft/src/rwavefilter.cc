@@ -0,0 +1,94 @@
+#include <algorithm>
+#include <sstream>
+#include "rwavefilter.hh"
+#include "rwavekern.hh"
+
+namespace filter {
+
+/** amplitude of the pulse with respect to the baseline **/
+static float
+amplitude(const options_t &opt, const float *x, int n)
+{
+  int nbase = std::min(opt.baseline_samples, n);
+  float baseline = nbase > 0 ? kern::sum(x, nbase) / nbase : 0.;
+  float min, max;
+  kern::minmax(x, n, min, max);
+  return opt.rising ? max - baseline : baseline - min;
+}
+
+/** sample where the pulse crosses threshold, -1 if it does not **/
+static int
+crossing(const options_t &opt, const float *x, int n)
+{
+  int nbase = std::min(opt.baseline_samples, n);
+  float baseline = nbase > 0 ? kern::sum(x, nbase) / nbase : 0.;
+  float level = opt.rising ? baseline + opt.threshold : baseline - opt.threshold;
+  return kern::first_crossing(x, n, level, opt.rising);
+}
+
+bool
+decide(const options_t &opt, const CAEN_DGTZ_X742_EVENT_t *event)
+{
+  if (opt.mode == mode_off) return true;
+  int times[16], ntimes = 0;
+  for (int igr = 0; igr < 2; ++igr) {
+    if (event->GrPresent[igr] == 0) continue;
+    auto mask = opt.channel_mask >> (8 * igr);
+    for (int ich = 0; ich < 8; ++ich) {
+      if (!(mask & 1 << ich)) continue;
+      const float *x = event->DataGroup[igr].DataChannel[ich];
+      int n = event->DataGroup[igr].ChSize[ich];
+      if (n <= 0) continue;
+      if (opt.mode == mode_amplitude) {
+	if (amplitude(opt, x, n) >= opt.threshold) return true;
+	continue;
+      }
+      int t = crossing(opt, x, n);
+      if (t >= 0) times[ntimes++] = t;
+    }
+  }
+  if (opt.mode != mode_coincidence || ntimes < opt.min_channels) return false;
+  /** sliding window over the sorted crossing times **/
+  std::sort(times, times + ntimes);
+  for (int i = 0; i + opt.min_channels - 1 < ntimes; ++i)
+    if (times[i + opt.min_channels - 1] - times[i] <= opt.window) return true;
+  return false;
+}
+
+bool
+count(const options_t &opt, counters_t &cnt, bool accepted)
+{
+  if (accepted) {
+    ++cnt.accepted;
+    return true;
+  }
+  ++cnt.rejected;
+  if (opt.prescale > 0 && cnt.rejected % opt.prescale == 0) {
+    ++cnt.prescaled;
+    return true;
+  }
+  return false;
+}
+
+bool
+evaluate(const options_t &opt, counters_t &cnt, const CAEN_DGTZ_X742_EVENT_t *event)
+{
+  return count(opt, cnt, decide(opt, event));
+}
+
+std::string
+describe(const options_t &opt)
+{
+  std::ostringstream ss;
+  if (opt.mode == mode_off) return "off";
+  ss << (opt.mode == mode_amplitude ? "amplitude" : "coincidence")
+     << " chmask 0x" << std::hex << opt.channel_mask << std::dec
+     << " threshold " << opt.threshold
+     << " polarity " << (opt.rising ? "pos" : "neg");
+  if (opt.mode == mode_coincidence)
+    ss << " window " << opt.window << " multiplicity " << opt.min_channels;
+  ss << " baseline " << opt.baseline_samples << " prescale " << opt.prescale;
+  return ss.str();
+}
+
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <CAENDigitizer.h>
+
+/** event-level software filter, evaluated on decoded events **/
+
+namespace filter {
+
+enum mode_t { mode_off = 0, mode_amplitude, mode_coincidence };
+
+struct options_t {
+  int mode = mode_off;
+  uint32_t channel_mask = 0x0;  // channels (gr * 8 + ch) taking part in the decision
+  float threshold = 100.;       // amplitude above baseline (ADC counts)
+  bool rising = false;          // pulse polarity: rising (positive) or falling (negative)
+  int window = 0;               // coincidence window (samples)
+  int min_channels = 2;         // coincidence multiplicity
+  int baseline_samples = 16;    // samples at the start of the record used for the baseline
+  int prescale = 0;             // keep one rejected event every prescale, 0 = drop all
+};
+
+struct counters_t {
+  uint64_t accepted = 0;
+  uint64_t rejected = 0;
+  uint64_t prescaled = 0;       // rejected but kept by the prescaler
+};
+
+/** true if the event has to be kept **/
+bool evaluate(const options_t &opt, counters_t &cnt, const CAEN_DGTZ_X742_EVENT_t *event);
+
+/** the two halves of evaluate: the decision, which only reads the event and can run
+    on any thread, and the counting with the prescaler, in readout order **/
+bool decide(const options_t &opt, const CAEN_DGTZ_X742_EVENT_t *event);
+bool count(const options_t &opt, counters_t &cnt, bool accepted);
+
+std::string describe(const options_t &opt);
+
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstdint>
+
+/** wire formats of the data sent by rwaveserver: "download" headers, v2 blocks
+    (also published to the shared-memory ring) and the "acquire" trailer.
+    no globals and no CAEN headers, for clients and same-host readers **/
+
+namespace data {
+
+const int max_events = 1024;
+const int max_groups = 2;
+const int max_channels = 8;
+const int max_length = 1024;
+/** channel ids are group * 8 + channel, the digitized TR0/TR1 fast triggers get tr_id + group **/
+const int tr_id = max_groups * max_channels;
+const int max_ids = max_groups * max_channels + max_groups;
+  
+/** header of "download" **/
+struct header_t {
+  uint16_t n_events;
+  uint16_t n_channels;
+  uint16_t record_length;
+  uint16_t frequency;
+};
+
+/** optional preamble of "download sized": byte size of each section that follows **/
+struct sizes_t {
+  uint64_t header;
+  uint64_t channels;
+  uint64_t trigger_tags;
+  uint64_t start_cells;
+  uint64_t data;
+};
+
+/** self-describing header of "download v2" and of shared-memory blocks **/
+const uint32_t v2_magic = 0x32574152; // "RAW2"
+const uint16_t v2_version = 2;
+
+enum layout_t {
+  layout_event = 0,   // [event][channel][sample]
+  layout_channel = 1  // [channel][event][sample]
+};
+
+enum sample_type_t {
+  sample_float32 = 0
+};
+
+enum tag_type_t {
+  tags_ttt32 = 0,   // raw 30-bit trigger time tags, uint32_t
+  tags_ttt64 = 1    // trigger time tags unwrapped into monotonic 64-bit tick counts, uint64_t
+};
+
+struct header_v2_t {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t header_size;   // sizeof(header_v2_t), sections start right after
+  uint32_t n_events;
+  uint16_t n_channels;
+  uint16_t record_length;
+  uint16_t frequency;
+  uint8_t group_mask;     // groups present in the data
+  uint8_t sample_type;
+  uint8_t layout;
+  uint8_t tag_type;
+  uint16_t sample_step_ps; // grid step of resampled data (ps), 0 = samples at the DRS4 cell times
+  uint64_t channels_size;
+  uint64_t trigger_tags_size;
+  uint64_t start_cells_size;
+  uint64_t data_size;
+  uint64_t host_ns;       // wall clock of the block transfer, ns since the epoch
+};
+static_assert(sizeof(header_v2_t) == 64, "header_v2_t must be packed to 64 bytes");
+
+/** end of the stream of v2 blocks sent by "acquire" **/
+const uint32_t trailer_magic = 0x45415752; // "RWAE"
+
+enum acquire_status_t {
+  acquire_completed = 0,
+  acquire_timeout = 1,  // no data within the readout timeout
+  acquire_error = 2     // readout, decoding or network error
+};
+
+struct acquire_trailer_t {
+  uint32_t magic;
+  uint16_t header_size;   // sizeof(acquire_trailer_t)
+  uint16_t status;
+  uint32_t n_blocks;      // v2 blocks sent
+  uint32_t reserved;
+  uint64_t n_triggers;    // software triggers sent
+  uint64_t n_read;        // events read from the board
+  uint64_t n_sent;        // events sent, after the filter
+  uint64_t bytes;         // bytes sent in v2 blocks
+  uint64_t first_ns;      // from the command to the first readout
+  uint64_t total_ns;      // from the command to the end of the transfer
+};
+static_assert(sizeof(acquire_trailer_t) == 64, "acquire_trailer_t must be packed to 64 bytes");
+
+}
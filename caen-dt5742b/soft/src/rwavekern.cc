@@ -0,0 +1,193 @@
+#include <algorithm>
+#include <cmath>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include "rwavekern.hh"
+
+namespace kern {
+
+void
+minmax(const float *x, int n, float &min, float &max)
+{
+  int i = 0;
+  float vmin = x[0], vmax = x[0];
+#if defined(__AVX__)
+  if (n >= 16) {
+    __m256 min0 = _mm256_loadu_ps(x), max0 = min0;
+    __m256 min1 = _mm256_loadu_ps(x + 8), max1 = min1;
+    for (i = 16; i + 16 <= n; i += 16) {
+      __m256 a = _mm256_loadu_ps(x + i), b = _mm256_loadu_ps(x + i + 8);
+      min0 = _mm256_min_ps(min0, a); max0 = _mm256_max_ps(max0, a);
+      min1 = _mm256_min_ps(min1, b); max1 = _mm256_max_ps(max1, b);
+    }
+    min0 = _mm256_min_ps(min0, min1);
+    max0 = _mm256_max_ps(max0, max1);
+    alignas(32) float lo[8], hi[8];
+    _mm256_store_ps(lo, min0);
+    _mm256_store_ps(hi, max0);
+    vmin = *std::min_element(lo, lo + 8);
+    vmax = *std::max_element(hi, hi + 8);
+  }
+#elif defined(__SSE2__)
+  if (n >= 8) {
+    __m128 min0 = _mm_loadu_ps(x), max0 = min0;
+    __m128 min1 = _mm_loadu_ps(x + 4), max1 = min1;
+    for (i = 8; i + 8 <= n; i += 8) {
+      __m128 a = _mm_loadu_ps(x + i), b = _mm_loadu_ps(x + i + 4);
+      min0 = _mm_min_ps(min0, a); max0 = _mm_max_ps(max0, a);
+      min1 = _mm_min_ps(min1, b); max1 = _mm_max_ps(max1, b);
+    }
+    min0 = _mm_min_ps(min0, min1);
+    max0 = _mm_max_ps(max0, max1);
+    alignas(16) float lo[4], hi[4];
+    _mm_store_ps(lo, min0);
+    _mm_store_ps(hi, max0);
+    vmin = *std::min_element(lo, lo + 4);
+    vmax = *std::max_element(hi, hi + 4);
+  }
+#endif
+  for (; i < n; ++i) {
+    vmin = std::min(vmin, x[i]);
+    vmax = std::max(vmax, x[i]);
+  }
+  min = vmin;
+  max = vmax;
+}
+
+float
+sum(const float *x, int n)
+{
+  int i = 0;
+  float total = 0.;
+#if defined(__SSE2__)
+  __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+  for (; i + 8 <= n; i += 8) {
+    acc0 = _mm_add_ps(acc0, _mm_loadu_ps(x + i));
+    acc1 = _mm_add_ps(acc1, _mm_loadu_ps(x + i + 4));
+  }
+  alignas(16) float acc[4];
+  _mm_store_ps(acc, _mm_add_ps(acc0, acc1));
+  total = acc[0] + acc[1] + acc[2] + acc[3];
+#endif
+  for (; i < n; ++i) total += x[i];
+  return total;
+}
+
+int
+first_crossing(const float *x, int n, float threshold, bool rising)
+{
+  int i = 0;
+#if defined(__SSE2__)
+  __m128 thr = _mm_set1_ps(threshold);
+  for (; i + 4 <= n; i += 4) {
+    __m128 a = _mm_loadu_ps(x + i);
+    int mask = _mm_movemask_ps(rising ? _mm_cmpgt_ps(a, thr) : _mm_cmplt_ps(a, thr));
+    if (mask) return i + __builtin_ctz(mask);
+  }
+#endif
+  for (; i < n; ++i)
+    if (rising ? x[i] > threshold : x[i] < threshold) return i;
+  return -1;
+}
+
+void
+cell_times(const float *ring, int start, int n, float period, float *t)
+{
+  const int ring_size = 1024;
+  t[0] = 0.;
+  float prev = ring[start % ring_size];
+  for (int i = 1; i < n; ++i) {
+    float cur = ring[(start + i) % ring_size];
+    float dt = cur - prev;
+    /** the ring times start over after the last cell **/
+    if (dt <= 0.) dt += ring_size * period;
+    t[i] = t[i - 1] + dt;
+    prev = cur;
+  }
+}
+
+void
+plan(const float *t, int n, float step, int n_out, interp_t method, plan_t &p)
+{
+  int taps = method == interp_cubic ? 4 : 2;
+  if (n < taps) taps = n;
+  p.taps = taps;
+  p.n_out = n_out;
+  p.index.assign(n_out, 0);
+  p.weight.assign((size_t)taps * n_out, 0.);
+  if (n < 2) {
+    std::fill(p.weight.begin(), p.weight.end(), 1.);
+    return;
+  }
+  int i = 0;
+  for (int k = 0; k < n_out; ++k) {
+    double tk = std::min((double)t[0] + (double)k * step, (double)t[n - 1]);
+    /** t[i] <= tk < t[i + 1], the grid is increasing so the walk never goes back **/
+    while (i + 2 < n && t[i + 1] <= tk) ++i;
+    double u = std::min(std::max((tk - t[i]) / (t[i + 1] - t[i]), 0.), 1.);
+    int first = std::min(std::max(i - (taps / 2 - 1), 0), n - taps);
+    p.index[k] = first;
+    for (int j = 0; j < taps; ++j) {
+      int ij = first + j;
+      double w;
+      switch (method) {
+      case interp_cubic:
+	/** Lagrange polynomial through the four nearest samples, at their true times **/
+	w = 1.;
+	for (int m = first; m < first + taps; ++m)
+	  if (m != ij) w *= (tk - t[m]) / ((double)t[ij] - t[m]);
+	break;
+      default:
+	w = ij == i ? 1. - u : ij == i + 1 ? u : 0.;
+      }
+      p.weight[(size_t)j * n_out + k] = w;
+    }
+  }
+}
+
+void
+apply(const plan_t &p, const float *x, float *y)
+{
+  int k = 0, n = p.n_out;
+  const int *index = p.index.data();
+  const float *weight = p.weight.data();
+#if defined(__AVX2__)
+  for (; k + 8 <= n; k += 8) {
+    __m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(index + k));
+    __m256 acc = _mm256_setzero_ps();
+    for (int j = 0; j < p.taps; ++j) {
+      __m256 xj = _mm256_i32gather_ps(x + j, idx, 4);
+      acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(weight + (size_t)j * n + k), xj));
+    }
+    _mm256_storeu_ps(y + k, acc);
+  }
+#endif
+  for (; k < n; ++k) {
+    float acc = 0.;
+    for (int j = 0; j < p.taps; ++j)
+      acc += weight[(size_t)j * n + k] * x[index[k] + j];
+    y[k] = acc;
+  }
+}
+
+static const char *interp_names[] = { "off", "linear", "cubic" };
+
+bool
+parse_interp(const std::string &name, interp_t &method)
+{
+  for (int m = interp_off; m <= interp_cubic; ++m) {
+    if (name != interp_names[m]) continue;
+    method = (interp_t)m;
+    return true;
+  }
+  return false;
+}
+
+const char *
+interp_name(interp_t method)
+{
+  return method >= interp_off && method <= interp_cubic ? interp_names[method] : "unknown";
+}
+
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+/** vectorized waveform kernels **/
+
+namespace kern {
+
+/** minimum and maximum of x[0, n) **/
+void minmax(const float *x, int n, float &min, float &max);
+
+/** sum of x[0, n) **/
+float sum(const float *x, int n);
+
+/** index of the first sample above (rising) or below (falling) threshold, -1 if none **/
+int first_crossing(const float *x, int n, float threshold, bool rising);
+
+/** resampling of DRS4 records onto a uniform time grid **/
+
+/** linear, or cubic Lagrange through the four nearest samples at their true times **/
+enum interp_t { interp_off = 0, interp_linear, interp_cubic };
+
+/** input samples and weights of every output sample of one record.
+    the cells of a group share the start cell, so one plan serves all its channels **/
+struct plan_t {
+  int taps = 0;
+  int n_out = 0;
+  std::vector<int> index;     // first input sample of output k
+  std::vector<float> weight;  // weight[j * n_out + k] of input sample index[k] + j
+};
+
+/** times (ns, t[0] = 0) of the n samples of a record starting at DRS4 cell start,
+    from the cell times of the ring (CAEN_DGTZ_DRS4Correction_t::time);
+    period is the nominal sampling period (ns), a full turn of the ring lasts 1024 periods **/
+void cell_times(const float *ring, int start, int n, float period, float *t);
+
+/** plan the resampling of samples at increasing times t[0, n) onto the grid k * step,
+    k in [0, n_out). grid points past the last sample hold its value **/
+void plan(const float *t, int n, float step, int n_out, interp_t method, plan_t &p);
+
+/** y[0, n_out) from x[0, n), y must not overlap x **/
+void apply(const plan_t &p, const float *x, float *y);
+
+bool parse_interp(const std::string &name, interp_t &method);
+const char *interp_name(interp_t method);
+
+}
@@ -1,4 +1,11 @@
+#include <cmath>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <sstream>
+#include <iomanip>
 #include "rwavelib.hh"
+#include "rwavestats.hh"
 
 namespace dgz {
 
@@ -12,18 +19,17 @@ std::map<int, CAEN_DGTZ_DRS4Frequency_t> frequencies = {
 bool
 open(digitizer_t &dgz)
 {
-  std::cout << " --- open digitizer " << std::endl;
+  log("open digitizer");
   CAEN_DGTZ_ConnectionType LinkType = CAEN_DGTZ_USB;
   int LinkNum = 0;
   int ConetMode = 0;
   std::uint32_t VMEBaseAddress = 0;
   if (CAEN_DGTZ_OpenDigitizer(LinkType, LinkNum, ConetMode, VMEBaseAddress, &dgz.handle))  error("CAEN_DGTZ_OpenDigitizer");
   if (CAEN_DGTZ_GetInfo(dgz.handle, &dgz.BoardInfo))  error("CAEN_DGTZ_GetInfo");
-  std::cout << " --- CAEN digitizer " << std::endl
-	    << "      ModelName: " << dgz.BoardInfo.ModelName << std::endl
-	    << "     FamilyCode: " << dgz.BoardInfo.FamilyCode << std::endl /** CAEN_DGTZ_XX742_FAMILY_CODE **/
-	    << "       Channels: " << dgz.BoardInfo.Channels
-	    << std::endl;
+  log("CAEN digitizer " << std::endl
+      << "      ModelName: " << dgz.BoardInfo.ModelName << std::endl
+      << "     FamilyCode: " << dgz.BoardInfo.FamilyCode << std::endl /** CAEN_DGTZ_XX742_FAMILY_CODE **/
+      << "       Channels: " << dgz.BoardInfo.Channels);
 
   dgz.open = true;
   return true;
@@ -33,7 +39,7 @@ bool
 close(digitizer_t &dgz)
 {
   if (!dgz.open) return true;
-  std::cout << " --- closing digitizer, have a good day " << std::endl;
+  log("closing digitizer, have a good day");
   if (CAEN_DGTZ_CloseDigitizer(dgz.handle)) error("CAEN_DGTZ_CloseDigitizer");
   return true;
 }
@@ -44,33 +50,20 @@ config(digitizer_t &dgz)
   auto handle = dgz.handle;
   auto opt = dgz.opt;
 
-  std::cout << " --- reset digitizer " << std::endl;
+  log("reset digitizer");
   if (CAEN_DGTZ_Reset(handle)) error("CAEN_DGTZ_Reset");
   
-  std::cout << " --- set record length: " << opt.record_length << std::endl;
+  log("set record length: " << opt.record_length);
   if (CAEN_DGTZ_SetRecordLength(handle, opt.record_length))                    error("CAEN_DGTZ_SetRecordLength");  
   ///  if (CAEN_DGTZ_SetDecimationFactor(handle, WDcfg->DecimationFactor))          error("CAEN_DGTZ_SetDecimationFactor");
-  std::cout << " --- set maximum events BLT: " << opt.max_blt << std::endl;
+  log("set maximum events BLT: " << opt.max_blt);
   if (CAEN_DGTZ_SetMaxNumEventsBLT(handle, opt.max_blt))                       error("CAEN_DGTZ_SetMaxNumEventsBLT");
   if (CAEN_DGTZ_SetAcquisitionMode(handle, CAEN_DGTZ_SW_CONTROLLED))           error("CAEN_DGTZ_SetAcquisitionMode");
   if (CAEN_DGTZ_SetGroupEnableMask(handle, 0x3))                               error("CAEN_DGTZ_SetGroupEnableMask");
-  std::cout << " --- set DRS4 sampling frequency: " << opt.frequency << " MHz " << std::endl;
+  log("set DRS4 sampling frequency: " << opt.frequency << " MHz");
   if (CAEN_DGTZ_SetDRS4SamplingFrequency(handle, frequencies[opt.frequency]))  error("CAEN_DGTZ_SetDRS4SamplingFrequency");
 
-  //  if (CAEN_DGTZ_SetFastTriggerDigitizing(handle, CAEN_DGTZ_ENABLE))            error("CAEN_DGTZ_SetFastTriggerDigitizing");
-  //  if (CAEN_DGTZ_SetFastTriggerDigitizing(handle, CAEN_DGTZ_DISABLE))           error("CAEN_DGTZ_SetFastTriggerDigitizing");
-  //  if (CAEN_DGTZ_SetFastTriggerMode(handle, CAEN_DGTZ_TRGMODE_ACQ_ONLY))        error("CAEN_DGTZ_SetFastTriggerMode");
-  //  if (CAEN_DGTZ_SetFastTriggerMode(handle, CAEN_DGTZ_TRGMODE_DISABLED))        error("CAEN_DGTZ_SetFastTriggerMode");
-
-  //  if (CAEN_DGTZ_SetExtTriggerInputMode(handle, CAEN_DGTZ_TRGMODE_DISABLED))    error("CAEN_DGTZ_SetExtTriggerInputMode");
-  if (CAEN_DGTZ_SetExtTriggerInputMode(handle, CAEN_DGTZ_TRGMODE_ACQ_ONLY))    error("CAEN_DGTZ_SetExtTriggerInputMode");
-  //  if (CAEN_DGTZ_SetTriggerPolarity(handle, 0, CAEN_DGTZ_TriggerOnRisingEdge))  error("CAEN_DGTZ_SetTriggerPolarity 0");
-
-  //  if (CAEN_DGTZ_SetGroupFastTriggerDCOffset(handle, 0, opt.trigger_dc))        error("CAEN_DGTZ_SetGroupFastTriggerDCOffset 0");
-  //  if (CAEN_DGTZ_SetGroupFastTriggerThreshold(handle, 0, opt.trigger_thr))      error("CAEN_DGTZ_SetGroupFastTriggerThreshold 0");
-  //  if (CAEN_DGTZ_SetTriggerPolarity(handle, 1, CAEN_DGTZ_TriggerOnRisingEdge))  error("CAEN_DGTZ_SetTriggerPolarity 1");
-  //  if (CAEN_DGTZ_SetGroupFastTriggerDCOffset(handle, 1, opt.trigger_dc))        error("CAEN_DGTZ_SetGroupFastTriggerDCOffset 1");  
-  //  if (CAEN_DGTZ_SetGroupFastTriggerThreshold(handle, 1, opt.trigger_thr))      error("CAEN_DGTZ_SetGroupFastTriggerThreshold 0");
+  config_trigger(dgz);
 
   /** enable busy signal on GPO **/
   if (CAEN_DGTZ_WriteRegister(handle, 0x811C, 0x000D0001))                     error("CAEN_DGTZ_WriteRegister");
@@ -88,24 +81,100 @@ config(digitizer_t &dgz)
 
   //  status(dgz);
 
+  dgz.configured = std::chrono::steady_clock::now();
   return true;
 }
 
+bool
+config_trigger(digitizer_t &dgz)
+{
+  auto handle = dgz.handle;
+  auto opt = dgz.opt;
+  auto acq = [](bool on) { return on ? CAEN_DGTZ_TRGMODE_ACQ_ONLY : CAEN_DGTZ_TRGMODE_DISABLED; };
+  auto polarity = opt.trigger_polarity ? CAEN_DGTZ_TriggerOnFallingEdge : CAEN_DGTZ_TriggerOnRisingEdge;
+  bool ok = true;
+
+  log("configure trigger: " << describe_trigger(opt));
+  if (CAEN_DGTZ_SetSWTriggerMode(handle, CAEN_DGTZ_TRGMODE_ACQ_ONLY))                { error("CAEN_DGTZ_SetSWTriggerMode"); ok = false; }
+  if (CAEN_DGTZ_SetExtTriggerInputMode(handle, acq(opt.trigger_ext)))                { error("CAEN_DGTZ_SetExtTriggerInputMode"); ok = false; }
+
+  /** fast triggers, TR0 on group 0 and TR1 on group 1 **/
+  if (CAEN_DGTZ_SetFastTriggerMode(handle, acq(opt.trigger_fast)))                   { error("CAEN_DGTZ_SetFastTriggerMode"); ok = false; }
+  if (CAEN_DGTZ_SetFastTriggerDigitizing(handle, opt.trigger_fast ? CAEN_DGTZ_ENABLE : CAEN_DGTZ_DISABLE))  { error("CAEN_DGTZ_SetFastTriggerDigitizing"); ok = false; }
+  for (int igr = 0; igr < MAX_X742_GROUP_SIZE; ++igr) {
+    if (CAEN_DGTZ_SetGroupFastTriggerDCOffset(handle, igr, opt.trigger_dc))          { error("CAEN_DGTZ_SetGroupFastTriggerDCOffset " << igr); ok = false; }
+    if (CAEN_DGTZ_SetGroupFastTriggerThreshold(handle, igr, opt.trigger_thr))        { error("CAEN_DGTZ_SetGroupFastTriggerThreshold " << igr); ok = false; }
+    if (CAEN_DGTZ_SetTriggerPolarity(handle, igr, polarity))                         { error("CAEN_DGTZ_SetTriggerPolarity " << igr); ok = false; }
+  }
+
+  /** channel self-triggers, OR-ed within each group **/
+  uint32_t self_mask = opt.self_trigger_mask & 0xFFFF, group_mask = 0;
+  for (int ich = 0; ich < 16; ++ich) {
+    if (!(self_mask & 1 << ich)) continue;
+    group_mask |= 1 << (ich / 8);
+    if (CAEN_DGTZ_SetChannelTriggerThreshold(handle, ich, opt.self_trigger_thr))     { error("CAEN_DGTZ_SetChannelTriggerThreshold " << ich); ok = false; }
+    if (CAEN_DGTZ_SetTriggerPolarity(handle, ich, polarity))                         { error("CAEN_DGTZ_SetTriggerPolarity " << ich); ok = false; }
+  }
+  if (CAEN_DGTZ_SetChannelSelfTrigger(handle, CAEN_DGTZ_TRGMODE_DISABLED, ~self_mask & 0xFFFF))  { error("CAEN_DGTZ_SetChannelSelfTrigger"); ok = false; }
+  if (self_mask && CAEN_DGTZ_SetChannelSelfTrigger(handle, CAEN_DGTZ_TRGMODE_ACQ_ONLY, self_mask))  { error("CAEN_DGTZ_SetChannelSelfTrigger"); ok = false; }
+  if (CAEN_DGTZ_SetGroupSelfTrigger(handle, CAEN_DGTZ_TRGMODE_DISABLED, ~group_mask & 0x3))      { error("CAEN_DGTZ_SetGroupSelfTrigger"); ok = false; }
+  if (group_mask && CAEN_DGTZ_SetGroupSelfTrigger(handle, CAEN_DGTZ_TRGMODE_ACQ_ONLY, group_mask))  { error("CAEN_DGTZ_SetGroupSelfTrigger"); ok = false; }
+
+  /** group logic: majority level, bits [26:24] of the global trigger mask **/
+  uint32_t global_mask = 0;
+  if (CAEN_DGTZ_ReadRegister(handle, 0x810C, &global_mask))                          { error("CAEN_DGTZ_ReadRegister 0x810C"); return false; }
+  global_mask = (global_mask & ~(0x7 << 24)) | ((uint32_t)(opt.trigger_majority - 1) & 0x7) << 24;
+  if (CAEN_DGTZ_WriteRegister(handle, 0x810C, global_mask))                          { error("CAEN_DGTZ_WriteRegister 0x810C"); ok = false; }
+
+  return ok;
+}
+
+std::string
+describe_trigger(const options_t &opt)
+{
+  std::ostringstream ss;
+  ss << "ext " << (opt.trigger_ext ? "on" : "off")
+     << ", fast " << (opt.trigger_fast ? "on" : "off") << " (dc " << opt.trigger_dc << ", thr " << opt.trigger_thr << ")"
+     << ", self 0x" << std::hex << std::setw(4) << std::setfill('0') << opt.self_trigger_mask << std::dec
+     << " (thr " << opt.self_trigger_thr << ", majority " << opt.trigger_majority << ")"
+     << ", polarity " << (opt.trigger_polarity ? "falling" : "rising");
+  return ss.str();
+}
+
 bool
 start(digitizer_t &dgz)
 {
-  msleep(300);
-  std::cout << " --- start readout " << std::endl;
-  if (CAEN_DGTZ_AllocateEvent(dgz.handle, (void **)&dgz.event))                     error("CAEN_DGTZ_AllocateEvent");
-  if (CAEN_DGTZ_MallocReadoutBuffer(dgz.handle, &dgz.buffer, &dgz.allocated_size))  error("CAEN_DGTZ_MallocReadoutBuffer");
-  if (CAEN_DGTZ_SWStartAcquisition(dgz.handle))                                     error("CAEN_DGTZ_SWStartAcquisition");
+  /** let the board settle after the configuration, later starts do not wait **/
+  std::this_thread::sleep_until(dgz.configured + std::chrono::milliseconds(300));
+  log("start readout");
+  /** the board clears the trigger time tags at start **/
+  for (auto &clock : dgz.ttag_clock) clock = ttag_clock_t();
+  /** on failure nothing is left allocated, and stop must not be called **/
+  if (CAEN_DGTZ_AllocateEvent(dgz.handle, (void **)&dgz.event)) {
+    error("CAEN_DGTZ_AllocateEvent");
+    return false;
+  }
+  if (CAEN_DGTZ_MallocReadoutBuffer(dgz.handle, &dgz.buffer, &dgz.allocated_size)) {
+    error("CAEN_DGTZ_MallocReadoutBuffer");
+    CAEN_DGTZ_FreeEvent(dgz.handle, (void **)&dgz.event);
+    return false;
+  }
+  /** interrupt when readout_irq events are ready, acknowledged by the readout (ROAK) **/
+  auto irq = dgz.opt.readout_irq > 0 ? CAEN_DGTZ_ENABLE : CAEN_DGTZ_DISABLE;
+  if (CAEN_DGTZ_SetInterruptConfig(dgz.handle, irq, 1, 0, dgz.opt.readout_irq, CAEN_DGTZ_IRQ_MODE_ROAK))  error("CAEN_DGTZ_SetInterruptConfig");
+  if (CAEN_DGTZ_SWStartAcquisition(dgz.handle)) {
+    error("CAEN_DGTZ_SWStartAcquisition");
+    CAEN_DGTZ_FreeReadoutBuffer(&dgz.buffer);
+    CAEN_DGTZ_FreeEvent(dgz.handle, (void **)&dgz.event);
+    return false;
+  }
   return true;
 }
 
 bool
 stop(digitizer_t &dgz)
 {
-  std::cout << " --- stop readout " << std::endl;
+  log("stop readout");
   if (CAEN_DGTZ_SWStopAcquisition(dgz.handle))              error("CAEN_DGTZ_SWStopAcquisition");
   if (CAEN_DGTZ_FreeReadoutBuffer(&dgz.buffer))             error("CAEN_DGTZ_FreeReadoutBuffer");
   if (CAEN_DGTZ_FreeEvent(dgz.handle, (void**)&dgz.event))  error("CAEN_DGTZ_FreeEvent");
@@ -117,16 +186,194 @@ status(digitizer_t &dgz)
 {
   uint32_t status = 0;
   CAEN_DGTZ_ReadRegister(dgz.handle, CAEN_DGTZ_ACQ_STATUS_ADD, &status);
-  std::cout << " --- board status after configure " << status << std::endl;
+  log("board status after configure " << status);
   usleep(1000);
   CAEN_DGTZ_ReadRegister(dgz.handle, CAEN_DGTZ_ACQ_STATUS_ADD, &status);
-  std::cout << " --- board status after configure " << status << std::endl;
+  log("board status after configure " << status);
 
   if(!(status & (1 << 7)))  error("board error detected: PLL not locked");
 
   return true;
 }
 
+uint64_t
+host_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+uint64_t
+mono_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+uint64_t
+extend_ttag(ttag_clock_t &clock, uint32_t ttag, uint64_t mono_ns)
+{
+  const uint64_t period = 1ULL << ttag_bits;
+  ttag &= period - 1;
+  if (clock.valid) {
+    uint64_t delta = (ttag - clock.last) & (period - 1);
+    if (ttag < clock.last) clock.high += period;
+    /** the tag only tells the time modulo one period, the host clock tells how many periods passed **/
+    if (mono_ns > clock.last_mono_ns + period * ttag_ns) {
+      double elapsed = (mono_ns - clock.last_mono_ns) / ttag_ns;
+      int64_t missed = std::llround((elapsed - delta) / period);
+      if (missed > 0) clock.high += missed * period;
+    }
+  }
+  clock.valid = true;
+  clock.last = ttag;
+  clock.last_mono_ns = mono_ns;
+  return clock.high + ttag;
+}
+
+bool
+wait_event(digitizer_t &dgz, int timeout_ms)
+{
+  stats::scope_t timer(stats::stage_wait);
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  while (true) {
+    if (dgz.opt.readout_irq > 0) {
+      auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+      CAEN_DGTZ_IRQWait(dgz.handle, left > 0 ? left : 1);
+    }
+    else msleep(dgz.opt.readout_msleep);
+    if (event_ready(dgz)) {
+      /** dead time is sampled once per block, when the board is about to be read **/
+      stats::busy(event_full(dgz));
+      return true;
+    }
+    if (std::chrono::steady_clock::now() >= deadline) return false;
+  }
+}
+
+/** apply the readout settings of point **/
+static bool
+apply(digitizer_t &dgz, const tune_point_t &point)
+{
+  dgz.opt.max_blt = point.max_blt;
+  dgz.opt.readout_msleep = point.msleep;
+  dgz.opt.readout_irq = point.irq;
+  if (CAEN_DGTZ_SetMaxNumEventsBLT(dgz.handle, point.max_blt)) {
+    error("CAEN_DGTZ_SetMaxNumEventsBLT");
+    return false;
+  }
+  return true;
+}
+
+/** read out for topt.seconds with the settings of point, fill in the throughput **/
+static bool
+measure(digitizer_t &dgz, const tune_options_t &topt, tune_point_t &point)
+{
+  if (!apply(dgz, point) || !start(dgz)) return false;
+
+  std::atomic<bool> triggering(topt.trigger_sw);
+  std::thread trigger;
+  if (topt.trigger_sw)
+    trigger = std::thread([&dgz, &triggering] {
+      while (triggering) {
+	CAEN_DGTZ_SendSWtrigger(dgz.handle);
+	usleep(dgz.opt.trigger_sw_usleep);
+      }
+    });
+
+  uint64_t events = 0, bytes = 0, blts = 0;
+  bool ok = true;
+  auto t_start = std::chrono::steady_clock::now();
+  auto deadline = t_start + std::chrono::duration<double>(topt.seconds);
+  while (ok && std::chrono::steady_clock::now() < deadline) {
+    if (!wait_event(dgz, 100)) continue;
+    std::uint32_t buffer_size = 0, num_events = 0;
+    if (CAEN_DGTZ_ReadData(dgz.handle, CAEN_DGTZ_SLAVE_TERMINATED_READOUT_MBLT, dgz.buffer, &buffer_size) ||
+	CAEN_DGTZ_GetNumEvents(dgz.handle, dgz.buffer, buffer_size, &num_events)) {
+      error("readout failed while tuning");
+      ok = false;
+    }
+    events += num_events;
+    bytes += buffer_size;
+    if (num_events > 0) ++blts;
+  }
+  auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+  triggering = false;
+  if (trigger.joinable()) trigger.join();
+  stop(dgz);
+
+  point.events_per_s = events / elapsed;
+  point.mb_per_s = bytes / elapsed / 1.e6;
+  point.events_per_blt = blts > 0 ? (double)events / blts : 0.;
+  return ok;
+}
+
+std::string
+describe(const tune_point_t &point)
+{
+  std::ostringstream ss;
+  ss << "max_blt " << point.max_blt << ", "
+     << (point.irq > 0 ? "irq " + std::to_string(point.irq) + " events" : "poll " + std::to_string(point.msleep) + " ms") << ": "
+     << std::fixed << std::setprecision(1) << point.events_per_s << " ev/s, "
+     << std::setprecision(2) << point.mb_per_s << " MB/s, "
+     << std::setprecision(1) << point.events_per_blt << " ev/BLT";
+  return ss.str();
+}
+
+bool
+tune(digitizer_t &dgz, const tune_options_t &topt, std::vector<tune_point_t> &curve, tune_point_t &best)
+{
+  log("tune readout: " << topt.seconds << " s per point");
+  /** the settings to go back to when the sweep fails **/
+  tune_point_t current;
+  current.max_blt = dgz.opt.max_blt;
+  current.msleep = dgz.opt.readout_msleep;
+  current.irq = dgz.opt.readout_irq;
+  curve.clear();
+  for (auto max_blt : topt.max_blt) {
+    std::vector<tune_point_t> points;
+    for (auto ms : topt.poll_msleep) {
+      points.push_back(tune_point_t());
+      points.back().max_blt = max_blt;
+      points.back().msleep = ms;
+    }
+    for (auto irq : { 1, max_blt }) {
+      if (!topt.irq || (irq == max_blt && max_blt == 1 && points.back().irq == 1)) continue;
+      points.push_back(tune_point_t());
+      points.back().max_blt = max_blt;
+      points.back().irq = irq;
+    }
+    for (auto &point : points) {
+      if (!measure(dgz, topt, point)) {
+	apply(dgz, current);
+	return false;
+      }
+      log(describe(point));
+      curve.push_back(point);
+    }
+  }
+  if (curve.empty()) {
+    apply(dgz, current);
+    return false;
+  }
+
+  /** highest event rate, the first (smallest BLT, polling) within 1% wins **/
+  best = curve[0];
+  for (auto &point : curve)
+    if (point.events_per_s > best.events_per_s * 1.01) best = point;
+  /** no events at all (no triggers): nothing to choose from **/
+  if (best.events_per_s == 0.) {
+    error("no events read while tuning, readout settings unchanged");
+    apply(dgz, current);
+    return false;
+  }
+  apply(dgz, best);
+  log("best setting: " << describe(best));
+  return true;
+}
+
 bool
 test_bit(digitizer_t &dgz, uint32_t address, int bit)
 {
@@ -3,12 +3,13 @@
 #include <iostream>
 #include <cstdint>
 #include <ctime>
+#include <chrono>
 #include <map>
 #include <string>
+#include <vector>
 #include <CAENDigitizer.h>
+#include "rwavelog.hh"
 
-#define error(msg) std::cout << " [ERROR] " << msg << std::endl
-#define log(msg) std::cout << " --- " << msg << std::endl
 #define msleep(ms) usleep((ms) * 1000)
 
 namespace dgz {
@@ -18,17 +19,37 @@ struct options_t {
   int frequency = 5000; // 5000 2500 1000 750
   int record_length = 1024; // 1024, 520, 256 and 136
   int max_blt = 1024; // 1-1024
-  int trigger_dc = 32768;
-  int trigger_thr = 20934;
+  /** trigger **/
+  int trigger_dc = 32768;   // TR0/TR1 fast trigger DC offset
+  int trigger_thr = 20934;  // TR0/TR1 fast trigger threshold
   int trigger_sw = 0;
   int trigger_sw_usleep = 1000;
+  bool trigger_ext = true;  // external trigger input
+  bool trigger_fast = false; // TR0/TR1 fast trigger, also digitized as channel 8 of each group
+  int trigger_polarity = 0; // 0 = rising, 1 = falling edge, for fast and self triggers
+  int self_trigger_mask = 0; // channels (gr * 8 + ch) generating a self-trigger
+  int self_trigger_thr = 2048; // self-trigger threshold (ADC counts)
+  int trigger_majority = 1; // group self-triggers required to trigger the board, 1 = OR
   /** readout **/
   int nevents = 1;
   int readout_msleep = 1;
   int readout_timeout = 1000;
+  int readout_irq = 0; // IRQ event threshold, 0 = poll the status register
   int channel_mask = 0xFFFF;
 };
 
+/** the group trigger time tag is a 30-bit counter of 8.5 ns ticks, it wraps every 9.1 s **/
+const int ttag_bits = 30;
+const double ttag_ns = 8.5;
+
+/** unwrapping state of the trigger time tag of one group, reset at every start **/
+struct ttag_clock_t {
+  bool valid = false;
+  uint32_t last = 0;         // previous tag
+  uint64_t high = 0;         // ticks of the wraps seen so far
+  uint64_t last_mono_ns = 0; // monotonic clock of the block of the previous tag
+};
+
 struct digitizer_t {
   bool open = false;
   int handle;
@@ -37,11 +58,16 @@ struct digitizer_t {
   char *buffer = nullptr;
   std::uint32_t allocated_size;
   options_t opt;
+  std::chrono::steady_clock::time_point configured; // end of the last config
+  ttag_clock_t ttag_clock[MAX_X742_GROUP_SIZE];
 };
   
 bool open(digitizer_t &dgz);
 bool close(digitizer_t &dgz);
 bool config(digitizer_t &dgz);
+/** apply the trigger options: external input, fast triggers, self-triggers and group logic **/
+bool config_trigger(digitizer_t &dgz);
+std::string describe_trigger(const options_t &opt);
 bool status(digitizer_t &dgz);
 bool start(digitizer_t &dgz);
 bool stop(digitizer_t &dgz);
@@ -54,4 +80,40 @@ bool test_bit(digitizer_t &dgz, uint32_t address, int bit);
 
 extern std::map<int, CAEN_DGTZ_DRS4Frequency_t> frequencies;
 
+/** wall clock (ns since the epoch), taken for every block transfer, metadata only **/
+uint64_t host_ns();
+/** monotonic clock (ns), taken for every block transfer, not stepped by NTP or date **/
+uint64_t mono_ns();
+/** unwrap a trigger time tag into a monotonic 64-bit tick count. tags must come in
+    readout order; mono_ns, the monotonic clock of the block, recovers the wraps
+    missed when more than one period passes between two readouts **/
+uint64_t extend_ttag(ttag_clock_t &clock, uint32_t ttag, uint64_t mono_ns);
+
+/** wait for data, polling every readout_msleep or on IRQ, false on timeout **/
+bool wait_event(digitizer_t &dgz, int timeout_ms);
+
+/** readout auto-tuner **/
+struct tune_options_t {
+  std::vector<int> max_blt = { 1, 4, 16, 64, 256, 1024 };
+  std::vector<int> poll_msleep = { 0, 1 };
+  bool irq = true;          // also try IRQ with thresholds of 1 and max_blt events
+  double seconds = 1.;      // measurement time per point
+  bool trigger_sw = false;  // send software triggers while measuring
+};
+
+struct tune_point_t {
+  int max_blt = 0;
+  int msleep = 0;
+  int irq = 0;
+  double events_per_s = 0.;
+  double mb_per_s = 0.;
+  double events_per_blt = 0.;
+};
+
+/** measure the readout throughput over the sweep, apply the best setting to dgz.opt and the board.
+    the acquisition must be stopped, it is started and stopped for every point. false, with the
+    settings left as they were, when a point fails or no events were read at all **/
+bool tune(digitizer_t &dgz, const tune_options_t &topt, std::vector<tune_point_t> &curve, tune_point_t &best);
+std::string describe(const tune_point_t &point);
+
 }
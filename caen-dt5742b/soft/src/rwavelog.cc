@@ -0,0 +1,283 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "rwavelog.hh"
+
+namespace logger {
+
+/** bounded multi-producer queue (D. Vyukov): producers claim a cell with one
+    compare-and-swap, the single consumer needs no atomic read-modify-write **/
+
+struct entry_t {
+  level_t level;
+  uint64_t time_ns;          // wall clock, taken by the producer
+  std::string text;
+};
+
+struct cell_t {
+  std::atomic<size_t> sequence;
+  entry_t entry;
+};
+
+static const size_t capacity = 8192;
+static const size_t mask = capacity - 1;
+static std::unique_ptr<cell_t[]> cells;
+static std::atomic<size_t> tail{0};
+static size_t head = 0;      // consumer only
+
+static std::atomic<int> level_{level_info};
+static std::atomic<bool> async{false};
+static std::atomic<uint64_t> n_pushed{0}, n_written{0}, n_dropped{0};
+
+static std::thread writer;
+static std::atomic<bool> running{false};
+static std::mutex wake_mutex;
+static std::condition_variable wake;
+
+static std::mutex file_mutex;
+static std::ofstream file;
+static std::string file_path;
+
+static bool
+enqueue(entry_t &&e)
+{
+  auto pos = tail.load(std::memory_order_relaxed);
+  cell_t *cell;
+  while (true) {
+    cell = &cells[pos & mask];
+    auto seq = cell->sequence.load(std::memory_order_acquire);
+    auto dif = (intptr_t)seq - (intptr_t)pos;
+    if (dif == 0) {
+      if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+    }
+    else if (dif < 0) return false;
+    else pos = tail.load(std::memory_order_relaxed);
+  }
+  cell->entry = std::move(e);
+  cell->sequence.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+static bool
+dequeue(entry_t &e)
+{
+  auto cell = &cells[head & mask];
+  if (cell->sequence.load(std::memory_order_acquire) != head + 1) return false;
+  e = std::move(cell->entry);
+  cell->sequence.store(head + capacity, std::memory_order_release);
+  ++head;
+  return true;
+}
+
+static uint64_t
+wall_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/** "2024-05-17 14:03:12.345" **/
+static void
+timestamp(uint64_t ns, char *out, size_t size)
+{
+  time_t sec = ns / 1000000000ULL;
+  struct tm tm;
+  localtime_r(&sec, &tm);
+  auto n = strftime(out, size, "%Y-%m-%d %H:%M:%S", &tm);
+  snprintf(out + n, size - n, ".%03d", (int)(ns / 1000000ULL % 1000));
+}
+
+static void
+output(const entry_t &e)
+{
+  std::cout << e.text << '\n';
+  std::lock_guard<std::mutex> lock(file_mutex);
+  if (!file.is_open()) return;
+  char ts[32];
+  timestamp(e.time_ns, ts, sizeof(ts));
+  file << ts << " [" << level_name(e.level) << "]" << e.text << '\n';
+}
+
+static void
+flush_outputs()
+{
+  std::cout.flush();
+  std::lock_guard<std::mutex> lock(file_mutex);
+  if (file.is_open()) file.flush();
+}
+
+/** drain the queue, flushing once per batch instead of once per line **/
+static void
+drain()
+{
+  entry_t e;
+  uint64_t n = 0;
+  while (dequeue(e)) {
+    output(e);
+    ++n;
+  }
+  if (n == 0) return;
+  flush_outputs();
+  n_written += n;
+}
+
+static void
+writer_loop()
+{
+  uint64_t reported = 0;
+  while (running) {
+    drain();
+    auto dropped = n_dropped.load();
+    if (dropped != reported) {
+      entry_t e = { level_warning, wall_ns(), " [WARNING] " + std::to_string(dropped - reported) + " log messages dropped, queue full" };
+      output(e);
+      flush_outputs();
+      reported = dropped;
+    }
+    std::unique_lock<std::mutex> lock(wake_mutex);
+    wake.wait_for(lock, std::chrono::milliseconds(50));
+  }
+  drain();
+}
+
+bool
+enabled(level_t level)
+{
+  return level >= level_.load(std::memory_order_relaxed);
+}
+
+void
+push(level_t level, std::string &&text)
+{
+  if (!async.load(std::memory_order_acquire)) {
+    entry_t e = { level, wall_ns(), std::move(text) };
+    output(e);
+    flush_outputs();
+    return;
+  }
+  if (!enqueue({ level, wall_ns(), std::move(text) })) {
+    n_dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  n_pushed.fetch_add(1, std::memory_order_relaxed);
+  /** no lock taken: a wakeup lost to the race is recovered by the writer timeout **/
+  wake.notify_one();
+}
+
+bool
+start(const options_t &opt)
+{
+  set_level(opt.level);
+  if (!opt.file.empty() && !set_file(opt.file)) return false;
+  if (running) return true;
+  if (!cells) {
+    cells.reset(new cell_t[capacity]);
+    for (size_t i = 0; i < capacity; ++i) cells[i].sequence.store(i, std::memory_order_relaxed);
+    std::atexit(stop);
+  }
+  running = true;
+  writer = std::thread(writer_loop);
+  async.store(true, std::memory_order_release);
+  return true;
+}
+
+void
+stop()
+{
+  if (!running) return;
+  /** messages pushed after this point are written synchronously **/
+  async.store(false, std::memory_order_release);
+  running = false;
+  wake.notify_one();
+  if (writer.joinable()) writer.join();
+  /** a producer may have seen the asynchronous mode just before the switch **/
+  drain();
+}
+
+void
+flush()
+{
+  if (!running) return;
+  auto target = n_pushed.load();
+  while (n_written.load() < target) {
+    wake.notify_one();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+void
+set_level(level_t level)
+{
+  if (level == level_debug && !debug_compiled) level = level_info;
+  level_ = level;
+}
+
+level_t
+get_level()
+{
+  return (level_t)level_.load();
+}
+
+bool
+parse_level(const std::string &name, level_t &level)
+{
+  for (int l = level_debug; l <= level_error; ++l) {
+    if (name != level_name((level_t)l)) continue;
+    level = (level_t)l;
+    return true;
+  }
+  return false;
+}
+
+const char *
+level_name(level_t level)
+{
+  switch (level) {
+  case level_debug: return "debug";
+  case level_info: return "info";
+  case level_warning: return "warning";
+  case level_error: return "error";
+  }
+  return "unknown";
+}
+
+bool
+set_file(const std::string &path)
+{
+  std::lock_guard<std::mutex> lock(file_mutex);
+  if (file.is_open()) file.close();
+  file_path.clear();
+  if (path.empty()) return true;
+  file.open(path, std::ios::app);
+  if (!file) return false;
+  file_path = path;
+  return true;
+}
+
+std::string
+get_file()
+{
+  std::lock_guard<std::mutex> lock(file_mutex);
+  return file_path;
+}
+
+counters_t
+counters()
+{
+  counters_t c;
+  c.pushed = n_pushed;
+  c.written = n_written;
+  c.dropped = n_dropped;
+  return c;
+}
+
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+/** leveled logging. messages are formatted by the caller and pushed to a
+    bounded lock-free queue; a background thread writes them to stdout and,
+    optionally, to a log file with timestamps. until start() is called (and
+    after stop()) messages are written synchronously, as the tools always did.
+    debug messages are compiled out unless RWAVE_LOG_DEBUG is defined **/
+
+namespace logger {
+
+enum level_t {
+  level_debug = 0,
+  level_info,
+  level_warning,
+  level_error
+};
+
+#ifdef RWAVE_LOG_DEBUG
+constexpr bool debug_compiled = true;
+#else
+constexpr bool debug_compiled = false;
+#endif
+
+struct options_t {
+  level_t level = level_info;
+  std::string file;          // also write to this file, with timestamps, empty = stdout only
+};
+
+struct counters_t {
+  uint64_t pushed = 0;
+  uint64_t written = 0;
+  uint64_t dropped = 0;      // queue full, the caller never waits
+};
+
+bool enabled(level_t level);
+/** queue one formatted line, never blocks in asynchronous mode **/
+void push(level_t level, std::string &&text);
+
+/** start the background writer **/
+bool start(const options_t &opt);
+/** write what is queued and go back to synchronous writing **/
+void stop();
+/** wait until what is queued now has been written **/
+void flush();
+
+void set_level(level_t level);
+level_t get_level();
+bool parse_level(const std::string &name, level_t &level);
+const char *level_name(level_t level);
+/** open (or close, with an empty path) the log file **/
+bool set_file(const std::string &path);
+std::string get_file();
+counters_t counters();
+
+}
+
+#define RWAVE_LOG(level, msg) do {					\
+    if (logger::enabled(level)) {					\
+      std::ostringstream rwave_log_ss;					\
+      rwave_log_ss << msg;						\
+      logger::push(level, rwave_log_ss.str());				\
+    }									\
+  } while (0)
+
+#define error(msg) RWAVE_LOG(logger::level_error, " [ERROR] " << msg)
+#define warning(msg) RWAVE_LOG(logger::level_warning, " [WARNING] " << msg)
+#define log(msg) RWAVE_LOG(logger::level_info, " --- " << msg)
+#ifdef RWAVE_LOG_DEBUG
+#define debug(msg) RWAVE_LOG(logger::level_debug, " --- " << msg)
+#else
+#define debug(msg) do {} while (0)
+#endif
@@ -0,0 +1,199 @@
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/errqueue.h>
+#include <poll.h>
+#include <netdb.h>
+#include <unistd.h>
+#include "rwavenet.hh"
+#include "rwavelib.hh"
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+
+namespace net {
+
+bool
+tune_socket(int fd, options_t &opt)
+{
+  int one = 1;
+  if (opt.nodelay && setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)))
+    error("setsockopt TCP_NODELAY");
+  if (opt.sndbuf > 0 && setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &opt.sndbuf, sizeof(opt.sndbuf)))
+    error("setsockopt SO_SNDBUF");
+  if (opt.zerocopy && setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one))) {
+    error("setsockopt SO_ZEROCOPY, zero-copy disabled");
+    opt.zerocopy = false;
+  }
+  return true;
+}
+
+bool
+send_all(int fd, const void *buf, std::size_t size)
+{
+  auto ptr = static_cast<const char *>(buf);
+  while (size > 0) {
+    auto n = ::send(fd, ptr, size, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      error("send failed: " << std::strerror(errno));
+      return false;
+    }
+    ptr += n;
+    size -= n;
+  }
+  return true;
+}
+
+/** wait until the kernel reports completion of zero-copy sends [0, count) **/
+static bool
+wait_zerocopy(int fd, uint32_t count)
+{
+  uint32_t completed = 0;
+  while (completed < count) {
+    struct pollfd pfd = { fd, 0, 0 };
+    if (poll(&pfd, 1, 10000) <= 0) {
+      error("timeout waiting for zero-copy completion");
+      return false;
+    }
+    char control[128];
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(fd, &msg, MSG_ERRQUEUE) < 0) {
+      if (errno == EAGAIN || errno == EINTR) continue;
+      error("recvmsg MSG_ERRQUEUE: " << std::strerror(errno));
+      return false;
+    }
+    for (auto cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+      auto serr = reinterpret_cast<struct sock_extended_err *>(CMSG_DATA(cm));
+      if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+      /** notifications cover the range [ee_info, ee_data] of send calls **/
+      completed += serr->ee_data - serr->ee_info + 1;
+    }
+  }
+  return true;
+}
+
+bool
+send_iov(int fd, struct iovec *iov, int iovcnt, const options_t &opt)
+{
+  std::size_t total = 0;
+  for (int i = 0; i < iovcnt; ++i) total += iov[i].iov_len;
+  int flags = MSG_NOSIGNAL;
+  if (opt.zerocopy && total >= opt.zerocopy_threshold) flags |= MSG_ZEROCOPY;
+
+  uint32_t zerocopy_sends = 0;
+  struct msghdr msg;
+  std::memset(&msg, 0, sizeof(msg));
+  while (iovcnt > 0) {
+    /** skip exhausted entries **/
+    if (iov->iov_len == 0) {
+      ++iov;
+      --iovcnt;
+      continue;
+    }
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+    auto n = sendmsg(fd, &msg, flags);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0 && errno == ENOBUFS && (flags & MSG_ZEROCOPY)) {
+      /** out of optmem for pinning pages, copy the rest **/
+      flags &= ~MSG_ZEROCOPY;
+      continue;
+    }
+    if (n <= 0) {
+      error("sendmsg failed: " << std::strerror(errno));
+      wait_zerocopy(fd, zerocopy_sends);
+      return false;
+    }
+    if (flags & MSG_ZEROCOPY) ++zerocopy_sends;
+    /** advance over what has been sent **/
+    std::size_t sent = n;
+    while (sent > 0 && iovcnt > 0) {
+      if (sent < iov->iov_len) {
+	iov->iov_base = static_cast<char *>(iov->iov_base) + sent;
+	iov->iov_len -= sent;
+	sent = 0;
+      }
+      else {
+	sent -= iov->iov_len;
+	iov->iov_len = 0;
+	++iov;
+	--iovcnt;
+      }
+    }
+  }
+
+  if (zerocopy_sends > 0) return wait_zerocopy(fd, zerocopy_sends);
+  return true;
+}
+
+int
+connect(const std::string &host, int port)
+{
+  struct addrinfo hints, *res = nullptr;
+  std::memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res) || !res) {
+    error("cannot resolve address: " << host);
+    return -1;
+  }
+  int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+  if (fd < 0 || ::connect(fd, res->ai_addr, res->ai_addrlen) < 0) {
+    error("cannot connect to " << host << ":" << port);
+    if (fd >= 0) ::close(fd);
+    freeaddrinfo(res);
+    return -1;
+  }
+  freeaddrinfo(res);
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+bool
+recv_all(int fd, void *buf, std::size_t size)
+{
+  auto ptr = static_cast<char *>(buf);
+  while (size > 0) {
+    auto n = ::recv(fd, ptr, size, 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      error("recv failed: " << (n == 0 ? "connection closed" : std::strerror(errno)));
+      return false;
+    }
+    ptr += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool
+command(int fd, const std::string &cmd, std::string &reply)
+{
+  if (!send_all(fd, cmd.c_str(), cmd.size())) return false;
+  /** byte by byte, not to read into binary data that may follow the reply **/
+  reply.clear();
+  char c;
+  while (true) {
+    if (!recv_all(fd, &c, 1)) return false;
+    if (c == '\n') break;
+    reply += c;
+  }
+  reply.erase(reply.find_last_not_of(" \r") + 1);
+  return true;
+}
+
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <sys/uio.h>
+
+namespace net {
+
+struct options_t {
+  bool nodelay = true;                     // disable Nagle on data sockets
+  int sndbuf = 8 << 20;                    // socket send buffer (bytes), 0 = system default
+  bool zerocopy = false;                   // use MSG_ZEROCOPY for large payloads
+  std::size_t zerocopy_threshold = 1 << 20; // minimum payload (bytes) to go zero-copy
+};
+
+/** apply TCP_NODELAY/SO_SNDBUF/SO_ZEROCOPY to a connected socket **/
+bool tune_socket(int fd, options_t &opt);
+
+/** send the whole buffer, retrying partial writes **/
+bool send_all(int fd, const void *buf, std::size_t size);
+
+/** scatter-gather send of the whole iovec array, retrying partial writes.
+    iov is modified in place. with zerocopy enabled, returns only after the
+    kernel has released all the user pages, so the buffers can be reused **/
+bool send_iov(int fd, struct iovec *iov, int iovcnt, const options_t &opt);
+
+/** client side **/
+
+/** connect to host:port, return the socket or -1 **/
+int connect(const std::string &host, int port);
+
+/** receive exactly size bytes **/
+bool recv_all(int fd, void *buf, std::size_t size);
+
+/** send a command and receive the newline-terminated reply **/
+bool command(int fd, const std::string &cmd, std::string &reply);
+
+}
@@ -0,0 +1,105 @@
+#include <algorithm>
+#include "rwavepool.hh"
+
+namespace pool {
+
+static thread_local int current_worker = -1;
+
+pool_t::pool_t(int nthreads)
+{
+  if (nthreads <= 0) nthreads = std::max(1u, std::thread::hardware_concurrency());
+  for (int i = 0; i < nthreads; ++i) queues.emplace_back(new queue_t);
+  for (int i = 0; i < nthreads; ++i) threads.emplace_back(&pool_t::run, this, i);
+}
+
+pool_t::~pool_t()
+{
+  wait();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  cv.notify_all();
+  for (auto &thread : threads) thread.join();
+}
+
+int
+pool_t::worker_id()
+{
+  return current_worker;
+}
+
+void
+pool_t::submit(std::function<void()> task)
+{
+  auto id = next++ % queues.size();
+  ++pending;
+  {
+    std::lock_guard<std::mutex> lock(queues[id]->mutex);
+    queues[id]->tasks.push_back(std::move(task));
+  }
+  ++queued;
+  { std::lock_guard<std::mutex> lock(mutex); }
+  cv.notify_all();
+}
+
+void
+pool_t::wait()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  done_cv.wait(lock, [this] { return pending == 0; });
+}
+
+bool
+pool_t::pop(int id, std::function<void()> &task)
+{
+  /** own deque first, newest task **/
+  {
+    auto &q = *queues[id];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if (!q.tasks.empty()) {
+      task = std::move(q.tasks.back());
+      q.tasks.pop_back();
+      --queued;
+      return true;
+    }
+  }
+  /** then steal the oldest task of another worker **/
+  int n = queues.size();
+  for (int i = 1; i < n; ++i) {
+    auto &q = *queues[(id + i) % n];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if (!q.tasks.empty()) {
+      task = std::move(q.tasks.front());
+      q.tasks.pop_front();
+      --queued;
+      return true;
+    }
+  }
+  return false;
+}
+
+void
+pool_t::run(int id)
+{
+  current_worker = id;
+  std::function<void()> task;
+  while (true) {
+    if (pop(id, task)) {
+      task();
+      task = nullptr;
+      if (--pending == 0) {
+	{ std::lock_guard<std::mutex> lock(mutex); }
+	done_cv.notify_all();
+      }
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    if (stopping) return;
+    /** re-check under the lock, a task may have been queued meanwhile **/
+    cv.wait(lock, [this] { return stopping || queued > 0; });
+    if (stopping) return;
+  }
+}
+
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/** work-stealing thread pool.
+    each worker owns a task deque: it pops its own tasks from the back and,
+    when empty, steals from the front of the other workers' deques **/
+
+namespace pool {
+
+class pool_t {
+
+public:
+
+  explicit pool_t(int nthreads = 0);
+  ~pool_t();
+  /** queue a task, distributed round-robin over the workers **/
+  void submit(std::function<void()> task);
+  /** block until all submitted tasks have completed **/
+  void wait();
+  int size() const { return threads.size(); };
+  /** index of the calling worker in [0, size()), -1 outside the pool **/
+  static int worker_id();
+
+private:
+
+  struct queue_t {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  std::vector<std::unique_ptr<queue_t>> queues;
+  std::vector<std::thread> threads;
+  std::atomic<int> pending{0}; // queued or running
+  std::atomic<int> queued{0};  // waiting in a deque
+  std::atomic<unsigned> next{0};
+  bool stopping = false;
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::condition_variable done_cv;
+
+  bool pop(int id, std::function<void()> &task);
+  void run(int id);
+
+};
+
+}
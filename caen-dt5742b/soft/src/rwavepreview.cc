@@ -0,0 +1,200 @@
+#include <algorithm>
+#include <cerrno>
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "rwavepreview.hh"
+#include "rwavekern.hh"
+#include "rwavenet.hh"
+#include "rwavelib.hh"
+
+namespace preview {
+
+struct streamer_t {
+  int fd = -1;
+  options_t opt;
+  std::thread thread;
+  std::atomic<bool> running{true};
+  std::atomic<bool> done{false};
+};
+
+static std::mutex latest_mutex;
+static std::shared_ptr<const snapshot_t> latest;
+static uint64_t sequence = 0;
+
+static std::mutex streamers_mutex;
+static std::list<std::unique_ptr<streamer_t>> streamers;
+static std::atomic<int> n_subscribers{0};
+
+bool
+active()
+{
+  return n_subscribers > 0;
+}
+
+void
+publish(std::shared_ptr<snapshot_t> snapshot)
+{
+  std::lock_guard<std::mutex> lock(latest_mutex);
+  snapshot->sequence = ++sequence;
+  latest = std::move(snapshot);
+}
+
+static std::shared_ptr<const snapshot_t>
+get_latest()
+{
+  std::lock_guard<std::mutex> lock(latest_mutex);
+  return latest;
+}
+
+int
+n_points(const options_t &opt, int record_length)
+{
+  if (opt.mode == mode_envelope) return std::min(opt.width, record_length);
+  return (record_length + opt.factor - 1) / opt.factor;
+}
+
+int
+build(const snapshot_t &snapshot, const options_t &opt, std::vector<float> &out)
+{
+  int length = snapshot.record_length;
+  int points = n_points(opt, length);
+  int n_channels = snapshot.channels.size();
+  out.resize((size_t)n_channels * points * (opt.mode == mode_envelope ? 2 : 1));
+  float *o = out.data();
+  for (int i = 0; i < n_channels; ++i) {
+    const float *x = &snapshot.data[(size_t)i * length];
+    if (opt.mode == mode_envelope) {
+      /** pixel columns cover [p * length / points, (p + 1) * length / points) **/
+      for (int p = 0; p < points; ++p) {
+	int begin = p * length / points, end = (p + 1) * length / points;
+	kern::minmax(x + begin, end - begin, o[0], o[1]);
+	o += 2;
+      }
+      continue;
+    }
+    for (int begin = 0; begin < length; begin += opt.factor) {
+      int n = std::min(opt.factor, length - begin);
+      *o++ = kern::sum(x + begin, n) / n;
+    }
+  }
+  return points;
+}
+
+static void
+stream(streamer_t &s)
+{
+  auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1. / s.opt.fps));
+  auto next = std::chrono::steady_clock::now();
+  uint64_t last_sequence = 0;
+  uint32_t frame = 0;
+  std::vector<float> out;
+  while (s.running) {
+    /** wait for the next frame, watching the socket: any input or a hangup ends the stream **/
+    auto now = std::chrono::steady_clock::now();
+    if (now < next) {
+      auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count();
+      struct pollfd pfd = { s.fd, POLLIN, 0 };
+      int ret = poll(&pfd, 1, (int)std::min<long>(wait + 1, 100));
+      if (ret < 0 && errno != EINTR) break;
+      if (ret > 0) break;
+      continue;
+    }
+    next += period;
+    if (next < now) next = now + period; // do not burst after a stall
+    /** frames are only sent when the acquisition published a new event **/
+    auto snapshot = get_latest();
+    if (!snapshot || snapshot->sequence == last_sequence) continue;
+    last_sequence = snapshot->sequence;
+    int points = build(*snapshot, s.opt, out);
+    frame_header_t header = {};
+    header.magic = frame_magic;
+    header.header_size = sizeof(header);
+    header.mode = s.opt.mode;
+    header.n_channels = snapshot->channels.size();
+    header.frame = frame++;
+    header.n_points = points;
+    header.sequence = snapshot->sequence;
+    header.record_length = snapshot->record_length;
+    header.frequency = snapshot->frequency;
+    struct iovec iov[3] = {
+      { &header, sizeof(header) },
+      { (void *)snapshot->channels.data(), snapshot->channels.size() },
+      { out.data(), out.size() * sizeof(float) }
+    };
+    net::options_t nopt;
+    if (!net::send_iov(s.fd, iov, 3, nopt)) break;
+  }
+  /** the descriptor is closed by whoever joins the thread, stop_all may still shut it down **/
+  shutdown(s.fd, SHUT_RDWR);
+  log("preview client disconnected after " << frame << " frames");
+  --n_subscribers;
+  s.done = true;
+}
+
+/** join the streamers whose client went away, called with streamers_mutex held **/
+static void
+reap()
+{
+  for (auto it = streamers.begin(); it != streamers.end(); ) {
+    if (!(*it)->done) { ++it; continue; }
+    (*it)->thread.join();
+    close((*it)->fd);
+    it = streamers.erase(it);
+  }
+}
+
+bool
+subscribe(int fd, const options_t &opt)
+{
+  std::lock_guard<std::mutex> lock(streamers_mutex);
+  reap();
+  auto s = std::make_unique<streamer_t>();
+  s->fd = fd;
+  s->opt = opt;
+  ++n_subscribers;
+  auto ptr = s.get();
+  s->thread = std::thread(stream, std::ref(*ptr));
+  streamers.push_back(std::move(s));
+  return true;
+}
+
+void
+stop_all()
+{
+  std::lock_guard<std::mutex> lock(streamers_mutex);
+  /** shutting the socket down wakes a streamer blocked on a client that stopped reading **/
+  for (auto &s : streamers) {
+    s->running = false;
+    shutdown(s->fd, SHUT_RDWR);
+  }
+  for (auto &s : streamers) {
+    s->thread.join();
+    close(s->fd);
+  }
+  streamers.clear();
+}
+
+int
+subscribers()
+{
+  return n_subscribers;
+}
+
+std::string
+describe(const options_t &opt)
+{
+  std::ostringstream ss;
+  if (opt.mode == mode_envelope) ss << "envelope width " << opt.width;
+  else ss << "decimate factor " << opt.factor;
+  ss << " at " << opt.fps << " fps";
+  return ss.str();
+}
+
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/** decimated preview stream for live displays.
+    the acquisition publishes a copy of the latest accepted event, streamer
+    threads turn it into small frames (min/max envelope or averaged samples)
+    and push them to subscribed clients at a fixed frame rate **/
+
+namespace preview {
+
+enum mode_t {
+  mode_envelope = 0,   // min and max per pixel column
+  mode_decimate = 1    // mean of every factor samples
+};
+
+struct options_t {
+  int mode = mode_envelope;
+  int width = 256;     // envelope points per channel
+  int factor = 8;      // decimation factor
+  double fps = 10.;
+};
+
+/** frame preamble, followed by the channel list (uint8_t) and the float data:
+    envelope [channel][point][min, max], decimate [channel][point] **/
+const uint32_t frame_magic = 0x56505752; // "RWPV"
+
+struct frame_header_t {
+  uint32_t magic;
+  uint16_t header_size;
+  uint8_t mode;
+  uint8_t n_channels;
+  uint32_t frame;          // frames sent to this subscriber
+  uint32_t n_points;       // points per channel
+  uint64_t sequence;       // snapshot published by the acquisition
+  uint16_t record_length;
+  uint16_t frequency;
+  uint32_t reserved;
+};
+static_assert(sizeof(frame_header_t) == 32, "frame_header_t must be packed to 32 bytes");
+
+struct snapshot_t {
+  uint64_t sequence = 0;
+  uint16_t record_length = 0;
+  uint16_t frequency = 0;
+  std::vector<uint8_t> channels;
+  std::vector<float> data;  // [channel][sample]
+};
+
+/** true if at least one client is subscribed, snapshots are not taken otherwise **/
+bool active();
+
+/** make the snapshot the latest one, sequence is assigned here **/
+void publish(std::shared_ptr<snapshot_t> snapshot);
+
+/** points per channel of a frame **/
+int n_points(const options_t &opt, int record_length);
+
+/** reduce the snapshot into out, returns the number of points per channel **/
+int build(const snapshot_t &snapshot, const options_t &opt, std::vector<float> &out);
+
+/** hand the connected socket over to a streamer thread, which owns and closes it.
+    the stream ends when the client sends anything or disconnects **/
+bool subscribe(int fd, const options_t &opt);
+
+/** stop all streamers and close their sockets **/
+void stop_all();
+
+int subscribers();
+
+std::string describe(const options_t &opt);
+
+}
@@ -0,0 +1,378 @@
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "rwaverec.hh"
+
+namespace rec {
+
+const std::size_t alignment = 4096;
+
+struct uring_t {
+  int fd = -1;
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_sqe *sqes = nullptr;
+  struct io_uring_cqe *cqes = nullptr;
+  void *sq_ptr = nullptr, *cq_ptr = nullptr;
+  std::size_t sq_len = 0, cq_len = 0, sqes_len = 0;
+  int inflight = 0;
+};
+
+const uint64_t fsync_tag = ~0ULL;
+
+static void
+uring_destroy(uring_t *u)
+{
+  if (!u) return;
+  if (u->sqes) munmap(u->sqes, u->sqes_len);
+  if (u->cq_ptr && u->cq_ptr != u->sq_ptr) munmap(u->cq_ptr, u->cq_len);
+  if (u->sq_ptr) munmap(u->sq_ptr, u->sq_len);
+  if (u->fd >= 0) ::close(u->fd);
+  delete u;
+}
+
+static uring_t *
+uring_create(unsigned entries)
+{
+  struct io_uring_params p;
+  std::memset(&p, 0, sizeof(p));
+  auto u = new uring_t;
+  u->fd = syscall(__NR_io_uring_setup, entries, &p);
+  if (u->fd < 0) {
+    delete u;
+    return nullptr;
+  }
+  u->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  u->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+  if (single) u->sq_len = u->cq_len = std::max(u->sq_len, u->cq_len);
+  u->sq_ptr = mmap(nullptr, u->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+  if (u->sq_ptr == MAP_FAILED) {
+    u->sq_ptr = nullptr;
+    uring_destroy(u);
+    return nullptr;
+  }
+  u->cq_ptr = single ? u->sq_ptr : mmap(nullptr, u->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+  if (u->cq_ptr == MAP_FAILED) {
+    u->cq_ptr = nullptr;
+    uring_destroy(u);
+    return nullptr;
+  }
+  u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  u->sqes = (struct io_uring_sqe *)mmap(nullptr, u->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+  if (u->sqes == MAP_FAILED) {
+    u->sqes = nullptr;
+    uring_destroy(u);
+    return nullptr;
+  }
+  auto sq = (char *)u->sq_ptr;
+  auto cq = (char *)u->cq_ptr;
+  u->sq_head = (unsigned *)(sq + p.sq_off.head);
+  u->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+  u->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+  u->sq_array = (unsigned *)(sq + p.sq_off.array);
+  u->cq_head = (unsigned *)(cq + p.cq_off.head);
+  u->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+  u->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+  u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+  return u;
+}
+
+static bool
+uring_submit(uring_t *u, uint8_t opcode, int fd, const struct iovec *iov, uint64_t offset, uint64_t tag, uint8_t sqe_flags = 0)
+{
+  unsigned tail = *u->sq_tail;
+  unsigned index = tail & *u->sq_mask;
+  auto sqe = &u->sqes[index];
+  std::memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->flags = sqe_flags;
+  if (iov) {
+    sqe->addr = (uint64_t)iov;
+    sqe->len = 1;
+    sqe->off = offset;
+  }
+  else sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+  sqe->user_data = tag;
+  u->sq_array[index] = index;
+  __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  while (syscall(__NR_io_uring_enter, u->fd, 1, 0, 0, nullptr, 0) < 0)
+    if (errno != EINTR) return false;
+  ++u->inflight;
+  return true;
+}
+
+/** write a chunk, or what the kernel left of a short write. an O_DIRECT
+    descriptor takes only aligned writes: an unaligned tail is finished
+    through a buffered descriptor of the same file **/
+static bool
+pwrite_all(writer_t &w, const char *data, std::size_t size, uint64_t offset)
+{
+  int fd = w.fd, tail_fd = -1;
+  bool ok = true;
+  while (size > 0) {
+    if (w.direct && tail_fd < 0 && (offset % alignment != 0 || (uintptr_t)data % alignment != 0 || size % alignment != 0)) {
+      tail_fd = ::open(w.path.c_str(), O_WRONLY);
+      if (tail_fd < 0) {
+	ok = false;
+	break;
+      }
+      fd = tail_fd;
+    }
+    auto n = ::pwrite(fd, data, size, offset);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      ok = false;
+      break;
+    }
+    data += n;
+    size -= n;
+    offset += n;
+  }
+  if (tail_fd >= 0) {
+    int err = errno;
+    ::close(tail_fd);
+    errno = err;
+  }
+  return ok;
+}
+
+/** reap completions, waiting for at least min_complete **/
+static bool
+uring_reap(writer_t &w, int min_complete)
+{
+  auto u = w.uring;
+  if (min_complete > 0)
+    while (syscall(__NR_io_uring_enter, u->fd, 0, min_complete, IORING_ENTER_GETEVENTS, nullptr, 0) < 0)
+      if (errno != EINTR) return false;
+  unsigned head = *u->cq_head;
+  unsigned tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+  for (; head != tail; ++head) {
+    auto cqe = &u->cqes[head & *u->cq_mask];
+    --u->inflight;
+    if (cqe->user_data == fsync_tag) {
+      if (cqe->res < 0) std::cout << " [ERROR] recording fsync failed: " << std::strerror(-cqe->res) << std::endl;
+      continue;
+    }
+    auto &c = w.chunks[cqe->user_data];
+    if (cqe->res < 0) {
+      std::cout << " [ERROR] recording write failed: " << std::strerror(-cqe->res) << std::endl;
+      w.failed = true;
+    }
+    else if ((std::size_t)cqe->res < c.iov.iov_len &&
+	     !pwrite_all(w, (char *)c.iov.iov_base + cqe->res, c.iov.iov_len - cqe->res, c.offset + cqe->res)) {
+      std::cout << " [ERROR] recording write failed: " << std::strerror(errno) << std::endl;
+      w.failed = true;
+    }
+    c.busy = false;
+  }
+  __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+  return true;
+}
+
+static void
+writer_loop(writer_t &w)
+{
+  std::unique_lock<std::mutex> lock(w.mutex);
+  while (true) {
+    w.cv.wait(lock, [&w] { return w.stopping || !w.queue.empty(); });
+    if (w.queue.empty()) return;
+    int ichunk = w.queue.front();
+    w.queue.pop_front();
+    auto &c = w.chunks[ichunk];
+    lock.unlock();
+    bool ok = pwrite_all(w, (char *)c.iov.iov_base, c.iov.iov_len, c.offset);
+    if (!ok) std::cout << " [ERROR] recording write failed: " << std::strerror(errno) << std::endl;
+    bool sync = false;
+    if (w.opt.fsync == fsync_interval) {
+      w.since_sync += c.iov.iov_len;
+      if (w.since_sync >= w.opt.fsync_bytes) {
+	sync = true;
+	w.since_sync = 0;
+      }
+    }
+    if (sync) fdatasync(w.fd);
+    lock.lock();
+    if (!ok) w.failed = true;
+    c.busy = false;
+    w.cv.notify_all();
+  }
+}
+
+/** hand a chunk to the backend, padded to the alignment when writing O_DIRECT **/
+static bool
+submit(writer_t &w, int ichunk)
+{
+  auto &c = w.chunks[ichunk];
+  std::size_t len = c.fill;
+  if (w.direct) {
+    std::size_t padded = (len + alignment - 1) / alignment * alignment;
+    std::memset(c.data + len, 0, padded - len);
+    len = padded;
+  }
+  c.offset = w.offset;
+  c.iov.iov_base = c.data;
+  c.iov.iov_len = len;
+  c.busy = true;
+  ++w.n_chunks;
+  if (w.uring) {
+    if (!uring_submit(w.uring, IORING_OP_WRITEV, w.fd, &c.iov, c.offset, ichunk)) {
+      std::cout << " [ERROR] io_uring submission failed: " << std::strerror(errno) << std::endl;
+      c.busy = false;
+      w.failed = true;
+      return false;
+    }
+    if (w.opt.fsync == fsync_interval) {
+      w.since_sync += len;
+      if (w.since_sync >= w.opt.fsync_bytes) {
+	w.since_sync = 0;
+	/** drain: the fsync starts only after the writes submitted before it completed **/
+	uring_submit(w.uring, IORING_OP_FSYNC, w.fd, nullptr, 0, fsync_tag, IOSQE_IO_DRAIN);
+      }
+    }
+    uring_reap(w, 0);
+    return true;
+  }
+  {
+    std::lock_guard<std::mutex> lock(w.mutex);
+    w.queue.push_back(ichunk);
+  }
+  w.cv.notify_all();
+  return true;
+}
+
+static void
+wait_chunk(writer_t &w, int ichunk)
+{
+  auto &c = w.chunks[ichunk];
+  if (w.uring) {
+    uring_reap(w, 0);
+    if (c.busy) ++w.n_stalls;
+    while (c.busy && uring_reap(w, 1));
+    return;
+  }
+  std::unique_lock<std::mutex> lock(w.mutex);
+  if (c.busy) ++w.n_stalls;
+  w.cv.wait(lock, [&c] { return !c.busy; });
+}
+
+bool
+open(writer_t &w, const std::string &path, const options_t &opt)
+{
+  w.path = path;
+  w.opt = opt;
+  w.opt.chunk_size = std::max(alignment, opt.chunk_size / alignment * alignment);
+  w.opt.n_chunks = std::max(2, opt.n_chunks);
+  w.failed = false;
+  w.current = 0;
+  w.offset = w.size = w.since_sync = 0;
+  w.n_chunks = w.n_stalls = 0;
+
+  int flags = O_WRONLY | O_CREAT | O_TRUNC;
+  w.direct = false;
+  w.fd = -1;
+  if (w.opt.direct) {
+    w.fd = ::open(path.c_str(), flags | O_DIRECT, 0644);
+    w.direct = w.fd >= 0;
+    if (w.fd < 0) std::cout << " --- O_DIRECT not available for " << path << ", using buffered writes " << std::endl;
+  }
+  if (w.fd < 0) w.fd = ::open(path.c_str(), flags, 0644);
+  if (w.fd < 0) {
+    std::cout << " [ERROR] cannot open recording file " << path << ": " << std::strerror(errno) << std::endl;
+    return false;
+  }
+  if (w.opt.prealloc > 0 && fallocate(w.fd, 0, 0, w.opt.prealloc) != 0)
+    std::cout << " --- cannot preallocate " << w.opt.prealloc << " bytes: " << std::strerror(errno) << std::endl;
+
+  w.chunks.assign(w.opt.n_chunks, chunk_t());
+  for (auto &c : w.chunks) {
+    void *ptr = nullptr;
+    if (posix_memalign(&ptr, alignment, w.opt.chunk_size) != 0) {
+      std::cout << " [ERROR] cannot allocate recording buffers " << std::endl;
+      close(w);
+      return false;
+    }
+    c.data = (char *)ptr;
+  }
+
+  w.uring = w.opt.uring ? uring_create(2 * w.opt.n_chunks) : nullptr;
+  if (!w.uring) {
+    if (w.opt.uring) std::cout << " --- io_uring not available, using a writer thread " << std::endl;
+    w.stopping = false;
+    w.queue.clear();
+    w.thread = std::thread(writer_loop, std::ref(w));
+  }
+  return true;
+}
+
+bool
+append(writer_t &w, const struct iovec *iov, int iovcnt)
+{
+  if (w.fd < 0 || w.failed) return false;
+  for (int i = 0; i < iovcnt; ++i) {
+    auto src = (const char *)iov[i].iov_base;
+    std::size_t len = iov[i].iov_len;
+    while (len > 0) {
+      auto &c = w.chunks[w.current];
+      std::size_t n = std::min(len, w.opt.chunk_size - c.fill);
+      std::memcpy(c.data + c.fill, src, n);
+      c.fill += n;
+      src += n;
+      len -= n;
+      w.size += n;
+      if (c.fill < w.opt.chunk_size) continue;
+      /** chunk full, write it and move to the next one **/
+      if (!submit(w, w.current)) return false;
+      w.offset += w.opt.chunk_size;
+      w.current = (w.current + 1) % w.chunks.size();
+      wait_chunk(w, w.current);
+      w.chunks[w.current].fill = 0;
+      if (w.failed) return false;
+    }
+  }
+  return true;
+}
+
+bool
+close(writer_t &w)
+{
+  if (w.fd < 0) return true;
+  if (!w.chunks.empty() && w.chunks[w.current].fill > 0 && !w.failed) submit(w, w.current);
+  /** drain **/
+  if (w.uring) {
+    while (w.uring->inflight > 0 && uring_reap(w, 1));
+    uring_destroy(w.uring);
+    w.uring = nullptr;
+  }
+  else if (w.thread.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(w.mutex);
+      w.stopping = true;
+    }
+    w.cv.notify_all();
+    w.thread.join();
+  }
+  /** drop the alignment padding and the unused preallocated space **/
+  if (ftruncate(w.fd, w.size) != 0)
+    std::cout << " [ERROR] cannot truncate recording file: " << std::strerror(errno) << std::endl;
+  if (w.opt.fsync != fsync_never) fsync(w.fd);
+  ::close(w.fd);
+  w.fd = -1;
+  for (auto &c : w.chunks) free(c.data);
+  w.chunks.clear();
+  return !w.failed;
+}
+
+std::string
+backend(const writer_t &w)
+{
+  return std::string(w.uring ? "io_uring" : "writer thread") + (w.direct ? ", O_DIRECT" : ", buffered");
+}
+
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <sys/uio.h>
+
+/** sequential file writer for server-side recording.
+    data are appended to a small ring of large aligned chunks; full chunks
+    are written with io_uring (raw syscalls, no liburing), or by a writer
+    thread when io_uring is not available, so that the acquisition only
+    pays for a memcpy. files are opened with O_DIRECT when possible **/
+
+namespace rec {
+
+enum fsync_t {
+  fsync_never = 0,
+  fsync_close = 1,    // once, when the file is closed
+  fsync_interval = 2  // every fsync_bytes written
+};
+
+struct options_t {
+  bool direct = true;
+  bool uring = true;
+  std::size_t chunk_size = 8 << 20;  // multiple of 4096
+  int n_chunks = 4;
+  uint64_t prealloc = 0;             // bytes reserved with fallocate at open
+  int fsync = fsync_close;
+  uint64_t fsync_bytes = 256 << 20;
+};
+
+/** block preamble of raw recordings, followed by the CAEN readout buffer **/
+const uint32_t raw_magic = 0x42525752; // "RWRB"
+
+struct raw_header_t {
+  uint32_t magic;
+  uint32_t header_size;
+  uint32_t n_events;
+  uint32_t reserved;
+  uint64_t size;       // bytes of readout buffer that follow
+  uint64_t time_ns;    // host time of the readout (CLOCK_REALTIME)
+};
+
+struct chunk_t {
+  char *data = nullptr;
+  std::size_t fill = 0;
+  bool busy = false;
+  uint64_t offset = 0;
+  struct iovec iov;
+};
+
+struct uring_t;
+
+struct writer_t {
+  std::string path;
+  options_t opt;
+  int fd = -1;
+  bool direct = false;
+  bool failed = false;
+  std::vector<chunk_t> chunks;
+  int current = 0;
+  uint64_t offset = 0;      // file offset of the current chunk
+  uint64_t size = 0;        // bytes appended
+  uint64_t since_sync = 0;
+  /** counters **/
+  uint64_t n_chunks = 0;
+  uint64_t n_stalls = 0;    // appends that waited for a free chunk
+  /** io_uring backend **/
+  uring_t *uring = nullptr;
+  /** writer thread backend **/
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<int> queue;
+  bool stopping = false;
+};
+
+bool open(writer_t &w, const std::string &path, const options_t &opt);
+/** copy the buffers at the end of the file **/
+bool append(writer_t &w, const struct iovec *iov, int iovcnt);
+/** flush, wait for all writes, trim to the appended size and close **/
+bool close(writer_t &w);
+std::string backend(const writer_t &w);
+
+}
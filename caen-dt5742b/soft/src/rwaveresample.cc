@@ -0,0 +1,80 @@
+#include <sstream>
+#include "rwaveresample.hh"
+#include "rwavelib.hh"
+
+namespace resample {
+
+static void
+clear(resampler_t &rs)
+{
+  for (auto &p : rs.plans) delete p.exchange(nullptr);
+}
+
+resampler_t::~resampler_t()
+{
+  clear(*this);
+}
+
+float
+step(const options_t &opt, int frequency)
+{
+  if (opt.method == kern::interp_off) return 0.;
+  return opt.step > 0. ? opt.step : 1000. / frequency;
+}
+
+bool
+setup(resampler_t &rs, const options_t &opt, int handle, int frequency, int record_length)
+{
+  if (rs.frequency == frequency && rs.record_length == record_length &&
+      rs.opt.method == opt.method && rs.opt.step == opt.step) return true;
+  clear(rs);
+  rs.opt = opt;
+  rs.record_length = record_length;
+  rs.step = step(opt, frequency);
+  if (rs.frequency == frequency) return true;
+  rs.frequency = 0;
+  CAEN_DGTZ_DRS4Correction_t tables[MAX_X742_GROUP_SIZE];
+  if (CAEN_DGTZ_GetCorrectionTables(handle, dgz::frequencies[frequency], tables)) {
+    error("CAEN_DGTZ_GetCorrectionTables");
+    return false;
+  }
+  for (int igr = 0; igr < MAX_X742_GROUP_SIZE; ++igr)
+    std::copy(tables[igr].time, tables[igr].time + 1024, rs.ring[igr]);
+  rs.frequency = frequency;
+  log("resampling: " << describe(opt, frequency) << ", cell times loaded");
+  return true;
+}
+
+const kern::plan_t &
+plan(resampler_t &rs, int group, int start)
+{
+  auto &slot = rs.plans[group * 1024 + start % 1024];
+  if (auto p = slot.load(std::memory_order_acquire)) return *p;
+  /** two threads may build the same plan, the second one is dropped **/
+  auto p = new kern::plan_t;
+  std::vector<float> t(rs.record_length);
+  kern::cell_times(rs.ring[group], start, rs.record_length, 1000. / rs.frequency, t.data());
+  kern::plan(t.data(), rs.record_length, rs.step, rs.record_length, rs.opt.method, *p);
+  kern::plan_t *expected = nullptr;
+  if (slot.compare_exchange_strong(expected, p, std::memory_order_acq_rel)) return *p;
+  delete p;
+  return *expected;
+}
+
+void
+apply(resampler_t &rs, int group, int start, float *x, float *scratch)
+{
+  kern::apply(plan(rs, group, start), x, scratch);
+  std::copy(scratch, scratch + rs.record_length, x);
+}
+
+std::string
+describe(const options_t &opt, int frequency)
+{
+  if (opt.method == kern::interp_off) return "off";
+  std::ostringstream ss;
+  ss << kern::interp_name(opt.method) << ", step " << step(opt, frequency) << " ns";
+  return ss.str();
+}
+
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <CAENDigitizer.h>
+#include "rwavekern.hh"
+
+/** resampling of the records onto a uniform time grid.
+    the DRS4 cells have different widths: the time of every sample comes from
+    the cell times of the correction tables, rotated by the start cell. the
+    interpolation plan only depends on the group and on the start cell, so it
+    is built once per start cell and shared by every channel and event **/
+
+namespace resample {
+
+struct options_t {
+  kern::interp_t method = kern::interp_off;
+  float step = 0.;            // grid step (ns), 0 = nominal sampling period
+};
+
+/** range of an explicit grid step (ns): the v2 header carries it as uint16_t picoseconds **/
+const float min_step = 0.001;
+const float max_step = 65.535;
+
+struct resampler_t {
+  options_t opt;              // of the plans
+  int frequency = 0;          // of the cell times (MHz)
+  int record_length = 0;
+  float step = 0.;            // grid step in use (ns)
+  float ring[MAX_X742_GROUP_SIZE][1024];
+  /** [group * 1024 + start cell], built on first use **/
+  std::vector<std::atomic<kern::plan_t *>> plans;
+  resampler_t() : plans(MAX_X742_GROUP_SIZE * 1024) {}
+  ~resampler_t();
+};
+
+/** load the cell times of the board at this frequency and drop the plans when
+    anything changed, call before a block is resampled **/
+bool setup(resampler_t &rs, const options_t &opt, int handle, int frequency, int record_length);
+
+/** plan of a record, safe to call from several threads **/
+const kern::plan_t &plan(resampler_t &rs, int group, int start);
+
+/** resample one record of record_length samples in place, scratch holds as many floats **/
+void apply(resampler_t &rs, int group, int start, float *x, float *scratch);
+
+/** grid step (ns) of the output, 0 when off **/
+float step(const options_t &opt, int frequency);
+
+std::string describe(const options_t &opt, int frequency);
+
+}
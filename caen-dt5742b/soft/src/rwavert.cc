@@ -0,0 +1,114 @@
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "rwavert.hh"
+#include "rwavelib.hh"
+
+namespace rt {
+
+static bool
+save(thread_state_t &state)
+{
+  if (state.saved) return true;
+  if (pthread_getaffinity_np(pthread_self(), sizeof(state.affinity), &state.affinity) ||
+      pthread_getschedparam(pthread_self(), &state.policy, &state.param)) {
+    error("cannot read the thread scheduling parameters");
+    return false;
+  }
+  state.saved = true;
+  return true;
+}
+
+bool
+enter(const options_t &opt, thread_state_t &state)
+{
+  if (!save(state)) return false;
+  bool ok = true;
+  if (opt.cpu >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(opt.cpu, &set);
+    if (int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) {
+      error("cannot pin the acquisition thread to CPU " << opt.cpu << ": " << std::strerror(err));
+      ok = false;
+    }
+  }
+  if (opt.priority > 0) {
+    struct sched_param param = {};
+    param.sched_priority = opt.priority;
+    if (int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)) {
+      error("cannot switch the acquisition thread to SCHED_FIFO: " << std::strerror(err));
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+bool
+avoid(const options_t &opt, thread_state_t &state)
+{
+  if (opt.cpu < 0) return true;
+  if (!save(state)) return false;
+  cpu_set_t set = state.affinity;
+  CPU_CLR(opt.cpu, &set);
+  if (CPU_COUNT(&set) == 0) return true;
+  if (int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) {
+    error("cannot move the thread off CPU " << opt.cpu << ": " << std::strerror(err));
+    return false;
+  }
+  return true;
+}
+
+void
+leave(thread_state_t &state)
+{
+  if (!state.saved) return;
+  pthread_setaffinity_np(pthread_self(), sizeof(state.affinity), &state.affinity);
+  pthread_setschedparam(pthread_self(), state.policy, &state.param);
+  state.saved = false;
+}
+
+bool
+lock_memory(bool on)
+{
+  if (!on) return munlockall() == 0;
+  if (mlockall(MCL_CURRENT | MCL_FUTURE)) {
+    error("mlockall failed: " << std::strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+void
+prefault(void *ptr, std::size_t size, bool hugepages)
+{
+  if (!ptr || size == 0) return;
+  auto begin = reinterpret_cast<uintptr_t>(ptr), end = begin + size;
+  if (hugepages) {
+    /** madvise wants whole hugepages **/
+    const uintptr_t huge = 2 << 20;
+    uintptr_t hbegin = (begin + huge - 1) & ~(huge - 1), hend = end & ~(huge - 1);
+    if (hend > hbegin && madvise(reinterpret_cast<void *>(hbegin), hend - hbegin, MADV_HUGEPAGE))
+      error("madvise MADV_HUGEPAGE failed: " << std::strerror(errno));
+  }
+  /** write back what is there, so that prefaulting never changes the content **/
+  const uintptr_t page = sysconf(_SC_PAGESIZE);
+  for (uintptr_t p = begin & ~(page - 1); p < end; p += page) {
+    auto c = reinterpret_cast<volatile char *>(p < begin ? begin : p);
+    *c = *c;
+  }
+}
+
+std::string
+describe(const options_t &opt)
+{
+  std::ostringstream ss;
+  ss << (opt.enabled ? "on" : "off") << ", cpu " << opt.cpu << ", priority " << opt.priority
+     << ", hugepages " << (opt.hugepages ? "on" : "off");
+  return ss.str();
+}
+
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <sched.h>
+
+/** opt-in real-time mode for the acquisition thread: CPU pinning,
+    SCHED_FIFO, locked and prefaulted memory. the readout latency is
+    measured by the readout stage of the stats module **/
+
+namespace rt {
+
+struct options_t {
+  bool enabled = false;
+  int cpu = -1;            // CPU reserved to the acquisition thread, -1 = no pinning
+  int priority = 50;       // SCHED_FIFO priority (1-99), 0 = keep the default scheduler
+  bool hugepages = false;  // back the large buffers with transparent hugepages
+};
+
+struct thread_state_t {
+  bool saved = false;
+  cpu_set_t affinity;
+  int policy = SCHED_OTHER;
+  struct sched_param param;
+};
+
+/** pin the calling thread to opt.cpu and switch it to SCHED_FIFO, saving the previous setting **/
+bool enter(const options_t &opt, thread_state_t &state);
+/** keep the calling thread (logging, network) off opt.cpu **/
+bool avoid(const options_t &opt, thread_state_t &state);
+/** restore the setting saved by enter or avoid **/
+void leave(thread_state_t &state);
+
+/** enter for the lifetime of the scope, does nothing when opt is not enabled **/
+struct scope_t {
+  thread_state_t state;
+  scope_t(const options_t &opt) { if (opt.enabled) enter(opt, state); }
+  ~scope_t() { leave(state); }
+};
+
+/** mlockall current and future mappings, or unlock everything **/
+bool lock_memory(bool on);
+
+/** advise hugepages and touch every page, so that no page fault happens during the acquisition **/
+void prefault(void *ptr, std::size_t size, bool hugepages);
+
+std::string describe(const options_t &opt);
+
+}
@@ -0,0 +1,513 @@
+#include <boost/program_options.hpp>
+#include <algorithm>
+#include <cmath>
+#include <array>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <fstream>
+#include "rwavelib.hh"
+#include "phylib.hh"
+#include "TROOT.h"
+#include "TFile.h"
+#include "TTree.h"
+
+using namespace dgz;
+
+/** the data of one scan point, handed from the acquisition to the writer thread **/
+struct point_t {
+  int index = 0;
+  double target[2] = {0.};
+  double position[2] = {0.};
+  double acq_time = 0.; // seconds
+  int nevents = 0;
+  bool in_position = true; // the stage reached the point within the move timeout
+  bool complete = true;    // all the events were acquired
+  bool failed = false;     // a readout call failed, the scan is aborted
+  std::vector<uint32_t> ttag[MAX_X742_GROUP_SIZE];
+  std::vector<uint64_t> ttag64[MAX_X742_GROUP_SIZE];
+  std::vector<uint64_t> host; // host clock of the block transfer, one per event
+  std::vector<uint16_t> strt[MAX_X742_GROUP_SIZE];
+  std::vector<int> size[MAX_X742_GROUP_SIZE][MAX_X742_CHANNEL_SIZE];
+  std::vector<float> data[MAX_X742_GROUP_SIZE][MAX_X742_CHANNEL_SIZE];
+  void clear();
+};
+
+/** minimal blocking queue to pass points between threads **/
+template <typename T>
+class queue_t {
+public:
+  void push(T item) {
+    { std::lock_guard<std::mutex> lock(mutex); items.push_back(std::move(item)); }
+    cv.notify_one();
+  };
+  T pop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [this] { return !items.empty(); });
+    T item = std::move(items.front());
+    items.pop_front();
+    return item;
+  };
+private:
+  std::deque<T> items;
+  std::mutex mutex;
+  std::condition_variable cv;
+};
+
+struct scan_t {
+  double x_min = 0., x_max = 0., x_step = 1.;
+  double y_min = 0., y_max = 0., y_step = 1.;
+  std::string grid;
+  int settle_ms = 0;
+  int move_timeout = 60000;
+  std::vector<std::array<double, 2>> points;
+};
+
+// tree stuff
+struct output_t {
+  std::string output;
+  TFile *fout = nullptr;
+  TTree *tout[MAX_X742_GROUP_SIZE][MAX_X742_CHANNEL_SIZE] = {nullptr};
+  TTree *tscan = nullptr;
+  int size;
+  uint32_t ttag; // trigger time tag
+  uint64_t ttag64; // unwrapped trigger time tag, 8.5 ns ticks since the start
+  uint64_t host; // host clock of the block transfer (ns since epoch)
+  uint16_t strt; // start index cell
+  float data[1024];
+  int point;
+  double x, y; // measured position
+  double target_x, target_y;
+  int nevents;
+  double acq_time;
+  bool in_position;
+  bool complete;
+  /** one row per event for the time_index tree, entry counted over the whole scan **/
+  struct index_t { uint64_t ttag64, host; Long64_t entry; };
+  std::vector<index_t> index;
+};
+
+void process_program_options(int argc, char *argv[], options_t &opt, phy::options_t &phyopt, scan_t &scan, output_t &out);
+bool build_grid(scan_t &scan);
+
+bool acquire_point(digitizer_t &dgz, point_t &point);
+void writer(queue_t<point_t *> &full, queue_t<point_t *> &spare, output_t &out);
+
+bool init_output(output_t &out);
+bool fill_output(point_t &point, output_t &out);
+bool write_index(output_t &out);
+bool write_output(output_t &out);
+
+int main(int argc, char *argv[])
+{
+  std::cout << " --- welcome to rwavescan " << std::endl;
+  digitizer_t dgz;
+  phy::controller_t phy;
+  scan_t scan;
+  output_t out;
+  process_program_options(argc, argv, dgz.opt, phy.opt, scan, out);
+  /** the points are filled into the trees by the writer thread **/
+  ROOT::EnableThreadSafety();
+
+  if (!build_grid(scan))            /** build scan grid **/
+    return 1;
+  if (!init_output(out))            /** initialize output **/
+    return 1;
+  if (!phy::open(phy))              /** connect to the stage controller **/
+    return 1;
+  phy::start_polling(phy);
+
+  open(dgz);                        /** open digitizer **/
+  config(dgz);                      /** configure digitizer **/
+  if (!start(dgz)) {                /** start acquisition **/
+    close(dgz);
+    phy::close(phy);
+    return 1;
+  }
+
+  /** two point buffers: one being acquired, one being written **/
+  point_t points[2];
+  queue_t<point_t *> full, spare;
+  spare.push(&points[0]);
+  spare.push(&points[1]);
+  std::thread writer_thread(writer, std::ref(full), std::ref(spare), std::ref(out));
+
+  /** go to the first point **/
+  auto npoints = scan.points.size();
+  size_t ncompleted = 0;
+  auto t_start = std::chrono::steady_clock::now();
+  bool aborted = !phy::move(phy, { scan.points[0][0], scan.points[0][1] });
+  if (aborted) error("cannot move to first point, scan aborted");
+  bool in_position = aborted || phy::wait_in_position(phy, scan.move_timeout);
+  if (!in_position) error("timeout moving to first point");
+
+  for (size_t ipoint = 0; ipoint < npoints && !aborted; ++ipoint) {
+    if (scan.settle_ms > 0) msleep(scan.settle_ms);
+
+    auto point = spare.pop();
+    point->clear();
+    point->index = ipoint;
+    point->target[0] = scan.points[ipoint][0];
+    point->target[1] = scan.points[ipoint][1];
+    point->in_position = in_position;
+    {
+      std::lock_guard<std::mutex> lock(phy.status_mutex);
+      point->position[0] = phy.position[0];
+      point->position[1] = phy.position[1];
+    }
+
+    /** acquire with the stage at rest **/
+    auto t_acq = std::chrono::steady_clock::now();
+    point->complete = acquire_point(dgz, *point);
+    point->acq_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_acq).count();
+    if (point->failed) {
+      error("readout failed at point " << ipoint << ", scan aborted");
+      aborted = true;
+    }
+    else if (!point->complete) error("point " << ipoint << " incomplete: " << point->nevents << "/" << dgz.opt.nevents << " events");
+
+    /** start moving to the next point, then hand the data over to the writer **/
+    bool last = ipoint + 1 == npoints;
+    auto t_move = std::chrono::steady_clock::now();
+    if (!last && !aborted && !phy::move(phy, { scan.points[ipoint + 1][0], scan.points[ipoint + 1][1] })) {
+      error("cannot move to point " << ipoint + 1 << ", scan aborted");
+      aborted = true;
+    }
+    std::cout << " --- point " << ipoint << "/" << npoints
+	      << ": position " << point->position[0] << " " << point->position[1]
+	      << ", " << point->nevents << " events in " << point->acq_time << " s" << std::endl;
+    full.push(point);
+    if (!point->failed) ++ncompleted;
+    if (last || aborted) break;
+    in_position = phy::wait_in_position(phy, scan.move_timeout);
+    if (!in_position) error("timeout moving to point " << ipoint + 1);
+    std::cout << " --- moved in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - t_move).count() << " s" << std::endl;
+  }
+
+  /** flush the writer **/
+  full.push(nullptr);
+  writer_thread.join();
+
+  stop(dgz);                        /** stop acquisition **/
+  write_output(out);                /** write output data **/
+  close(dgz);                       /** close digitizer **/
+  phy::close(phy);
+
+  auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+  std::cout << " --- scan " << (aborted ? "aborted" : "done") << ": " << ncompleted << "/" << npoints << " points in " << elapsed << " s ("
+	    << (ncompleted > 0 ? elapsed / ncompleted : 0.) << " s/point) " << std::endl;
+
+  return aborted ? 1 : 0;
+}
+
+void
+process_program_options(int argc, char *argv[], options_t &opt, phy::options_t &phyopt, scan_t &scan, output_t &out)
+{
+  /** process arguments **/
+  namespace po = boost::program_options;
+  po::options_description desc("Options");
+  try {
+    desc.add_options()
+      ("help"             , "Print help messages")
+      ("output"           , po::value<std::string>(&out.output)->required(), "Output data filename")
+      ("nevents"          , po::value<int>(&opt.nevents)->required(), "Number of events to readout at each point")
+      ("frequency"        , po::value<int>(&opt.frequency)->required(), "DRS4 sampling frequency (MHz)")
+      ("max_blt"          , po::value<int>(&opt.max_blt)->default_value(1024), "Maximum number of events for BLT transfer")
+      ("record_length"    , po::value<int>(&opt.record_length)->default_value(1024), "Acquisition record length")
+      ("trigger_sw"       , po::value<int>(&opt.trigger_sw)->default_value(0), "Send software triggers")
+      ("trigger_sw_usleep" , po::value<int>(&opt.trigger_sw_usleep)->default_value(1000), "Delay between software triggers (microseconds)")
+      ("channel_mask"     , po::value<int>(&opt.channel_mask)->default_value(0x01FF01FF), "Output save channel mask")
+      ("readout_msleep"   , po::value<int>(&opt.readout_msleep)->default_value(1), "Readout sleep (ms)")
+      ("readout_timeout"  , po::value<int>(&opt.readout_timeout)->default_value(1000), "Readout timeout (ms)")
+      ("x_min"            , po::value<double>(&scan.x_min)->default_value(0.), "Scan grid x minimum (mm)")
+      ("x_max"            , po::value<double>(&scan.x_max)->default_value(0.), "Scan grid x maximum (mm)")
+      ("x_step"           , po::value<double>(&scan.x_step)->default_value(1.), "Scan grid x step (mm)")
+      ("y_min"            , po::value<double>(&scan.y_min)->default_value(0.), "Scan grid y minimum (mm)")
+      ("y_max"            , po::value<double>(&scan.y_max)->default_value(0.), "Scan grid y maximum (mm)")
+      ("y_step"           , po::value<double>(&scan.y_step)->default_value(1.), "Scan grid y step (mm)")
+      ("grid"             , po::value<std::string>(&scan.grid), "Scan grid file, one \"x y\" point per line (overrides min/max/step)")
+      ("settle_ms"        , po::value<int>(&scan.settle_ms)->default_value(0), "Extra settling time after the stage is in position (ms)")
+      ("move_timeout"     , po::value<int>(&scan.move_timeout)->default_value(60000), "Stage move timeout (ms)")
+      ("address"          , po::value<std::string>(&phyopt.address)->default_value("10.0.8.16"), "phyMOTION controller address")
+      ("port"             , po::value<int>(&phyopt.port)->default_value(22222), "phyMOTION controller port")
+      ("poll_ms"          , po::value<int>(&phyopt.poll_ms)->default_value(10), "Stage status polling period (ms)")
+      ;
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+      std::cout << desc << std::endl;
+      exit(1);
+    }
+  }
+  catch(std::exception& e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    std::cout << desc << std::endl;
+    exit(1);
+  }
+}
+
+bool
+build_grid(scan_t &scan)
+{
+  if (!scan.grid.empty()) {
+    std::ifstream fin(scan.grid);
+    if (!fin.is_open()) {
+      std::cout << " --- cannot open grid file: " << scan.grid << std::endl;
+      return false;
+    }
+    double x, y;
+    while (fin >> x >> y) scan.points.push_back({x, y});
+  }
+  else {
+    if (scan.x_step <= 0. || scan.y_step <= 0.) {
+      std::cout << " --- invalid grid step " << std::endl;
+      return false;
+    }
+    int nx = std::floor((scan.x_max - scan.x_min) / scan.x_step + 1.e-6) + 1;
+    int ny = std::floor((scan.y_max - scan.y_min) / scan.y_step + 1.e-6) + 1;
+    /** serpentine order, to keep moves short **/
+    for (int iy = 0; iy < ny; ++iy) {
+      for (int ix = 0; ix < nx; ++ix) {
+	int jx = iy % 2 ? nx - 1 - ix : ix;
+	scan.points.push_back({scan.x_min + jx * scan.x_step, scan.y_min + iy * scan.y_step});
+      }
+    }
+  }
+  if (scan.points.empty()) {
+    std::cout << " --- empty scan grid " << std::endl;
+    return false;
+  }
+  std::cout << " --- scan grid: " << scan.points.size() << " points " << std::endl;
+  return true;
+}
+
+void
+point_t::clear()
+{
+  nevents = 0;
+  failed = false;
+  host.clear();
+  for (int igr = 0; igr < MAX_X742_GROUP_SIZE; ++igr) {
+    ttag[igr].clear();
+    ttag64[igr].clear();
+    strt[igr].clear();
+    for (int ich = 0; ich < MAX_X742_CHANNEL_SIZE; ++ich) {
+      size[igr][ich].clear();
+      data[igr][ich].clear();
+    }
+  }
+}
+
+bool
+acquire_point(digitizer_t &dgz, point_t &point)
+{
+  auto opt = dgz.opt;
+  auto channel_mask = opt.channel_mask;
+  std::uint32_t buffer_size = 0, num_events = 0;
+
+  /** discard anything triggered while the stage was moving **/
+  if (CAEN_DGTZ_ClearData(dgz.handle))  error("CAEN_DGTZ_ClearData");
+
+  while (point.nevents < opt.nevents) {
+
+    /** send software triggers **/
+    for (int iswtrg = 0; iswtrg < opt.trigger_sw; ++iswtrg) {
+      if (CAEN_DGTZ_SendSWtrigger(dgz.handle))  error("CAEN_DGTZ_SendSWtrigger");
+      usleep(opt.trigger_sw_usleep);
+    }
+
+    /** poll for event ready **/
+    bool timeout = true;
+    for (int ipoll = 0; ipoll < opt.readout_timeout; ipoll += opt.readout_msleep) {
+      msleep(opt.readout_msleep);
+      if (!event_ready(dgz)) continue;
+      timeout = false;
+      break;
+    }
+    if (timeout) {
+      std::cout << " --- readout timeout " << std::endl;
+      return false;
+    }
+
+    /** a failed call leaves a stale buffer, the point is not worth continuing **/
+    if (CAEN_DGTZ_ReadData(dgz.handle, CAEN_DGTZ_SLAVE_TERMINATED_READOUT_MBLT, dgz.buffer, &buffer_size)) {
+      error("CAEN_DGTZ_ReadData");
+      point.failed = true;
+      return false;
+    }
+    if (CAEN_DGTZ_GetNumEvents(dgz.handle, dgz.buffer, buffer_size, &num_events)) {
+      error("CAEN_DGTZ_GetNumEvents");
+      point.failed = true;
+      return false;
+    }
+    auto host_ns = dgz::host_ns();
+    auto mono_ns = dgz::mono_ns();
+
+    /** decode events into the point buffer **/
+    CAEN_DGTZ_EventInfo_t event_info;
+    char *event_ptr = nullptr;
+    for (int iev = 0; iev < (int)num_events && point.nevents < opt.nevents; ++iev) {
+      if (CAEN_DGTZ_GetEventInfo(dgz.handle, dgz.buffer, buffer_size, iev, &event_info, &event_ptr) ||
+	  CAEN_DGTZ_DecodeEvent(dgz.handle, event_ptr, (void **)&dgz.event)) {
+	error("cannot decode event " << iev);
+	point.failed = true;
+	return false;
+      }
+      for (int igr = 0; igr < MAX_X742_GROUP_SIZE; ++igr) {
+	if (dgz.event->GrPresent[igr] == 0) continue;
+	auto &group = dgz.event->DataGroup[igr];
+	point.ttag[igr].push_back(group.TriggerTimeTag);
+	point.ttag64[igr].push_back(extend_ttag(dgz.ttag_clock[igr], group.TriggerTimeTag, mono_ns));
+	point.strt[igr].push_back(group.StartIndexCell);
+	auto mask = channel_mask >> (16 * igr);
+	for (int ich = 0; ich < MAX_X742_CHANNEL_SIZE; ++ich) {
+	  if (!(mask & 1 << ich)) continue;
+	  auto size = group.ChSize[ich];
+	  point.size[igr][ich].push_back(size);
+	  point.data[igr][ich].insert(point.data[igr][ich].end(), group.DataChannel[ich], group.DataChannel[ich] + size);
+	}
+      }
+      point.host.push_back(host_ns);
+      ++point.nevents;
+    }
+  }
+
+  return true;
+}
+
+void
+writer(queue_t<point_t *> &full, queue_t<point_t *> &spare, output_t &out)
+{
+  out.fout->cd();
+  while (auto point = full.pop()) {
+    fill_output(*point, out);
+    spare.push(point);
+  }
+}
+
+bool
+init_output(output_t &out)
+{
+  auto filename = out.output;
+  out.fout = TFile::Open(filename.c_str(), "RECREATE");
+  if (!out.fout || !out.fout->IsOpen()) {
+    std::cout << " --- cannot open output file: " << filename << std::endl;
+    return false;
+  }
+  out.tscan = new TTree("scan", "rwavescan");
+  out.tscan->Branch("point", &out.point, "point/I");
+  out.tscan->Branch("x", &out.x, "x/D");
+  out.tscan->Branch("y", &out.y, "y/D");
+  out.tscan->Branch("target_x", &out.target_x, "target_x/D");
+  out.tscan->Branch("target_y", &out.target_y, "target_y/D");
+  out.tscan->Branch("nevents", &out.nevents, "nevents/I");
+  out.tscan->Branch("acq_time", &out.acq_time, "acq_time/D");
+  out.tscan->Branch("in_position", &out.in_position, "in_position/O");
+  out.tscan->Branch("complete", &out.complete, "complete/O");
+  return true;
+}
+
+/** the time index tree: one entry per event sorted by ttag64, as written by rwavedump **/
+bool
+write_index(output_t &out)
+{
+  auto &index = out.index;
+  std::stable_sort(index.begin(), index.end(), [](const output_t::index_t &a, const output_t::index_t &b) { return a.ttag64 < b.ttag64; });
+  output_t::index_t row;
+  auto tindex = new TTree("time_index", "rwavescan");
+  tindex->Branch("ttag64", &row.ttag64, "ttag64/l");
+  tindex->Branch("host", &row.host, "host/l");
+  tindex->Branch("entry", &row.entry, "entry/L");
+  for (auto &r : index) {
+    row = r;
+    tindex->Fill();
+  }
+  std::cout << " --- writing time index: " << index.size() << " events" << std::endl;
+  tindex->Write();
+  return true;
+}
+
+bool
+write_output(output_t &out)
+{
+  auto filename = out.output;
+  if (!out.fout || !out.fout->IsOpen()) return false;
+  out.fout->cd();
+  std::cout << " --- writing output: " << filename << std::endl;
+  out.tscan->Write();
+  write_index(out);
+  for (int igr = 0; igr < MAX_X742_GROUP_SIZE; ++igr) {
+    for (int ich = 0; ich < MAX_X742_CHANNEL_SIZE; ++ich) {
+      auto tout = out.tout[igr][ich];
+      if (!tout) continue;
+      std::cout << " --- writing output tree: " << tout->GetName() << std::endl;
+      tout->Write();
+    }
+  }
+  out.fout->Close();
+  return true;
+}
+
+bool
+fill_output(point_t &point, output_t &out)
+{
+  out.point = point.index;
+  out.x = point.position[0];
+  out.y = point.position[1];
+  out.target_x = point.target[0];
+  out.target_y = point.target[1];
+  out.nevents = point.nevents;
+  out.acq_time = point.acq_time;
+  out.in_position = point.in_position;
+  out.complete = point.complete;
+  out.tscan->Fill();
+
+  /** the index gets the unwrapped tag of the first group present **/
+  Long64_t first_entry = out.index.size();
+  for (int igr = 0; igr < MAX_X742_GROUP_SIZE; ++igr) {
+    if (point.ttag64[igr].empty()) continue;
+    for (size_t iev = 0; iev < point.ttag64[igr].size(); ++iev)
+      out.index.push_back({ point.ttag64[igr][iev], point.host[iev], first_entry + (Long64_t)iev });
+    break;
+  }
+
+  /** loop over groups **/
+  for (int igr = 0; igr < MAX_X742_GROUP_SIZE; ++igr) {
+    /** loop over channels **/
+    for (int ich = 0; ich < MAX_X742_CHANNEL_SIZE; ++ich) {
+      auto &sizes = point.size[igr][ich];
+      if (sizes.empty()) continue;
+      /** create tree the first time **/
+      if (!out.tout[igr][ich]) {
+	std::string tname = "gr" + std::to_string(igr) + "_ch" + std::to_string(ich);
+	out.tout[igr][ich] = new TTree(tname.c_str(), "rwavescan");
+	out.tout[igr][ich]->Branch("size", &out.size, "size/I");
+	out.tout[igr][ich]->Branch("ttag", &out.ttag, "ttag/i");
+	out.tout[igr][ich]->Branch("ttag64", &out.ttag64, "ttag64/l");
+	out.tout[igr][ich]->Branch("host", &out.host, "host/l");
+	out.tout[igr][ich]->Branch("strt", &out.strt, "strt/s");
+	out.tout[igr][ich]->Branch("data", &out.data, "data[size]/F");
+	out.tout[igr][ich]->Branch("point", &out.point, "point/I");
+	out.tout[igr][ich]->Branch("x", &out.x, "x/D");
+	out.tout[igr][ich]->Branch("y", &out.y, "y/D");
+      }
+      /** store size and data, event by event **/
+      const float *data = point.data[igr][ich].data();
+      for (size_t iev = 0; iev < sizes.size(); ++iev) {
+	out.size = sizes[iev];
+	out.ttag = point.ttag[igr][iev];
+	out.ttag64 = point.ttag64[igr][iev];
+	out.host = point.host[iev];
+	out.strt = point.strt[igr][iev];
+	for (int i = 0; i < out.size; ++i)
+	  out.data[i] = data[i];
+	data += out.size;
+	out.tout[igr][ich]->Fill();
+      }
+    }
+  }
+  return true;
+}
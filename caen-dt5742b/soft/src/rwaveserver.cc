@@ -1,15 +1,35 @@
 #include <iostream>
 #include <cstring>
+#include <cerrno>
 #include <csignal>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <unistd.h>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <chrono>
+#include <ctime>
+#include <cmath>
+#include <memory>
 
 #define PORT 30001
 #define BUFFER_SIZE 1024
 
 #include "rwavelib.hh"
 #include "rwavedata.hh"
+#include "rwavenet.hh"
+#include "rwaveshm.hh"
+#include "rwavefilter.hh"
+#include "rwaveresample.hh"
+#include "rwavepool.hh"
+#include "rwaverec.hh"
+#include "rwavepreview.hh"
+#include "rwavert.hh"
+#include "rwavestats.hh"
 #include <vector>
 #include <sstream>
 #include <algorithm>
@@ -17,22 +37,94 @@
 #include <iomanip>
 
 void message(int fd, std::string msg) {
-  log(msg);
+  /** replies are only logged at debug level, errors returned to the client as warnings **/
+  if (msg.find("[ERROR]") == 0) warning("reply to client: " << msg);
+  else debug(msg);
   msg = msg + " \n";
-  send(fd, msg.c_str(), msg.size(), 0);
+  net::send_all(fd, msg.c_str(), msg.size());
 }
 
 int server_fd;
 dgz::digitizer_t DGZ;
+net::options_t NET;
+shm::writer_t SHM;
+filter::options_t FILTER;
+filter::counters_t FILTER_COUNTERS;
+/** the recording thread merges its counters while the command handlers read them **/
+std::mutex FILTER_COUNTERS_MUTEX;
+/** resampling onto a uniform time grid **/
+resample::options_t RESAMPLE;
+resample::resampler_t RESAMPLER;
+/** workers decoding and resampling the events of a block in parallel, none = in the readout thread **/
+std::unique_ptr<pool::pool_t> POOL;
+/** decode scratch event of every worker **/
+std::vector<CAEN_DGTZ_X742_EVENT_t *> POOL_EVENTS;
+/** the CAEN library does not document GetEventInfo/DecodeEvent as reentrant
+    on one handle: the workers take turns for these calls **/
+std::mutex POOL_DECODE_MUTEX;
+
+/** server-side recording, runs in its own thread and owns the readout **/
+struct recording_t {
+  std::thread thread;
+  std::atomic<bool> running{false};
+  std::string path;
+  bool raw = false;
+  uint64_t max_events = 0;
+  double max_seconds = 0.;
+  std::chrono::steady_clock::time_point start;
+  std::atomic<uint64_t> events{0}, blocks{0}, bytes{0}, stalls{0};
+  std::string backend;
+  std::string outcome;
+  std::mutex mutex; // backend, outcome
+} RECORD;
+rec::options_t REC;
+/** logging, written by a background thread **/
+logger::options_t LOG;
+/** real-time mode of the acquisition threads **/
+rt::options_t RT;
+rt::thread_state_t RT_MAIN;
+/** set by commands that hand the client socket over to another thread **/
+bool client_detached = false;
+
+void record_loop();
+void record_stop();
+void restart_logger();
+
+/** set by the signal handler, main shuts the server down when it sees it **/
+volatile sig_atomic_t SHUTDOWN = 0;
 
 void handle_signal(int signal) {
-  log("CTRL+C interrupt");
+  /** only async-signal-safe work here, a second CTRL+C exits at once **/
+  if (SHUTDOWN) _exit(1);
+  SHUTDOWN = 1;
+}
+
+void
+shutdown_server()
+{
+  /** finish recording **/
+  record_stop();
+  /** stop preview streams and the statistics file **/
+  preview::stop_all();
+  stats::stop_file();
   /** close digitizer **/
   dgz::close(DGZ);
-  /** close server socket **/
+  /** remove shared memory ring **/
+  shm::destroy(SHM);
   log("server is shutting down, have a good day");
-  close(server_fd);
-  exit(0);
+}
+
+/** wait until fd is readable, false once a shutdown was requested. polled,
+    since the signal may be taken by any thread and not interrupt accept/recv **/
+bool
+wait_readable(int fd)
+{
+  struct pollfd pfd = { fd, POLLIN, 0 };
+  while (!SHUTDOWN) {
+    int n = poll(&pfd, 1, 200);
+    if (n > 0 || (n < 0 && errno != EINTR)) return true;
+  }
+  return false;
 }
 
 void process_command(int client_fd, const std::string &str);
@@ -40,6 +132,15 @@ bool is_valid_hex(const std::string& str);
 bool is_valid_int(const std::string& str);
 
 bool fill_buffer(dgz::digitizer_t &dgz, int event);
+void finalize_buffer(int n_events);
+void resample_buffer(int n_events);
+bool start_workers(int n_workers);
+const char *decode_events(const char *buffer, std::uint32_t buffer_size, std::uint32_t num_events, uint64_t host_ns, uint64_t mono_ns, filter::counters_t &counters, int &n_accepted);
+void fill_header_v2(data::header_v2_t &header);
+void publish_preview(int n_events);
+void merge_filter_counters(const filter::counters_t &counters);
+void publish_shm();
+void acquire(int client_fd, uint32_t n_events, bool swtrg);
 
 int main() {
   struct sockaddr_in address;
@@ -49,6 +150,9 @@ int main() {
   
   /** handle SIGINT (Ctrl+C) **/
   signal(SIGINT, handle_signal);
+
+  /** start the log writer, the readout never waits for the terminal **/
+  logger::start(LOG);
   
   /** create socket **/
   server_fd = socket(AF_INET, SOCK_STREAM, 0);
@@ -92,7 +196,7 @@ int main() {
   /** configure digitizer **/
   dgz::config(DGZ);
   
-  while (true) {
+  while (wait_readable(server_fd)) {
     int client_fd = accept(server_fd, (struct sockaddr*)&address, &addr_len);
     if (client_fd < 0) {
       error("accept failed");
@@ -100,9 +204,10 @@ int main() {
     }
     
     log("client connected");
+    net::tune_socket(client_fd, NET);
     
     /** receive data **/
-    while (true) {
+    while (wait_readable(client_fd)) {
       ssize_t bytes_received = recv(client_fd, buffer, BUFFER_SIZE - 1, 0);
       if (bytes_received <= 0) {
 	log("client disconnected");
@@ -118,19 +223,28 @@ int main() {
       log(mystring);
       
       process_command(client_fd, received_str);
+      if (client_detached) break;
       
     }
     
+    /** the socket now belongs to a streamer **/
+    if (client_detached) {
+      client_detached = false;
+      continue;
+    }
+
     /** close clien socket **/
     close(client_fd);
   }
   
-  /** close digitizer **/
-  dgz::close(DGZ);
-  
+  log("CTRL+C interrupt");
+  shutdown_server();
+
   /** close server socket **/
   close(server_fd);
-  
+
+  /** flush the log writer here, not from atexit **/
+  logger::stop();
   return 0;
 }
 
@@ -153,11 +267,12 @@ process_command(int client_fd, const std::string &str)
   
   /** quit **/
   if (str.find("quit") == 0) {
-    dgz::close(DGZ);
+    shutdown_server();
     mystring = "server is shutting down, have a good day";
     message(client_fd, mystring);
     close(client_fd);
     close(server_fd);
+    logger::stop();
     exit(0);
   }
   
@@ -177,6 +292,11 @@ process_command(int client_fd, const std::string &str)
 
   /** start **/
   if (str.find("start") == 0) {
+    if (RECORD.running) {
+      mystring = "cannot start, recording is running";
+      message(client_fd, mystring);
+      return;
+    }
     if (!dgz::board_ready(DGZ)) {
       mystring = "the board is not ready to start acquisition";
       message(client_fd, mystring);
@@ -199,6 +319,11 @@ process_command(int client_fd, const std::string &str)
 
   /** stop **/
   if (str.find("stop") == 0) {
+    if (RECORD.running) {
+      mystring = "cannot stop, recording is running";
+      message(client_fd, mystring);
+      return;
+    }
     if (!dgz::acquisition_status(DGZ)) {
       mystring = "acquisition is not running";
       message(client_fd, mystring);
@@ -219,6 +344,11 @@ process_command(int client_fd, const std::string &str)
    **/
   
   if (str.find("swtrg") == 0) {
+    if (RECORD.running) {
+      mystring = "cannot send soft triggers, recording is running";
+      message(client_fd, mystring);
+      return;
+    }
     if (!dgz::acquisition_status(DGZ)) {
       mystring = "cannot send soft triggers, acquisition is not running";
       message(client_fd, mystring);
@@ -241,7 +371,7 @@ process_command(int client_fd, const std::string &str)
     }
     int ntriggers = std::stoi(astr);
 
-    log("send software triggers");
+    debug("send software triggers");
     for (int itrg = 0; itrg < ntriggers; ++itrg) {
       if (CAEN_DGTZ_SendSWtrigger(DGZ.handle)) {
 	mystring = "[ERROR] CAEN_DGTZ_SendSWtrigger";
@@ -253,6 +383,7 @@ process_command(int client_fd, const std::string &str)
       //      usleep(100);
       msleep(1);
     }
+    stats::add(stats::counter_triggers, ntriggers);
 
     mystring = "software triggers sent: " + astr;
     message(client_fd, mystring);
@@ -264,6 +395,11 @@ process_command(int client_fd, const std::string &str)
    **/
   
   if (str.find("readout") == 0) {
+    if (RECORD.running) {
+      mystring = "cannot readout, recording is running";
+      message(client_fd, mystring);
+      return;
+    }
     if (!dgz::acquisition_status(DGZ)) {
       mystring = "cannot readout data, acquisition is not running";
       message(client_fd, mystring);
@@ -276,305 +412,1204 @@ process_command(int client_fd, const std::string &str)
     data::header.frequency = DGZ.opt.frequency;
     data::header.n_channels = 0;
     
-    log("poll for event ready");
-    for (int ipoll = 0; ipoll < DGZ.opt.readout_timeout; ++ipoll) {
-      msleep(1);
-      if (!dgz::event_ready(DGZ)) continue;
-      break;
-    }
-    if (!dgz::event_ready(DGZ)) {
+    debug("wait for event ready");
+    if (!dgz::wait_event(DGZ, DGZ.opt.readout_timeout)) {
       mystring = "readout timeout";
       message(client_fd, mystring);
       return;
     }
   
-    log("data available to be read");
+    auto t_ready = std::chrono::steady_clock::now();
+    debug("data available to be read");
     std::uint32_t buffer_size = 0;
     if (CAEN_DGTZ_ReadData(DGZ.handle, CAEN_DGTZ_SLAVE_TERMINATED_READOUT_MBLT, DGZ.buffer, &buffer_size)) {
       mystring = "[ERROR] CAEN_DGTZ_ReadData";
       message(client_fd, mystring);
       return;
     }
+    auto host_ns = dgz::host_ns();
+    auto mono_ns = dgz::mono_ns();
+    stats::record(stats::stage_readout, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t_ready).count());
     std::uint32_t num_events = 0;
     if (CAEN_DGTZ_GetNumEvents(DGZ.handle, DGZ.buffer, buffer_size, &num_events)) {
       mystring = "[ERROR] CAEN_DGTZ_GetNumEvents";
       message(client_fd, mystring);
       return;
     }
-    mystring = "readout " + std::to_string(num_events) + " events";
-    log(mystring);
+    debug("readout " << num_events << " events");
+    stats::add(stats::counter_blocks);
+    stats::add(stats::counter_events, num_events);
+    stats::add(stats::counter_bytes_read, buffer_size);
 
-    log("decode events");
-    CAEN_DGTZ_EventInfo_t event_info;
-    char *event_ptr = nullptr;
-    data::buffer_size = 0;
-    std::fill(std::begin(data::has_channel), std::end(data::has_channel), false);
-    for (int iev = 0; iev < num_events; ++iev) {
-      if (CAEN_DGTZ_GetEventInfo(DGZ.handle, DGZ.buffer, buffer_size, iev, &event_info, &event_ptr)) {
-	mystring = "[ERROR] CAEN_DGTZ_GetEventInfo";
-	message(client_fd, mystring);
-	return;
-      }
-      if (CAEN_DGTZ_DecodeEvent(DGZ.handle, event_ptr, (void **)&DGZ.event)) {
-	mystring = "[ERROR] CAEN_DGTZ_DecodeEvent";
-	message(client_fd, mystring);
-	return;
-      }
-      //      data::triggertags[iev] = event_info.TriggerTimeTag;
-      fill_buffer(DGZ, iev);
+    debug("decode events");
+    filter::counters_t counters;
+    int n_accepted = 0;
+    if (auto what = decode_events(DGZ.buffer, buffer_size, num_events, host_ns, mono_ns, counters, n_accepted)) {
+      mystring = "[ERROR] " + std::string(what);
+      message(client_fd, mystring);
+      return;
     }
-    mystring = "readout completed: " + std::to_string(num_events) + " events";
+    merge_filter_counters(counters);
+    mystring = "readout completed: " + std::to_string(n_accepted) + " events";
+    if (FILTER.mode != filter::mode_off)
+      mystring += " (accepted " + std::to_string(counters.accepted) +
+	", rejected " + std::to_string(counters.rejected) +
+	", prescaled " + std::to_string(counters.prescaled) + ")";
     message(client_fd, mystring);
 
-    /** prepare data **/
-    data::header.n_events = num_events;
-    for (int ich = 0; ich < data::max_channels; ++ich)
-      if (data::has_channel[ich]) data::channels[data::header.n_channels++] = ich;
+    /** publish to same-host readers **/
+    publish_shm();
 
     return;
     
   }
-  
+
   /**
-   ** download
+   ** acquire [nevents] [swtrg] -- start, trigger, read out and stream v2 blocks, then stop
    **/
-  
-  if (str.find("download") == 0) {
-    int header_size = sizeof(data::header);
-    int channels_size = data::header.n_channels * sizeof(uint8_t);
-    int trigger_tags_size = data::header.n_events * sizeof(uint32_t) * 2;
-    int start_cells_size = data::header.n_events * sizeof(uint16_t) * 2;
-    int data_size = data::buffer_size * sizeof(float);
-    mystring = "sending header,channels,triggertags,startcells,data: " +
-      std::to_string(header_size) + ","  +
-      std::to_string(channels_size) + "," +
-      std::to_string(trigger_tags_size) + "," +
-      std::to_string(start_cells_size) + "," +
-      std::to_string(data_size) + " bytes";
-    message(client_fd, mystring);
-
-    send(client_fd, &data::header, header_size, 0);
-    send(client_fd, &data::channels, channels_size, 0);    
-    send(client_fd, &data::trigger_tags, trigger_tags_size, 0);
-    send(client_fd, &data::start_cells, start_cells_size, 0);
-    send(client_fd, data::buffer, data_size, 0);
-
-    return;
-  }
 
-  /** sampling [MHz] **/
-  if (str.find("sampling") == 0) {
+  if (str.find("acquire") == 0) {
+    if (RECORD.running) {
+      mystring = "cannot acquire, recording is running";
+      message(client_fd, mystring);
+      return;
+    }
     if (dgz::acquisition_status(DGZ)) {
-      mystring = "cannot change configuration, acquisition is running";
+      mystring = "cannot acquire, acquisition is already running";
       message(client_fd, mystring);
       return;
     }
-    // Step 2: Split the string into words
     std::stringstream ss(str);
     std::string word;
     std::vector<std::string> words;
     while (ss >> word) words.push_back(word);
-    if (words.size() != 2) {
-      mystring = "[ERROR] \'sampling\' command requires one argument: \'frequency (MHz)\'";
+    if (words.size() < 2 || words.size() > 3 || (words.size() == 3 && words[2] != "swtrg")) {
+      mystring = "[ERROR] \'acquire\' command requires arguments: \'nevents\' [swtrg]";
       message(client_fd, mystring);
       return;
     }
-    const std::string& astr = words[1];
-    if (!is_valid_int(astr)) {
-      mystring = "[ERROR] invalid \'sampling\' argument, not a valid integer: " + astr;
+    if (!is_valid_int(words[1]) || std::stoi(words[1]) < 1) {
+      mystring = "[ERROR] invalid \'acquire\' argument, not a valid number of events [>= 1]: " + words[1];
       message(client_fd, mystring);
       return;
     }
-    int frequency = std::stoi(astr);
-    if (frequency != 5000 && frequency != 2500 && frequency != 1000 && frequency != 750) {
-      mystring = " [ERROR] invalid \'sampling\' argument, not a valid value [5000, 2500, 1000, 750]: " + astr;
+    bool swtrg = words.size() == 3;
+    mystring = "acquire started: " + words[1] + " events" + (swtrg ? ", software triggers" : "");
+    message(client_fd, mystring);
+    acquire(client_fd, std::stoi(words[1]), swtrg);
+    return;
+  }
+  
+  /**
+   ** download
+   **/
+  
+  if (str.find("download") == 0) {
+    if (RECORD.running) {
+      mystring = "cannot download, recording is running";
       message(client_fd, mystring);
       return;
     }
-    if (CAEN_DGTZ_SetDRS4SamplingFrequency(DGZ.handle, dgz::frequencies[frequency])) {
-      mystring = "[ERROR] CAEN_DGTZ_SetDRS4SamplingFrequency";
+    std::stringstream ss(str);
+    std::string word;
+    std::vector<std::string> words;
+    while (ss >> word) words.push_back(word);
+
+    /** v2: self-describing header followed by the sections **/
+    if (words.size() > 1 && words[1] == "v2") {
+      data::header_v2_t header;
+      fill_header_v2(header);
+      mystring = "sending v2 header,channels,triggertags,startcells,data: " +
+	std::to_string(sizeof(header)) + "," +
+	std::to_string(header.channels_size) + "," +
+	std::to_string(header.trigger_tags_size) + "," +
+	std::to_string(header.start_cells_size) + "," +
+	std::to_string(header.data_size) + " bytes";
       message(client_fd, mystring);
+      struct iovec iov[5] = {
+	{ &header, sizeof(header) },
+	{ data::channels, header.channels_size },
+	{ data::trigger_tags64, header.trigger_tags_size },
+	{ data::start_cells, header.start_cells_size },
+	{ data::buffer, header.data_size }
+      };
+      stats::scope_t timer(stats::stage_send);
+      if (!net::send_iov(client_fd, iov, 5, NET))
+	error("download failed");
+      else stats::add(stats::counter_bytes_sent, sizeof(header) + header.channels_size + header.trigger_tags_size + header.start_cells_size + header.data_size);
       return;
     }
-    if (CAEN_DGTZ_LoadDRS4CorrectionData(DGZ.handle, dgz::frequencies[frequency])) {
-      mystring = "[ERROR] CAEN_DGTZ_LoadDRS4CorrectionData";
+
+    /** the v1 header cannot describe the channel-major layout nor a resampling grid **/
+    if (data::buffer_layout != data::layout_event) {
+      mystring = "[ERROR] \'download\' requires the event layout, use \'download v2\'";
       message(client_fd, mystring);
       return;
     }
-
-    DGZ.opt.frequency = frequency;
-    mystring = "sampling frequency configured: " + astr;
+    if (data::sample_step_ps != 0) {
+      mystring = "[ERROR] \'download\' cannot send resampled data, use \'download v2\'";
+      message(client_fd, mystring);
+      return;
+    }
+    bool sized = words.size() > 1 && words[1] == "sized";
+    data::sizes_t sizes;
+    sizes.header = sizeof(data::header);
+    sizes.channels = data::header.n_channels * sizeof(uint8_t);
+    sizes.trigger_tags = data::header.n_events * sizeof(uint32_t) * 2;
+    sizes.start_cells = data::header.n_events * sizeof(uint16_t) * 2;
+    sizes.data = (uint64_t)data::buffer_size * sizeof(float);
+    mystring = "sending header,channels,triggertags,startcells,data: " +
+      std::to_string(sizes.header) + ","  +
+      std::to_string(sizes.channels) + "," +
+      std::to_string(sizes.trigger_tags) + "," +
+      std::to_string(sizes.start_cells) + "," +
+      std::to_string(sizes.data) + " bytes";
     message(client_fd, mystring);
-    return;      
+
+    /** one scatter-gather send straight out of the data buffers **/
+    struct iovec iov[6];
+    int iovcnt = 0;
+    if (sized) iov[iovcnt++] = { &sizes, sizeof(sizes) };
+    iov[iovcnt++] = { &data::header, sizes.header };
+    iov[iovcnt++] = { data::channels, sizes.channels };
+    iov[iovcnt++] = { data::trigger_tags, sizes.trigger_tags };
+    iov[iovcnt++] = { data::start_cells, sizes.start_cells };
+    iov[iovcnt++] = { data::buffer, sizes.data };
+    stats::scope_t timer(stats::stage_send);
+    if (!net::send_iov(client_fd, iov, iovcnt, NET))
+      error("download failed");
+    else stats::add(stats::counter_bytes_sent, (sized ? sizeof(sizes) : 0) + sizes.header + sizes.channels + sizes.trigger_tags + sizes.start_cells + sizes.data);
+
+    return;
   }
-  
-  /** maxblt [events] **/
-  if (str.find("maxblt") == 0) {
-    if (dgz::acquisition_status(DGZ)) {
-      mystring = "cannot change configuration, acquisition is running";
+
+  /**
+   ** layout [event|channel] -- data layout of the next readouts
+   **/
+
+  if (str.find("layout") == 0) {
+    if (RECORD.running) {
+      mystring = "cannot change layout, recording is running";
       message(client_fd, mystring);
       return;
     }
-    // Step 2: Split the string into words
     std::stringstream ss(str);
     std::string word;
     std::vector<std::string> words;
     while (ss >> word) words.push_back(word);
-    if (words.size() != 2) {
-      mystring = "[ERROR] \'maxblt\' command requires one argument: \'events\'";
+    if (words.size() != 2 || (words[1] != "event" && words[1] != "channel")) {
+      mystring = "[ERROR] \'layout\' command requires one argument: \'layout\' [event, channel]";
       message(client_fd, mystring);
       return;
     }
-    const std::string& astr = words[1];
-    if (!is_valid_int(astr)) {
-      mystring = "[ERROR] invalid \'maxblt\' argument, not a valid integer: " + astr;
+    data::layout = words[1] == "event" ? data::layout_event : data::layout_channel;
+    mystring = "data layout configured: " + words[1] + "-major";
+    message(client_fd, mystring);
+    return;
+  }
+
+  /**
+   ** record -- write readout blocks to local disk from a dedicated thread
+   **   record [path] [max_events] [max_seconds]
+   **   record stop
+   **   record status
+   **   record format [raw|v2]
+   **   record fsync [never|close|MB]
+   **   record prealloc [MB]
+   **   record direct [on|off]
+   **   record uring [on|off]
+   **/
+
+  if (str.find("record") == 0) {
+    std::stringstream ss(str);
+    std::string word;
+    std::vector<std::string> words;
+    while (ss >> word) words.push_back(word);
+    if (words.size() < 2) {
+      mystring = "[ERROR] \'record\' command requires arguments: [path, stop, status, format, fsync, prealloc, direct, uring]";
       message(client_fd, mystring);
       return;
     }
-    int events = std::stoi(astr);
-    if (events < 1 || events > 1024) {
-      mystring = " [ERROR] invalid \'maxblt\' argument, not a valid value [1-1024]: " + astr;
+    const std::string &what = words[1];
+    if (what == "stop") {
+      if (!RECORD.running) {
+	mystring = "recording is not running";
+	message(client_fd, mystring);
+	return;
+      }
+      record_stop();
+      std::lock_guard<std::mutex> lock(RECORD.mutex);
+      mystring = "recording stopped: " + std::to_string(RECORD.events) + " events, " + std::to_string(RECORD.bytes) + " bytes, " + RECORD.outcome;
       message(client_fd, mystring);
       return;
     }
-    if (CAEN_DGTZ_SetMaxNumEventsBLT(DGZ.handle, events)) {
-      mystring = "[ERROR] CAEN_DGTZ_SetMaxNumEventsBLT";
+    if (what == "status") {
+      std::lock_guard<std::mutex> lock(RECORD.mutex);
+      auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - RECORD.start).count();
+      std::ostringstream os;
+      if (RECORD.running)
+	os << "recording to " << RECORD.path << " (" << RECORD.backend << "): "
+	   << RECORD.events << " events, " << RECORD.blocks << " blocks, "
+	   << RECORD.bytes / 1048576 << " MB, " << std::fixed << std::setprecision(1)
+	   << (elapsed > 0. ? RECORD.bytes / elapsed / 1.e6 : 0.) << " MB/s, "
+	   << RECORD.stalls << " writer stalls";
+      else
+	os << "recording is not running" << (RECORD.outcome.empty() ? "" : ", last: " + RECORD.path + " " + RECORD.outcome +
+					     ", " + std::to_string(RECORD.events) + " events, " + std::to_string(RECORD.bytes) + " bytes");
+      os << " [format " << (RECORD.raw ? "raw" : "v2") << ", fsync "
+	 << (REC.fsync == rec::fsync_never ? "never" : REC.fsync == rec::fsync_close ? "close" : std::to_string(REC.fsync_bytes >> 20) + " MB")
+	 << ", prealloc " << (REC.prealloc >> 20) << " MB, direct " << (REC.direct ? "on" : "off")
+	 << ", uring " << (REC.uring ? "on" : "off") << "]";
+      mystring = os.str();
       message(client_fd, mystring);
       return;
     }
-
-    DGZ.opt.max_blt = events;
-    mystring = "maximum number events BLT configured: " + astr;
-    message(client_fd, mystring);
-    return;      
-  }
-  
-  /**
-   ** grmask [mask] -- configure group mask
-   **/
-  
-  if (str.find("grmask") == 0) {
-    if (dgz::acquisition_status(DGZ)) {
-      mystring = "cannot change configuration, acquisition is running";
+    if (what == "format" || what == "fsync" || what == "prealloc" || what == "direct" || what == "uring") {
+      if (RECORD.running) {
+	mystring = "cannot change recording options, recording is running";
+	message(client_fd, mystring);
+	return;
+      }
+      const std::string astr = words.size() == 3 ? words[2] : "";
+      if (what == "format" && (astr == "raw" || astr == "v2")) RECORD.raw = astr == "raw";
+      else if ((what == "direct" || what == "uring") && (astr == "on" || astr == "off")) (what == "direct" ? REC.direct : REC.uring) = astr == "on";
+      else if (what == "fsync" && (astr == "never" || astr == "close")) REC.fsync = astr == "never" ? rec::fsync_never : rec::fsync_close;
+      else if ((what == "fsync" || what == "prealloc") && is_valid_int(astr) && std::stoi(astr) > 0) {
+	uint64_t bytes = (uint64_t)std::stoi(astr) << 20;
+	if (what == "prealloc") REC.prealloc = bytes;
+	else {
+	  REC.fsync = rec::fsync_interval;
+	  REC.fsync_bytes = bytes;
+	}
+      }
+      else {
+	mystring = "[ERROR] invalid \'record " + what + "\' argument: " + astr;
+	message(client_fd, mystring);
+	return;
+      }
+      mystring = "recording " + what + " configured: " + astr;
       message(client_fd, mystring);
       return;
     }
-    // Step 2: Split the string into words
-    std::stringstream ss(str);
-    std::string word;
-    std::vector<std::string> words;
-    while (ss >> word) words.push_back(word);
-    if (words.size() != 2) {
-      mystring = "[ERROR] \'grmask\' command requires one argument: \'mask\'";
+
+    /** record [path] [max_events] [max_seconds] **/
+    if (RECORD.running) {
+      mystring = "recording is already running";
       message(client_fd, mystring);
       return;
     }
-    const std::string& astr = words[1];
-    int mask = 0x0;
-    if (is_valid_int(astr)) mask = std::stoi(astr);
-    else if (is_valid_hex(astr)) {
-      std::string hstr = astr;
-      if (hstr.substr(0, 2) == "0x" || hstr.substr(0, 2) == "0X") hstr = hstr.substr(2);
-      mask = std::stoi(hstr, nullptr, 16);
-    }
-    else {
-      mystring = "[ERROR] invalid \'grmask\' argument, not a valid integer/hex: " + astr;
+    if (!dgz::acquisition_status(DGZ)) {
+      mystring = "cannot record data, acquisition is not running";
       message(client_fd, mystring);
       return;
     }
-    if (mask < 0x0 || mask > 0x3) {
-      mystring = "[ERROR] invalid \'grmask\' argument, not a valid value [0-3]: " + astr;
+    if (words.size() > 4 ||
+	(words.size() > 2 && (!is_valid_int(words[2]) || std::stoll(words[2]) < 0)) ||
+	(words.size() > 3 && (!is_valid_int(words[3]) || std::stoll(words[3]) < 0))) {
+      mystring = "[ERROR] invalid \'record\' arguments, expected: \'path\' [max_events] [max_seconds]";
       message(client_fd, mystring);
       return;
     }
-    if (CAEN_DGTZ_SetGroupEnableMask(DGZ.handle, mask)) {
-      mystring = "[ERROR] CAEN_DGTZ_SetGroupEnableMask";
+    record_stop(); // join a previous recording that ended by itself
+    RECORD.path = what;
+    RECORD.max_events = words.size() > 2 ? std::stoll(words[2]) : 0;
+    RECORD.max_seconds = words.size() > 3 ? std::stoll(words[3]) : 0;
+    RECORD.events = RECORD.blocks = RECORD.bytes = RECORD.stalls = 0;
+    RECORD.outcome.clear();
+    RECORD.start = std::chrono::steady_clock::now();
+    RECORD.running = true;
+    RECORD.thread = std::thread(record_loop);
+    mystring = "recording started: " + RECORD.path;
+    message(client_fd, mystring);
+    return;
+  }
+
+  /**
+   ** zerocopy [status] -- enable/disable MSG_ZEROCOPY for downloads
+   **/
+
+  if (str.find("zerocopy") == 0) {
+    std::stringstream ss(str);
+    std::string word;
+    std::vector<std::string> words;
+    while (ss >> word) words.push_back(word);
+    if (words.size() != 2 || (words[1] != "on" && words[1] != "off")) {
+      mystring = "[ERROR] \'zerocopy\' command requires one argument: \'status\' [on, off]";
       message(client_fd, mystring);
       return;
     }
-    mystring = "group enable mask configured: " + astr;
+    NET.zerocopy = words[1] == "on";
+    net::tune_socket(client_fd, NET);
+    mystring = std::string("zero-copy download ") + (NET.zerocopy ? "enabled" : "disabled");
     message(client_fd, mystring);
-    return;      
+    return;
   }
-  
+
   /**
-   ** chmask [mask] -- configure channel mask
+   ** shm [on [slots] | off] -- publish readout blocks to a shared-memory ring
    **/
-  
-  if (str.find("chmask") == 0) {
-    if (dgz::acquisition_status(DGZ)) {
-      mystring = "cannot change configuration, acquisition is running";
+
+  if (str.find("shm") == 0) {
+    if (RECORD.running) {
+      mystring = "cannot change shared memory, recording is running";
       message(client_fd, mystring);
       return;
     }
-    // Step 2: Split the string into words
     std::stringstream ss(str);
     std::string word;
     std::vector<std::string> words;
     while (ss >> word) words.push_back(word);
-    if (words.size() != 2) {
-      mystring = "[ERROR] \'chmask\' command requires one argument: \'mask\'";
+    if (words.size() < 2 || (words[1] != "on" && words[1] != "off")) {
+      mystring = "[ERROR] \'shm\' command requires one argument: \'status\' [on, off]";
       message(client_fd, mystring);
       return;
     }
-    const std::string& astr = words[1];
-    int mask = 0x0;
-    if (is_valid_int(astr)) mask = std::stoi(astr);
-    else if (is_valid_hex(astr)) {
-      std::string hstr = astr;
-      if (hstr.substr(0, 2) == "0x" || hstr.substr(0, 2) == "0X") hstr = hstr.substr(2);
-      mask = std::stoi(hstr, nullptr, 16);
-    }
-    else {
-      mystring = "[ERROR] invalid \'chmask\' argument, not a valid integer/hex: " + astr;
+    shm::destroy(SHM);
+    if (words[1] == "off") {
+      mystring = "shared memory publishing disabled";
       message(client_fd, mystring);
       return;
     }
-    if (mask < 0 || mask > 0xffff) {
-      mystring = "[ERROR] invalid \'chmask\' argument, not a valid value [0-65535]: " + astr;
+    int slots = 4;
+    if (words.size() > 2) {
+      if (!is_valid_int(words[2]) || words[2].size() > 3 || std::stoi(words[2]) < 2 || std::stoi(words[2]) > shm::max_slots) {
+	mystring = "[ERROR] invalid \'shm\' argument, not a valid number of slots [2-" + std::to_string(shm::max_slots) + "]: " + words[2];
+	message(client_fd, mystring);
+	return;
+      }
+      slots = std::stoi(words[2]);
+    }
+    std::size_t payload_size = sizeof(data::header_v2_t) + sizeof(data::channels) + sizeof(data::trigger_tags64) + sizeof(data::start_cells) + sizeof(data::buffer);
+    if (!shm::create(SHM, shm::default_name, slots, payload_size)) {
+      mystring = "[ERROR] cannot create shared memory ring";
       message(client_fd, mystring);
       return;
     }
-    mystring = "channel mask configured: " + astr;
-    DGZ.opt.channel_mask = mask;
+    mystring = "shared memory publishing enabled: " + std::string(shm::default_name) + ", " + std::to_string(slots) + " slots";
     message(client_fd, mystring);
-    return;      
+    return;
   }
-  
+
   /**
-   ** correction [status] -- enable/disable DRS4 correction
+   ** preview -- turn this connection into a decimated stream of the latest event
+   **   preview envelope [width] [fps]
+   **   preview decimate [factor] [fps]
+   **   preview status
    **/
-  
-  if (str.find("correction") == 0) {
-    if (dgz::acquisition_status(DGZ)) {
-      mystring = "cannot change configuration, acquisition is running";
-      message(client_fd, mystring);
-      return;
-    }
-    // Step 2: Split the string into words
+
+  if (str.find("preview") == 0) {
     std::stringstream ss(str);
     std::string word;
     std::vector<std::string> words;
     while (ss >> word) words.push_back(word);
-    if (words.size() != 2) {
-      mystring = "[ERROR] \'correction\' command requires one argument: \'status\'";
+    if (words.size() == 2 && words[1] == "status") {
+      mystring = "preview subscribers: " + std::to_string(preview::subscribers());
       message(client_fd, mystring);
       return;
     }
-    const std::string& astr = words[1];
-    if (astr == "on") {
-      if (CAEN_DGTZ_LoadDRS4CorrectionData(DGZ.handle, dgz::frequencies[DGZ.opt.frequency])) {
-	mystring = "[ERROR] CAEN_DGTZ_LoadDRS4CorrectionData";
+    if (words.size() < 2 || words.size() > 4 || (words[1] != "envelope" && words[1] != "decimate")) {
+      mystring = "[ERROR] \'preview\' command requires arguments: \'mode\' [envelope, decimate] [width|factor] [fps]";
+      message(client_fd, mystring);
+      return;
+    }
+    preview::options_t opt;
+    opt.mode = words[1] == "envelope" ? preview::mode_envelope : preview::mode_decimate;
+    if (words.size() > 2) {
+      int max = opt.mode == preview::mode_envelope ? data::max_length : data::max_length / 2;
+      if (!is_valid_int(words[2]) || std::stoi(words[2]) < 1 || std::stoi(words[2]) > max) {
+	mystring = "[ERROR] invalid \'preview\' argument, not a valid " + std::string(opt.mode == preview::mode_envelope ? "width" : "factor") +
+	  " [1-" + std::to_string(max) + "]: " + words[2];
 	message(client_fd, mystring);
 	return;
       }
-      if (CAEN_DGTZ_EnableDRS4Correction(DGZ.handle)) {
-	mystring = "[ERROR] CAEN_DGTZ_EnableDRS4Correction";
+      (opt.mode == preview::mode_envelope ? opt.width : opt.factor) = std::stoi(words[2]);
+    }
+    if (words.size() > 3) {
+      double fps = 0.;
+      try { fps = std::stod(words[3]); }
+      catch (std::exception &e) { fps = 0.; }
+      if (fps <= 0. || fps > 100.) {
+	mystring = "[ERROR] invalid \'preview\' argument, not a valid frame rate (0-100]: " + words[3];
 	message(client_fd, mystring);
 	return;
       }
-      mystring = "DRS4 correction enabled";
-      message(client_fd, mystring);
+      opt.fps = fps;
+    }
+    mystring = "preview streaming: " + preview::describe(opt);
+    message(client_fd, mystring);
+    preview::subscribe(client_fd, opt);
+    client_detached = true;
+    return;
+  }
+
+  /**
+   ** filter -- event-level software filter
+   **   filter off
+   **   filter amplitude [chmask] [threshold]
+   **   filter coincidence [chmask] [threshold] [window] [multiplicity]
+   **   filter polarity [pos|neg]
+   **   filter baseline [samples]
+   **   filter prescale [N]
+   **   filter status
+   **/
+
+  if (str.find("filter") == 0) {
+    std::stringstream ss(str);
+    std::string word;
+    std::vector<std::string> words;
+    while (ss >> word) words.push_back(word);
+    if (words.size() < 2) {
+      mystring = "[ERROR] \'filter\' command requires arguments: [off, amplitude, coincidence, polarity, baseline, prescale, status]";
+      message(client_fd, mystring);
+      return;
+    }
+    const std::string &what = words[1];
+    if (RECORD.running && what != "status") {
+      mystring = "cannot change filter, recording is running";
+      message(client_fd, mystring);
+      return;
+    }
+    auto parse_mask = [](const std::string &astr, int &mask) {
+      if (is_valid_int(astr)) mask = std::stoi(astr);
+      else if (is_valid_hex(astr)) mask = std::stoi(astr.substr(0, 2) == "0x" || astr.substr(0, 2) == "0X" ? astr.substr(2) : astr, nullptr, 16);
+      else return false;
+      return mask > 0 && mask <= 0xffff;
+    };
+    if (what == "off") {
+      FILTER.mode = filter::mode_off;
+    }
+    else if (what == "amplitude" || what == "coincidence") {
+      bool coincidence = what == "coincidence";
+      if (words.size() != (coincidence ? 6 : 4)) {
+	mystring = coincidence ?
+	  "[ERROR] \'filter coincidence\' requires four arguments: \'chmask\' \'threshold\' \'window\' \'multiplicity\'" :
+	  "[ERROR] \'filter amplitude\' requires two arguments: \'chmask\' \'threshold\'";
+	message(client_fd, mystring);
+	return;
+      }
+      int mask = 0;
+      if (!parse_mask(words[2], mask)) {
+	mystring = "[ERROR] invalid \'filter\' channel mask, not a valid value [1-65535]: " + words[2];
+	message(client_fd, mystring);
+	return;
+      }
+      float threshold = 0.;
+      try { threshold = std::stof(words[3]); }
+      catch (std::exception &e) {
+	mystring = "[ERROR] invalid \'filter\' threshold, not a valid number: " + words[3];
+	message(client_fd, mystring);
+	return;
+      }
+      if (coincidence) {
+	if (!is_valid_int(words[4]) || !is_valid_int(words[5]) || std::stoi(words[4]) < 0 || std::stoi(words[5]) < 1) {
+	  mystring = "[ERROR] invalid \'filter coincidence\' window/multiplicity: " + words[4] + " " + words[5];
+	  message(client_fd, mystring);
+	  return;
+	}
+	FILTER.window = std::stoi(words[4]);
+	FILTER.min_channels = std::stoi(words[5]);
+      }
+      FILTER.mode = coincidence ? filter::mode_coincidence : filter::mode_amplitude;
+      FILTER.channel_mask = mask;
+      FILTER.threshold = threshold;
+    }
+    else if (what == "polarity" && words.size() == 3 && (words[2] == "pos" || words[2] == "neg")) {
+      FILTER.rising = words[2] == "pos";
+    }
+    else if ((what == "baseline" || what == "prescale") && words.size() == 3) {
+      if (!is_valid_int(words[2]) || std::stoi(words[2]) < 0) {
+	mystring = "[ERROR] invalid \'filter " + what + "\' argument, not a valid integer: " + words[2];
+	message(client_fd, mystring);
+	return;
+      }
+      if (what == "baseline") FILTER.baseline_samples = std::stoi(words[2]);
+      else FILTER.prescale = std::stoi(words[2]);
+    }
+    else if (what == "status") {
+      filter::counters_t counters;
+      {
+	std::lock_guard<std::mutex> lock(FILTER_COUNTERS_MUTEX);
+	counters = FILTER_COUNTERS;
+      }
+      mystring = "filter: " + filter::describe(FILTER) +
+	", accepted " + std::to_string(counters.accepted) +
+	", rejected " + std::to_string(counters.rejected) +
+	", prescaled " + std::to_string(counters.prescaled);
+      message(client_fd, mystring);
+      return;
+    }
+    else {
+      mystring = "[ERROR] invalid \'filter\' arguments: " + str;
+      message(client_fd, mystring);
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(FILTER_COUNTERS_MUTEX);
+      FILTER_COUNTERS = filter::counters_t();
+    }
+    mystring = "filter configured: " + filter::describe(FILTER);
+    message(client_fd, mystring);
+    return;
+  }
+
+  /**
+   ** resample -- resample the records onto a uniform time grid
+   **   resample off
+   **   resample linear|cubic [step]
+   **   resample status
+   **/
+
+  if (str.find("resample") == 0) {
+    std::stringstream ss(str);
+    std::string word;
+    std::vector<std::string> words;
+    while (ss >> word) words.push_back(word);
+    if (words.size() == 2 && words[1] == "status") {
+      mystring = "resample: " + resample::describe(RESAMPLE, DGZ.opt.frequency) +
+	", " + std::to_string(POOL ? POOL->size() : 0) + " workers";
+      message(client_fd, mystring);
+      return;
+    }
+    if (RECORD.running) {
+      mystring = "cannot change resampling, recording is running";
+      message(client_fd, mystring);
+      return;
+    }
+    kern::interp_t method;
+    if (words.size() == 2 && words[1] == "off") {
+      RESAMPLE.method = kern::interp_off;
+    }
+    else if ((words.size() == 2 || words.size() == 3) && kern::parse_interp(words[1], method) && method != kern::interp_off) {
+      float step = 0.;
+      if (words.size() == 3) {
+	try { step = std::stof(words[2]); }
+	catch (std::exception &e) { step = -1.; }
+	if (step < resample::min_step || step > resample::max_step) {
+	  mystring = "[ERROR] invalid \'resample\' step, not a valid number [0.001-65.535] (ns): " + words[2];
+	  message(client_fd, mystring);
+	  return;
+	}
+      }
+      RESAMPLE.method = method;
+      RESAMPLE.step = step;
+    }
+    else {
+      mystring = "[ERROR] invalid \'resample\' arguments, expected [off], [linear|cubic step], [status]: " + str;
+      message(client_fd, mystring);
+      return;
+    }
+    mystring = "resample configured: " + resample::describe(RESAMPLE, DGZ.opt.frequency);
+    message(client_fd, mystring);
+    return;
+  }
+
+  /**
+   ** workers [N] -- threads decoding and resampling the events of a block, 0 = none
+   **/
+
+  if (str.find("workers") == 0) {
+    std::stringstream ss(str);
+    std::string word;
+    std::vector<std::string> words;
+    while (ss >> word) words.push_back(word);
+    if (words.size() == 1) {
+      mystring = "workers: " + std::to_string(POOL ? POOL->size() : 0);
+      message(client_fd, mystring);
+      return;
+    }
+    if (dgz::acquisition_status(DGZ) || RECORD.running) {
+      mystring = "cannot change workers, acquisition is running";
+      message(client_fd, mystring);
+      return;
+    }
+    if (words.size() != 2 || !is_valid_int(words[1]) || std::stoi(words[1]) < 0 || std::stoi(words[1]) > 256) {
+      mystring = "[ERROR] invalid \'workers\' argument, not a valid number of threads [0-256]: " + str;
+      message(client_fd, mystring);
+      return;
+    }
+    if (!start_workers(std::stoi(words[1]))) {
+      mystring = "[ERROR] CAEN_DGTZ_AllocateEvent";
+      message(client_fd, mystring);
+      return;
+    }
+    mystring = "workers configured: " + std::to_string(POOL ? POOL->size() : 0);
+    message(client_fd, mystring);
+    return;
+  }
+
+  /**
+   ** tune [seconds] [swtrg] -- sweep max_blt and polling/IRQ, apply the best
+   **/
+
+  if (str.find("tune") == 0) {
+    if (dgz::acquisition_status(DGZ) || RECORD.running) {
+      mystring = "cannot tune readout, acquisition is running";
+      message(client_fd, mystring);
+      return;
+    }
+    std::stringstream ss(str);
+    std::string word;
+    std::vector<std::string> words;
+    while (ss >> word) words.push_back(word);
+    dgz::tune_options_t topt;
+    for (size_t i = 1; i < words.size(); ++i) {
+      if (words[i] == "swtrg") topt.trigger_sw = true;
+      else if (is_valid_int(words[i]) && std::stoi(words[i]) > 0) topt.seconds = std::stoi(words[i]);
+      else {
+	mystring = "[ERROR] invalid \'tune\' argument, expected [seconds] [swtrg]: " + words[i];
+	message(client_fd, mystring);
+	return;
+      }
+    }
+    std::vector<dgz::tune_point_t> curve;
+    dgz::tune_point_t best;
+    if (!dgz::tune(DGZ, topt, curve, best)) {
+      mystring = "[ERROR] readout tuning failed, readout settings unchanged";
+      message(client_fd, mystring);
+      return;
+    }
+    mystring = "readout tuned, best " + dgz::describe(best) + "; curve:";
+    for (auto &point : curve) mystring += " [" + dgz::describe(point) + "]";
+    message(client_fd, mystring);
+    return;
+  }
+
+  /**
+   ** stats -- counters, rates, dead time and per-stage latencies
+   **   stats                        (rates since the previous 'stats' or the reset)
+   **   stats reset
+   **   stats file [path] [seconds]  (rewritten periodically, for monitoring)
+   **   stats file off
+   **/
+
+  if (str.find("stats") == 0) {
+    std::stringstream ss(str);
+    std::string word;
+    std::vector<std::string> words;
+    while (ss >> word) words.push_back(word);
+    static stats::snapshot_t previous;
+    static bool has_previous = false;
+    if (words.size() == 1) {
+      stats::snapshot_t snap;
+      stats::snapshot(snap);
+      bool since_previous = has_previous && previous.since_ns == snap.since_ns;
+      mystring = "stats: " + stats::describe(snap, since_previous ? &previous : nullptr);
+      previous = snap;
+      has_previous = true;
+      message(client_fd, mystring);
+      return;
+    }
+    if (words[1] == "reset" && words.size() == 2) {
+      stats::reset();
+      mystring = "statistics reset";
+      message(client_fd, mystring);
+      return;
+    }
+    if (words[1] == "file" && words.size() == 3 && words[2] == "off") {
+      stats::stop_file();
+      mystring = "statistics file disabled";
+      message(client_fd, mystring);
+      return;
+    }
+    if (words[1] == "file" && (words.size() == 3 || words.size() == 4)) {
+      double seconds = 10.;
+      if (words.size() == 4) {
+	try { seconds = std::stod(words[3]); }
+	catch (std::exception &e) { seconds = 0.; }
+	if (seconds < 0.1) {
+	  mystring = "[ERROR] invalid \'stats file\' argument, not a valid period [>= 0.1 s]: " + words[3];
+	  message(client_fd, mystring);
+	  return;
+	}
+      }
+      if (!stats::start_file(words[2], seconds)) {
+	mystring = "[ERROR] cannot write statistics file: " + words[2];
+	message(client_fd, mystring);
+	return;
+      }
+      std::ostringstream period;
+      period << seconds;
+      mystring = "statistics file enabled: " + words[2] + " every " + period.str() + " s";
+      message(client_fd, mystring);
+      return;
+    }
+    mystring = "[ERROR] invalid \'stats\' arguments, expected [reset], [file path [seconds]], [file off]: " + str;
+    message(client_fd, mystring);
+    return;
+  }
+
+  /**
+   ** log -- logging level and file
+   **   log level [debug|info|warning|error]
+   **   log file [path]   (appended, with timestamps)
+   **   log file off
+   **   log status
+   **/
+
+  if (str.find("log") == 0) {
+    std::stringstream ss(str);
+    std::string word;
+    std::vector<std::string> words;
+    while (ss >> word) words.push_back(word);
+    if (words.size() == 2 && words[1] == "status") {
+      auto c = logger::counters();
+      auto file = logger::get_file();
+      mystring = "log level " + std::string(logger::level_name(logger::get_level())) +
+	(logger::debug_compiled ? "" : " (debug compiled out)") +
+	", file " + (file.empty() ? "none" : file) +
+	", written " + std::to_string(c.written) + ", dropped " + std::to_string(c.dropped);
+      message(client_fd, mystring);
+      return;
+    }
+    if (words.size() == 3 && words[1] == "level") {
+      logger::level_t level;
+      if (!logger::parse_level(words[2], level)) {
+	mystring = "[ERROR] invalid \'log level\' argument, expected [debug, info, warning, error]: " + words[2];
+	message(client_fd, mystring);
+	return;
+      }
+      LOG.level = level;
+      logger::set_level(level);
+      mystring = "log level " + std::string(logger::level_name(logger::get_level()));
+      if (level == logger::level_debug && !logger::debug_compiled)
+	mystring += ", debug messages are compiled out (build with RWAVE_LOG_DEBUG)";
+      message(client_fd, mystring);
+      return;
+    }
+    if (words.size() == 3 && words[1] == "file") {
+      auto path = words[2] == "off" ? std::string() : words[2];
+      if (!logger::set_file(path)) {
+	mystring = "[ERROR] cannot open log file: " + path;
+	message(client_fd, mystring);
+	return;
+      }
+      LOG.file = path;
+      mystring = path.empty() ? "log file closed" : "logging to " + path;
+      message(client_fd, mystring);
+      return;
+    }
+    mystring = "[ERROR] invalid \'log\' arguments, expected [level level], [file path], [file off], [status]: " + str;
+    message(client_fd, mystring);
+    return;
+  }
+
+  /**
+   ** rt -- real-time mode of the acquisition threads (recording and acquire)
+   **   rt on [cpu] [priority]
+   **   rt off
+   **   rt hugepages [on|off]
+   **   rt status
+   **   rt reset
+   **/
+
+  if (str.find("rt") == 0 && (str.size() == 2 || str[2] == ' ')) {
+    std::stringstream ss(str);
+    std::string word;
+    std::vector<std::string> words;
+    while (ss >> word) words.push_back(word);
+    if (words.size() < 2) {
+      mystring = "[ERROR] \'rt\' command requires arguments: [on, off, hugepages, status, reset]";
+      message(client_fd, mystring);
+      return;
+    }
+    if (words[1] == "status") {
+      stats::snapshot_t snap;
+      stats::snapshot(snap);
+      mystring = "real-time mode " + rt::describe(RT) + "; readout latency " + stats::describe(snap.stages[stats::stage_readout]);
+      message(client_fd, mystring);
+      return;
+    }
+    if (words[1] == "reset") {
+      stats::reset();
+      mystring = "readout statistics reset";
+      message(client_fd, mystring);
+      return;
+    }
+    if (RECORD.running) {
+      mystring = "cannot change real-time mode, recording is running";
+      message(client_fd, mystring);
+      return;
+    }
+    if (words[1] == "hugepages") {
+      if (words.size() != 3 || (words[2] != "on" && words[2] != "off")) {
+	mystring = "[ERROR] \'rt hugepages\' command requires one argument: \'status\' [on, off]";
+	message(client_fd, mystring);
+	return;
+      }
+      RT.hugepages = words[2] == "on";
+      mystring = std::string("real-time hugepages ") + (RT.hugepages ? "enabled" : "disabled");
+      message(client_fd, mystring);
+      return;
+    }
+    if (words[1] == "off") {
+      RT.enabled = false;
+      rt::lock_memory(false);
+      rt::leave(RT_MAIN);
+      restart_logger();
+      mystring = "real-time mode disabled";
+      message(client_fd, mystring);
+      return;
+    }
+    if (words[1] != "on" || words.size() > 4) {
+      mystring = "[ERROR] invalid \'rt\' argument, expected on [cpu] [priority], off, hugepages, status, reset: " + words[1];
+      message(client_fd, mystring);
+      return;
+    }
+    int cpu = RT.cpu, priority = RT.priority;
+    if (words.size() > 2) {
+      int n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+      if (!is_valid_int(words[2]) || std::stoi(words[2]) < -1 || std::stoi(words[2]) >= n_cpus) {
+	mystring = "[ERROR] invalid \'rt\' argument, not a valid cpu [-1 = no pinning, 0-" + std::to_string(n_cpus - 1) + "]: " + words[2];
+	message(client_fd, mystring);
+	return;
+      }
+      cpu = std::stoi(words[2]);
+    }
+    if (words.size() > 3) {
+      if (!is_valid_int(words[3]) || std::stoi(words[3]) < 0 || std::stoi(words[3]) > 99) {
+	mystring = "[ERROR] invalid \'rt\' argument, not a valid priority [0-99]: " + words[3];
+	message(client_fd, mystring);
+	return;
+      }
+      priority = std::stoi(words[3]);
+    }
+    /** move this thread, which does logging and network, and the threads it spawns off the acquisition CPU **/
+    rt::leave(RT_MAIN);
+    RT.enabled = true;
+    RT.cpu = cpu;
+    RT.priority = priority;
+    rt::avoid(RT, RT_MAIN);
+    restart_logger();
+    bool locked = rt::lock_memory(true);
+    rt::prefault(data::buffer, sizeof(data::buffer), RT.hugepages);
+    mystring = "real-time mode enabled: " + rt::describe(RT) + (locked ? "" : " (memory not locked)");
+    message(client_fd, mystring);
+    return;
+  }
+
+  /**
+   ** trigger -- hardware trigger sources and logic
+   **   trigger ext [on|off]
+   **   trigger fast [on|off] [dc] [thr]
+   **   trigger self [chmask] [thr]
+   **   trigger self off
+   **   trigger polarity [rising|falling]
+   **   trigger majority [groups]
+   **   trigger status
+   **/
+
+  if (str.find("trigger") == 0) {
+    std::stringstream ss(str);
+    std::string word;
+    std::vector<std::string> words;
+    while (ss >> word) words.push_back(word);
+    if (words.size() < 2) {
+      mystring = "[ERROR] \'trigger\' command requires arguments: [ext, fast, self, polarity, majority, status]";
+      message(client_fd, mystring);
+      return;
+    }
+    const std::string &what = words[1];
+    if (what == "status") {
+      mystring = "trigger configuration: " + dgz::describe_trigger(DGZ.opt);
+      message(client_fd, mystring);
+      return;
+    }
+    if (dgz::acquisition_status(DGZ) || RECORD.running) {
+      mystring = "cannot change configuration, acquisition is running";
+      message(client_fd, mystring);
+      return;
+    }
+    auto parse_value = [](const std::string &astr, int min, int max, int &value) {
+      if (is_valid_int(astr)) value = std::stoi(astr);
+      else if (is_valid_hex(astr)) value = std::stoi(astr.substr(0, 2) == "0x" || astr.substr(0, 2) == "0X" ? astr.substr(2) : astr, nullptr, 16);
+      else return false;
+      return value >= min && value <= max;
+    };
+    auto opt = DGZ.opt;
+    if (what == "ext" || what == "fast") {
+      if (words.size() < 3 || (words[2] != "on" && words[2] != "off") || (what == "ext" && words.size() != 3) || words.size() > 5) {
+	mystring = what == "ext" ?
+	  "[ERROR] \'trigger ext\' requires one argument: \'status\' [on, off]" :
+	  "[ERROR] \'trigger fast\' requires arguments: \'status\' [on, off] [dc] [thr]";
+	message(client_fd, mystring);
+	return;
+      }
+      (what == "ext" ? opt.trigger_ext : opt.trigger_fast) = words[2] == "on";
+      if (words.size() > 3 && !parse_value(words[3], 0, 0xFFFF, opt.trigger_dc)) {
+	mystring = "[ERROR] invalid \'trigger fast\' DC offset, not a valid value [0-65535]: " + words[3];
+	message(client_fd, mystring);
+	return;
+      }
+      if (words.size() > 4 && !parse_value(words[4], 0, 0xFFFF, opt.trigger_thr)) {
+	mystring = "[ERROR] invalid \'trigger fast\' threshold, not a valid value [0-65535]: " + words[4];
+	message(client_fd, mystring);
+	return;
+      }
+    }
+    else if (what == "self") {
+      if (words.size() == 3 && words[2] == "off") opt.self_trigger_mask = 0;
+      else if (words.size() == 3 || words.size() == 4) {
+	if (!parse_value(words[2], 1, 0xFFFF, opt.self_trigger_mask)) {
+	  mystring = "[ERROR] invalid \'trigger self\' channel mask, not a valid value [1-65535]: " + words[2];
+	  message(client_fd, mystring);
+	  return;
+	}
+	if (words.size() == 4 && !parse_value(words[3], 0, 4095, opt.self_trigger_thr)) {
+	  mystring = "[ERROR] invalid \'trigger self\' threshold, not a valid value [0-4095]: " + words[3];
+	  message(client_fd, mystring);
+	  return;
+	}
+      }
+      else {
+	mystring = "[ERROR] \'trigger self\' requires arguments: \'chmask\' [thr] or \'off\'";
+	message(client_fd, mystring);
+	return;
+      }
+    }
+    else if (what == "polarity") {
+      if (words.size() != 3 || (words[2] != "rising" && words[2] != "falling")) {
+	mystring = "[ERROR] \'trigger polarity\' requires one argument: [rising, falling]";
+	message(client_fd, mystring);
+	return;
+      }
+      opt.trigger_polarity = words[2] == "falling";
+    }
+    else if (what == "majority") {
+      if (words.size() != 3 || !parse_value(words[2], 1, data::max_groups, opt.trigger_majority)) {
+	mystring = "[ERROR] \'trigger majority\' requires one argument, the number of groups [1-2]";
+	message(client_fd, mystring);
+	return;
+      }
+    }
+    else {
+      mystring = "[ERROR] invalid \'trigger\' argument, not a valid value [ext, fast, self, polarity, majority, status]: " + what;
+      message(client_fd, mystring);
+      return;
+    }
+    DGZ.opt = opt;
+    if (!dgz::config_trigger(DGZ)) {
+      mystring = "[ERROR] problems configuring the trigger: " + dgz::describe_trigger(DGZ.opt);
+      message(client_fd, mystring);
+      return;
+    }
+    mystring = "trigger configured: " + dgz::describe_trigger(DGZ.opt);
+    message(client_fd, mystring);
+    return;
+  }
+
+  /** sampling [MHz] **/
+  if (str.find("sampling") == 0) {
+    if (dgz::acquisition_status(DGZ)) {
+      mystring = "cannot change configuration, acquisition is running";
+      message(client_fd, mystring);
+      return;
+    }
+    // Step 2: Split the string into words
+    std::stringstream ss(str);
+    std::string word;
+    std::vector<std::string> words;
+    while (ss >> word) words.push_back(word);
+    if (words.size() != 2) {
+      mystring = "[ERROR] \'sampling\' command requires one argument: \'frequency (MHz)\'";
+      message(client_fd, mystring);
+      return;
+    }
+    const std::string& astr = words[1];
+    if (!is_valid_int(astr)) {
+      mystring = "[ERROR] invalid \'sampling\' argument, not a valid integer: " + astr;
+      message(client_fd, mystring);
+      return;
+    }
+    int frequency = std::stoi(astr);
+    if (frequency != 5000 && frequency != 2500 && frequency != 1000 && frequency != 750) {
+      mystring = " [ERROR] invalid \'sampling\' argument, not a valid value [5000, 2500, 1000, 750]: " + astr;
+      message(client_fd, mystring);
+      return;
+    }
+    if (CAEN_DGTZ_SetDRS4SamplingFrequency(DGZ.handle, dgz::frequencies[frequency])) {
+      mystring = "[ERROR] CAEN_DGTZ_SetDRS4SamplingFrequency";
+      message(client_fd, mystring);
+      return;
+    }
+    if (CAEN_DGTZ_LoadDRS4CorrectionData(DGZ.handle, dgz::frequencies[frequency])) {
+      mystring = "[ERROR] CAEN_DGTZ_LoadDRS4CorrectionData";
+      message(client_fd, mystring);
+      return;
+    }
+
+    DGZ.opt.frequency = frequency;
+    mystring = "sampling frequency configured: " + astr;
+    message(client_fd, mystring);
+    return;      
+  }
+  
+  /** maxblt [events] **/
+  if (str.find("maxblt") == 0) {
+    if (dgz::acquisition_status(DGZ)) {
+      mystring = "cannot change configuration, acquisition is running";
+      message(client_fd, mystring);
+      return;
+    }
+    // Step 2: Split the string into words
+    std::stringstream ss(str);
+    std::string word;
+    std::vector<std::string> words;
+    while (ss >> word) words.push_back(word);
+    if (words.size() != 2) {
+      mystring = "[ERROR] \'maxblt\' command requires one argument: \'events\'";
+      message(client_fd, mystring);
+      return;
+    }
+    const std::string& astr = words[1];
+    if (!is_valid_int(astr)) {
+      mystring = "[ERROR] invalid \'maxblt\' argument, not a valid integer: " + astr;
+      message(client_fd, mystring);
+      return;
+    }
+    int events = std::stoi(astr);
+    if (events < 1 || events > 1024) {
+      mystring = " [ERROR] invalid \'maxblt\' argument, not a valid value [1-1024]: " + astr;
+      message(client_fd, mystring);
+      return;
+    }
+    if (CAEN_DGTZ_SetMaxNumEventsBLT(DGZ.handle, events)) {
+      mystring = "[ERROR] CAEN_DGTZ_SetMaxNumEventsBLT";
+      message(client_fd, mystring);
+      return;
+    }
+
+    DGZ.opt.max_blt = events;
+    mystring = "maximum number events BLT configured: " + astr;
+    message(client_fd, mystring);
+    return;      
+  }
+  
+  /**
+   ** grmask [mask] -- configure group mask
+   **/
+  
+  if (str.find("grmask") == 0) {
+    if (dgz::acquisition_status(DGZ)) {
+      mystring = "cannot change configuration, acquisition is running";
+      message(client_fd, mystring);
+      return;
+    }
+    // Step 2: Split the string into words
+    std::stringstream ss(str);
+    std::string word;
+    std::vector<std::string> words;
+    while (ss >> word) words.push_back(word);
+    if (words.size() != 2) {
+      mystring = "[ERROR] \'grmask\' command requires one argument: \'mask\'";
+      message(client_fd, mystring);
+      return;
+    }
+    const std::string& astr = words[1];
+    int mask = 0x0;
+    if (is_valid_int(astr)) mask = std::stoi(astr);
+    else if (is_valid_hex(astr)) {
+      std::string hstr = astr;
+      if (hstr.substr(0, 2) == "0x" || hstr.substr(0, 2) == "0X") hstr = hstr.substr(2);
+      mask = std::stoi(hstr, nullptr, 16);
+    }
+    else {
+      mystring = "[ERROR] invalid \'grmask\' argument, not a valid integer/hex: " + astr;
+      message(client_fd, mystring);
+      return;
+    }
+    if (mask < 0x0 || mask > 0x3) {
+      mystring = "[ERROR] invalid \'grmask\' argument, not a valid value [0-3]: " + astr;
+      message(client_fd, mystring);
+      return;
+    }
+    if (CAEN_DGTZ_SetGroupEnableMask(DGZ.handle, mask)) {
+      mystring = "[ERROR] CAEN_DGTZ_SetGroupEnableMask";
+      message(client_fd, mystring);
+      return;
+    }
+    mystring = "group enable mask configured: " + astr;
+    message(client_fd, mystring);
+    return;      
+  }
+  
+  /**
+   ** chmask [mask] -- configure channel mask
+   **/
+  
+  if (str.find("chmask") == 0) {
+    if (dgz::acquisition_status(DGZ)) {
+      mystring = "cannot change configuration, acquisition is running";
+      message(client_fd, mystring);
+      return;
+    }
+    // Step 2: Split the string into words
+    std::stringstream ss(str);
+    std::string word;
+    std::vector<std::string> words;
+    while (ss >> word) words.push_back(word);
+    if (words.size() != 2) {
+      mystring = "[ERROR] \'chmask\' command requires one argument: \'mask\'";
+      message(client_fd, mystring);
+      return;
+    }
+    const std::string& astr = words[1];
+    int mask = 0x0;
+    if (is_valid_int(astr)) mask = std::stoi(astr);
+    else if (is_valid_hex(astr)) {
+      std::string hstr = astr;
+      if (hstr.substr(0, 2) == "0x" || hstr.substr(0, 2) == "0X") hstr = hstr.substr(2);
+      mask = std::stoi(hstr, nullptr, 16);
+    }
+    else {
+      mystring = "[ERROR] invalid \'chmask\' argument, not a valid integer/hex: " + astr;
+      message(client_fd, mystring);
+      return;
+    }
+    if (mask < 0 || mask > 0xffff) {
+      mystring = "[ERROR] invalid \'chmask\' argument, not a valid value [0-65535]: " + astr;
+      message(client_fd, mystring);
+      return;
+    }
+    mystring = "channel mask configured: " + astr;
+    DGZ.opt.channel_mask = mask;
+    message(client_fd, mystring);
+    return;      
+  }
+  
+  /**
+   ** correction [status] -- enable/disable DRS4 correction
+   **/
+  
+  if (str.find("correction") == 0) {
+    if (dgz::acquisition_status(DGZ)) {
+      mystring = "cannot change configuration, acquisition is running";
+      message(client_fd, mystring);
+      return;
+    }
+    // Step 2: Split the string into words
+    std::stringstream ss(str);
+    std::string word;
+    std::vector<std::string> words;
+    while (ss >> word) words.push_back(word);
+    if (words.size() != 2) {
+      mystring = "[ERROR] \'correction\' command requires one argument: \'status\'";
+      message(client_fd, mystring);
+      return;
+    }
+    const std::string& astr = words[1];
+    if (astr == "on") {
+      if (CAEN_DGTZ_LoadDRS4CorrectionData(DGZ.handle, dgz::frequencies[DGZ.opt.frequency])) {
+	mystring = "[ERROR] CAEN_DGTZ_LoadDRS4CorrectionData";
+	message(client_fd, mystring);
+	return;
+      }
+      if (CAEN_DGTZ_EnableDRS4Correction(DGZ.handle)) {
+	mystring = "[ERROR] CAEN_DGTZ_EnableDRS4Correction";
+	message(client_fd, mystring);
+	return;
+      }
+      mystring = "DRS4 correction enabled";
+      message(client_fd, mystring);
       return;      
     }
     else if (astr == "off") {
@@ -604,22 +1639,645 @@ bool
 fill_buffer(dgz::digitizer_t &dgz, int event)
 {
   auto channel_mask = DGZ.opt.channel_mask;
+  auto record_length = data::header.record_length;
+  bool channel_major = data::buffer_layout == data::layout_channel;
   /** loop over groups **/
   for (int igr = 0; igr < 2; ++igr) {
     if (dgz.event->GrPresent[igr] == 0) continue;
+    data::group_mask |= 1 << igr;
     data::trigger_tags[event][igr] = dgz.event->DataGroup[igr].TriggerTimeTag;
     data::start_cells[event][igr] = dgz.event->DataGroup[igr].StartIndexCell;
     auto mask = channel_mask >> (8 * igr);
-    /** loop over channels **/
-    for (int ich = 0; ich < 8; ++ich) {
-      if (!(mask & 1 << ich)) continue;
+    /** loop over channels, the digitized fast trigger comes as channel 8 **/
+    for (int ich = 0; ich < 9; ++ich) {
+      if (ich < 8 && !(mask & 1 << ich)) continue;
+      if (ich == 8 && !(dgz.opt.trigger_fast && dgz.event->DataGroup[igr].ChSize[8] > 0)) continue;
       auto size = dgz.event->DataGroup[igr].ChSize[ich];
-      uint8_t ch = ich + igr * 8;
+      uint8_t ch = ich < 8 ? ich + igr * 8 : data::tr_id + igr;
       data::has_channel[ch] = true;
-      for (int i = 0; i < size; ++i)
-	data::buffer[data::buffer_size + i] = dgz.event->DataGroup[igr].DataChannel[ich][i];
+      /** channel-major: each channel owns a slot of slot_events records, compacted in finalize_buffer **/
+      float *out = channel_major ?
+	&data::buffer[((size_t)ch * data::slot_events + event) * record_length] :
+	&data::buffer[data::buffer_size];
+      if (channel_major && size > record_length) size = record_length;
+      std::memcpy(out, dgz.event->DataGroup[igr].DataChannel[ich], size * sizeof(float));
       data::buffer_size += size;
     }
   }
   return true;
 }
+
+/** what a worker keeps of a decoded event, for the sequential pass **/
+struct decoded_t {
+  uint32_t ttag[2];
+  uint16_t strt[2];
+  bool keep;                 // filter decision, before the prescaler
+};
+decoded_t DECODED[data::max_events];
+
+/** decode the block on the workers. the CAEN calls are serialized, each worker
+    decoding its events into its own scratch event; the filter decisions and the
+    copies to the slice of the buffer the events would take if all were accepted
+    run in parallel, the offsets being fixed by the channels of the first event,
+    which the readout thread takes. the tags are unwrapped, the filter counted and
+    the accepted events compacted afterwards, in readout order. false, with
+    nothing counted, when the events do not all have the channels and the record
+    length of the first one. the CAEN calls, DRS4 correction included, are most of
+    the cost and stay serial, so this only pays off when there is a filter
+    decision to spread over the workers **/
+static bool
+decode_parallel(const char *buffer, std::uint32_t buffer_size, std::uint32_t num_events, uint64_t mono_ns, filter::counters_t &counters, int &n_accepted, const char *&what)
+{
+  CAEN_DGTZ_EventInfo_t event_info;
+  char *event_ptr = nullptr;
+  auto t_decode = stats::now();
+  if (CAEN_DGTZ_GetEventInfo(DGZ.handle, (char *)buffer, buffer_size, 0, &event_info, &event_ptr)) {
+    what = "CAEN_DGTZ_GetEventInfo";
+    return true;
+  }
+  if (CAEN_DGTZ_DecodeEvent(DGZ.handle, event_ptr, (void **)&DGZ.event)) {
+    what = "CAEN_DGTZ_DecodeEvent";
+    return true;
+  }
+  /** channels of the first event, in the order of fill_buffer **/
+  struct slot_t { int igr, ich; uint8_t ch; };
+  slot_t slots[data::max_ids];
+  int n_slots = 0;
+  uint8_t present = 0;
+  auto channel_mask = DGZ.opt.channel_mask;
+  for (int igr = 0; igr < 2; ++igr) {
+    if (DGZ.event->GrPresent[igr] == 0) continue;
+    present |= 1 << igr;
+    auto mask = channel_mask >> (8 * igr);
+    for (int ich = 0; ich < 9; ++ich) {
+      if (ich < 8 && !(mask & 1 << ich)) continue;
+      if (ich == 8 && !(DGZ.opt.trigger_fast && DGZ.event->DataGroup[igr].ChSize[8] > 0)) continue;
+      slots[n_slots++] = { igr, ich, (uint8_t)(ich < 8 ? ich + igr * 8 : data::tr_id + igr) };
+    }
+  }
+
+  size_t record_length = data::header.record_length;
+  bool channel_major = data::buffer_layout == data::layout_channel;
+  std::atomic<bool> uniform{true};
+  std::atomic<const char *> failed{nullptr};
+  /** filter decision and copy of one decoded event **/
+  auto take = [&](int iev, CAEN_DGTZ_X742_EVENT_t *event) {
+    auto &d = DECODED[iev];
+    uint8_t event_present = 0;
+    int event_slots = 0;
+    for (int igr = 0; igr < 2; ++igr) {
+      if (event->GrPresent[igr] == 0) continue;
+      event_present |= 1 << igr;
+      d.ttag[igr] = event->DataGroup[igr].TriggerTimeTag;
+      d.strt[igr] = event->DataGroup[igr].StartIndexCell;
+      event_slots += __builtin_popcount((channel_mask >> (8 * igr)) & 0xff) +
+	(DGZ.opt.trigger_fast && event->DataGroup[igr].ChSize[8] > 0);
+    }
+    if (event_present != present || event_slots != n_slots) return false;
+    d.keep = filter::decide(FILTER, event);
+    stats::scope_t timer(stats::stage_fill);
+    for (int is = 0; is < n_slots; ++is) {
+      auto &slot = slots[is];
+      auto &group = event->DataGroup[slot.igr];
+      if (group.ChSize[slot.ich] != record_length) return false;
+      float *out = channel_major ?
+	&data::buffer[((size_t)slot.ch * num_events + iev) * record_length] :
+	&data::buffer[((size_t)iev * n_slots + is) * record_length];
+      std::memcpy(out, group.DataChannel[slot.ich], record_length * sizeof(float));
+    }
+    return true;
+  };
+  auto task = [&](int begin, int end) {
+    auto event = POOL_EVENTS[pool::pool_t::worker_id()];
+    CAEN_DGTZ_EventInfo_t info;
+    char *ptr = nullptr;
+    for (int iev = begin; iev < end && uniform && !failed; ++iev) {
+      {
+	std::lock_guard<std::mutex> lock(POOL_DECODE_MUTEX);
+	if (CAEN_DGTZ_GetEventInfo(DGZ.handle, (char *)buffer, buffer_size, iev, &info, &ptr)) {
+	  failed = "CAEN_DGTZ_GetEventInfo";
+	  return;
+	}
+	if (CAEN_DGTZ_DecodeEvent(DGZ.handle, ptr, (void **)&event)) {
+	  failed = "CAEN_DGTZ_DecodeEvent";
+	  return;
+	}
+      }
+      if (!take(iev, event)) {
+	uniform = false;
+	return;
+      }
+    }
+  };
+  /** the first event is already decoded, the workers take the others **/
+  int n_tasks = std::min<int>(num_events - 1, 4 * POOL->size());
+  for (int itask = 0; itask < n_tasks; ++itask)
+    POOL->submit([&, itask] { task(1 + (num_events - 1) * itask / n_tasks, 1 + (num_events - 1) * (itask + 1) / n_tasks); });
+  if (!take(0, DGZ.event)) uniform = false;
+  POOL->wait();
+  if (!uniform && !failed) return false;
+  stats::record(stats::stage_decode, stats::now() - t_decode);
+  if ((what = failed)) return true;
+
+  /** in readout order: unwrapping, filter counters and prescaler, compaction **/
+  size_t event_floats = n_slots * record_length;
+  for (int iev = 0; iev < num_events; ++iev) {
+    auto &d = DECODED[iev];
+    uint64_t ttag64[2] = { 0, 0 };
+    for (int igr = 0; igr < 2; ++igr)
+      if (present & 1 << igr)
+	ttag64[igr] = dgz::extend_ttag(DGZ.ttag_clock[igr], d.ttag[igr], mono_ns);
+    if (!filter::count(FILTER, counters, d.keep)) continue;
+    int event = n_accepted++;
+    for (int igr = 0; igr < 2; ++igr) {
+      if (!(present & 1 << igr)) continue;
+      data::trigger_tags[event][igr] = d.ttag[igr];
+      data::start_cells[event][igr] = d.strt[igr];
+    }
+    data::trigger_tags64[event][0] = ttag64[0];
+    data::trigger_tags64[event][1] = ttag64[1];
+    if (event == iev) continue;
+    if (!channel_major)
+      std::memmove(&data::buffer[event * event_floats], &data::buffer[iev * event_floats], event_floats * sizeof(float));
+    else for (int is = 0; is < n_slots; ++is) {
+      float *slot = &data::buffer[(size_t)slots[is].ch * num_events * record_length];
+      std::memmove(slot + event * record_length, slot + iev * record_length, record_length * sizeof(float));
+    }
+  }
+  data::group_mask = present;
+  for (int is = 0; is < n_slots; ++is) data::has_channel[slots[is].ch] = true;
+  data::buffer_size = n_accepted * event_floats;
+  return true;
+}
+
+/** decode the readout buffer into the data buffers, returns the failing call on error **/
+const char *
+decode_events(const char *buffer, std::uint32_t buffer_size, std::uint32_t num_events, uint64_t host_ns, uint64_t mono_ns, filter::counters_t &counters, int &n_accepted)
+{
+  CAEN_DGTZ_EventInfo_t event_info;
+  char *event_ptr = nullptr;
+  data::header.record_length = DGZ.opt.record_length;
+  data::header.frequency = DGZ.opt.frequency;
+  data::buffer_size = 0;
+  data::buffer_layout = data::layout;
+  data::slot_events = num_events;
+  data::group_mask = 0;
+  data::host_ns = host_ns;
+  std::fill(std::begin(data::has_channel), std::end(data::has_channel), false);
+  n_accepted = 0;
+  const char *what = nullptr;
+  if (POOL && FILTER.mode != filter::mode_off && num_events > 1 && decode_parallel(buffer, buffer_size, num_events, mono_ns, counters, n_accepted, what)) {
+    if (what) return what;
+    finalize_buffer(n_accepted);
+    resample_buffer(n_accepted);
+    if (n_accepted > 0 && preview::active()) publish_preview(n_accepted - 1);
+    return nullptr;
+  }
+  uint64_t decode_ns = 0;
+  for (int iev = 0; iev < num_events; ++iev) {
+    auto t_decode = stats::now();
+    if (CAEN_DGTZ_GetEventInfo(DGZ.handle, (char *)buffer, buffer_size, iev, &event_info, &event_ptr))
+      return "CAEN_DGTZ_GetEventInfo";
+    if (CAEN_DGTZ_DecodeEvent(DGZ.handle, event_ptr, (void **)&DGZ.event))
+      return "CAEN_DGTZ_DecodeEvent";
+    decode_ns += stats::now() - t_decode;
+    /** every event goes through the unwrapping, so that no wrap is missed behind the filter **/
+    uint64_t ttag64[2] = { 0, 0 };
+    for (int igr = 0; igr < 2; ++igr)
+      if (DGZ.event->GrPresent[igr])
+	ttag64[igr] = dgz::extend_ttag(DGZ.ttag_clock[igr], DGZ.event->DataGroup[igr].TriggerTimeTag, mono_ns);
+    /** only events accepted by the filter enter the download buffer **/
+    if (!filter::evaluate(FILTER, counters, DGZ.event)) continue;
+    stats::scope_t timer(stats::stage_fill);
+    data::trigger_tags64[n_accepted][0] = ttag64[0];
+    data::trigger_tags64[n_accepted][1] = ttag64[1];
+    fill_buffer(DGZ, n_accepted++);
+  }
+  stats::record(stats::stage_decode, decode_ns);
+  finalize_buffer(n_accepted);
+  resample_buffer(n_accepted);
+  if (n_accepted > 0 && preview::active()) publish_preview(n_accepted - 1);
+  return nullptr;
+}
+
+/** copy one event of the buffer for the preview streamers, which reduce it in their own threads **/
+void
+publish_preview(int event)
+{
+  auto snapshot = std::make_shared<preview::snapshot_t>();
+  size_t record_length = data::header.record_length;
+  size_t n_channels = data::header.n_channels;
+  snapshot->record_length = record_length;
+  snapshot->frequency = data::header.frequency;
+  snapshot->channels.assign(data::channels, data::channels + n_channels);
+  snapshot->data.resize(n_channels * record_length);
+  for (size_t i = 0; i < n_channels; ++i) {
+    size_t offset = data::buffer_layout == data::layout_channel ?
+      (i * data::header.n_events + event) * record_length :
+      ((size_t)event * n_channels + i) * record_length;
+    std::memcpy(&snapshot->data[i * record_length], &data::buffer[offset], record_length * sizeof(float));
+  }
+  preview::publish(snapshot);
+}
+
+void
+merge_filter_counters(const filter::counters_t &counters)
+{
+  std::lock_guard<std::mutex> lock(FILTER_COUNTERS_MUTEX);
+  FILTER_COUNTERS.accepted += counters.accepted;
+  FILTER_COUNTERS.rejected += counters.rejected;
+  FILTER_COUNTERS.prescaled += counters.prescaled;
+}
+
+void
+finalize_buffer(int n_events)
+{
+  data::header.n_events = n_events;
+  data::header.n_channels = 0;
+  for (int ich = 0; ich < data::max_ids; ++ich)
+    if (data::has_channel[ich]) data::channels[data::header.n_channels++] = ich;
+  if (data::buffer_layout != data::layout_channel) return;
+
+  /** close the gaps left by absent channels and by events rejected by the filter **/
+  size_t record_length = data::header.record_length;
+  size_t block = (size_t)n_events * record_length;
+  for (int i = 0; i < data::header.n_channels; ++i) {
+    size_t from = (size_t)data::channels[i] * data::slot_events * record_length;
+    size_t to = i * block;
+    if (from != to) std::memmove(&data::buffer[to], &data::buffer[from], block * sizeof(float));
+  }
+  data::buffer_size = data::header.n_channels * block;
+}
+
+/** (re)start the pool with its decode scratch events, 0 = no workers **/
+bool
+start_workers(int n_workers)
+{
+  POOL.reset();
+  for (auto &event : POOL_EVENTS)
+    if (event) CAEN_DGTZ_FreeEvent(DGZ.handle, (void **)&event);
+  POOL_EVENTS.clear();
+  if (n_workers == 0) return true;
+  /** started here, not by the acquisition threads, which may be pinned **/
+  POOL.reset(new pool::pool_t(n_workers));
+  POOL_EVENTS.resize(POOL->size(), nullptr);
+  for (auto &event : POOL_EVENTS) {
+    if (!CAEN_DGTZ_AllocateEvent(DGZ.handle, (void **)&event)) continue;
+    error("CAEN_DGTZ_AllocateEvent");
+    start_workers(0);
+    return false;
+  }
+  return true;
+}
+
+/** resample the records of the buffer in place, the events are split over the pool **/
+void
+resample_buffer(int n_events)
+{
+  data::sample_step_ps = 0;
+  if (RESAMPLE.method == kern::interp_off || n_events == 0) return;
+  size_t record_length = data::header.record_length;
+  if (!resample::setup(RESAMPLER, RESAMPLE, DGZ.handle, data::header.frequency, record_length)) return;
+  stats::scope_t timer(stats::stage_resample);
+  int n_channels = data::header.n_channels;
+  bool channel_major = data::buffer_layout == data::layout_channel;
+  auto task = [=](int begin, int end) {
+    std::vector<float> scratch(record_length);
+    for (int iev = begin; iev < end; ++iev) {
+      for (int i = 0; i < n_channels; ++i) {
+	int ch = data::channels[i];
+	int igr = ch >= data::tr_id ? ch - data::tr_id : ch / data::max_channels;
+	size_t offset = channel_major ?
+	  ((size_t)i * n_events + iev) * record_length :
+	  ((size_t)iev * n_channels + i) * record_length;
+	resample::apply(RESAMPLER, igr, data::start_cells[iev][igr], &data::buffer[offset], scratch.data());
+      }
+    }
+  };
+  if (!POOL || n_events < 2) task(0, n_events);
+  else {
+    int n_tasks = std::min(n_events, 4 * POOL->size());
+    for (int itask = 0; itask < n_tasks; ++itask)
+      POOL->submit([=] { task(n_events * itask / n_tasks, n_events * (itask + 1) / n_tasks); });
+    POOL->wait();
+  }
+  data::sample_step_ps = std::lround(RESAMPLER.step * 1000.);
+}
+
+void
+publish_shm()
+{
+  if (!SHM.ring) return;
+  data::header_v2_t header;
+  fill_header_v2(header);
+  struct iovec iov[5] = {
+    { &header, sizeof(header) },
+    { data::channels, header.channels_size },
+    { data::trigger_tags64, header.trigger_tags_size },
+    { data::start_cells, header.start_cells_size },
+    { data::buffer, header.data_size }
+  };
+  if (!shm::publish(SHM, iov, 5)) error("cannot publish block to shared memory");
+}
+
+/** readout block handed from the acquire readout thread to the sender **/
+struct acquire_block_t {
+  int index;               // readout buffer, -1 marks the end of the readout
+  std::uint32_t size;
+  std::uint32_t num_events;
+  uint64_t host_ns;        // wall clock of the transfer
+  uint64_t mono_ns;        // monotonic clock of the transfer
+};
+
+/** the readout thread moves BLTs into a small ring of readout buffers while the
+    calling thread decodes and sends the previous ones, and a third thread
+    issues the software triggers. the stream ends with an acquire_trailer_t **/
+void
+acquire(int client_fd, uint32_t n_events, bool swtrg)
+{
+  using clock = std::chrono::steady_clock;
+  auto t_start = clock::now();
+  data::acquire_trailer_t trailer = {};
+  trailer.magic = data::trailer_magic;
+  trailer.header_size = sizeof(trailer);
+  trailer.status = data::acquire_completed;
+
+  const int n_buffers = 3;
+  std::vector<char *> buffers(n_buffers, nullptr);
+  bool started = dgz::start(DGZ);
+  bool ok = started;
+  buffers[0] = DGZ.buffer;
+  for (int i = 1; ok && i < n_buffers; ++i) {
+    std::uint32_t allocated = 0;
+    if (CAEN_DGTZ_MallocReadoutBuffer(DGZ.handle, &buffers[i], &allocated)) {
+      error("CAEN_DGTZ_MallocReadoutBuffer");
+      ok = false;
+    }
+  }
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<int> free_buffers;
+  std::deque<acquire_block_t> full_buffers;
+  for (int i = 0; i < n_buffers; ++i) free_buffers.push_back(i);
+  std::atomic<bool> running(ok);
+  std::atomic<uint64_t> n_triggers(0);
+  std::atomic<int> status(ok ? data::acquire_completed : data::acquire_error);
+  std::atomic<uint64_t> first_ns(0);
+
+  std::thread trigger;
+  if (swtrg && ok)
+    trigger = std::thread([&] {
+      for (uint32_t itrg = 0; itrg < n_events && running; ++itrg) {
+	if (CAEN_DGTZ_SendSWtrigger(DGZ.handle)) {
+	  error("CAEN_DGTZ_SendSWtrigger");
+	  break;
+	}
+	++n_triggers;
+	stats::add(stats::counter_triggers);
+	usleep(DGZ.opt.trigger_sw_usleep);
+      }
+    });
+
+  std::thread readout([&] {
+    rt::scope_t rt_scope(RT);
+    if (RT.enabled)
+      for (int i = 0; i < n_buffers; ++i) rt::prefault(buffers[i], DGZ.allocated_size, RT.hugepages);
+    uint32_t n_read = 0;
+    while (running && n_read < n_events) {
+      if (!dgz::wait_event(DGZ, DGZ.opt.readout_timeout)) {
+	status = data::acquire_timeout;
+	break;
+      }
+      auto t_ready = clock::now();
+      int index;
+      {
+	std::unique_lock<std::mutex> lock(mutex);
+	cv.wait(lock, [&] { return !free_buffers.empty() || !running; });
+	if (!running) break;
+	index = free_buffers.front();
+	free_buffers.pop_front();
+      }
+      acquire_block_t block = { index, 0, 0, 0, 0 };
+      if (CAEN_DGTZ_ReadData(DGZ.handle, CAEN_DGTZ_SLAVE_TERMINATED_READOUT_MBLT, buffers[index], &block.size) ||
+	  CAEN_DGTZ_GetNumEvents(DGZ.handle, buffers[index], block.size, &block.num_events)) {
+	error("acquire readout failed");
+	status = data::acquire_error;
+	break;
+      }
+      block.host_ns = dgz::host_ns();
+      block.mono_ns = dgz::mono_ns();
+      stats::record(stats::stage_readout, std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - t_ready).count());
+      stats::add(stats::counter_blocks);
+      stats::add(stats::counter_events, block.num_events);
+      stats::add(stats::counter_bytes_read, block.size);
+      if (first_ns == 0) first_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - t_start).count();
+      /** events beyond the requested number are dropped **/
+      block.num_events = std::min(block.num_events, n_events - n_read);
+      n_read += block.num_events;
+      std::lock_guard<std::mutex> lock(mutex);
+      if (block.num_events == 0) free_buffers.push_back(index);
+      else full_buffers.push_back(block);
+      cv.notify_all();
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    full_buffers.push_back({ -1, 0, 0, 0, 0 });
+    cv.notify_all();
+  });
+
+  /** decode and send while the next BLTs are read out **/
+  filter::counters_t counters;
+  data::header_v2_t header;
+  while (true) {
+    acquire_block_t block;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      cv.wait(lock, [&] { return !full_buffers.empty(); });
+      block = full_buffers.front();
+      full_buffers.pop_front();
+    }
+    if (block.index < 0) break;
+    trailer.n_read += block.num_events;
+    int n_accepted = 0;
+    /** the first error ends the stream, nothing more is decoded or sent **/
+    if (auto what = decode_events(buffers[block.index], block.size, block.num_events, block.host_ns, block.mono_ns, counters, n_accepted)) {
+      error(what);
+      status = data::acquire_error;
+      break;
+    }
+    if (n_accepted > 0) {
+      fill_header_v2(header);
+      struct iovec iov[5] = {
+	{ &header, sizeof(header) },
+	{ data::channels, header.channels_size },
+	{ data::trigger_tags64, header.trigger_tags_size },
+	{ data::start_cells, header.start_cells_size },
+	{ data::buffer, header.data_size }
+      };
+      auto bytes = sizeof(header) + header.channels_size + header.trigger_tags_size + header.start_cells_size + header.data_size;
+      stats::scope_t timer(stats::stage_send);
+      if (!net::send_iov(client_fd, iov, 5, NET)) {
+	error("acquire send failed");
+	status = data::acquire_error;
+	break;
+      }
+      ++trailer.n_blocks;
+      trailer.n_sent += n_accepted;
+      trailer.bytes += bytes;
+      stats::add(stats::counter_bytes_sent, bytes);
+      publish_shm();
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    free_buffers.push_back(block.index);
+    cv.notify_all();
+  }
+
+  running = false;
+  cv.notify_all();
+  readout.join();
+  if (trigger.joinable()) trigger.join();
+  if (started) dgz::stop(DGZ);
+  for (int i = 1; i < n_buffers; ++i)
+    if (buffers[i]) CAEN_DGTZ_FreeReadoutBuffer(&buffers[i]);
+  merge_filter_counters(counters);
+
+  trailer.status = status;
+  trailer.n_triggers = n_triggers;
+  trailer.first_ns = first_ns;
+  trailer.total_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - t_start).count();
+  log("acquire " << (trailer.status == data::acquire_completed ? "completed" : trailer.status == data::acquire_timeout ? "timeout" : "failed") <<
+      ": " << trailer.n_read << " events read, " << trailer.n_sent << " sent in " << trailer.n_blocks << " blocks, " <<
+      trailer.total_ns / 1000000 << " ms");
+  net::send_all(client_fd, &trailer, sizeof(trailer));
+}
+
+void
+fill_header_v2(data::header_v2_t &header)
+{
+  std::memset(&header, 0, sizeof(header));
+  header.magic = data::v2_magic;
+  header.version = data::v2_version;
+  header.header_size = sizeof(header);
+  header.n_events = data::header.n_events;
+  header.n_channels = data::header.n_channels;
+  header.record_length = data::header.record_length;
+  header.frequency = data::header.frequency;
+  header.group_mask = data::group_mask;
+  header.sample_type = data::sample_float32;
+  header.layout = data::buffer_layout;
+  header.tag_type = data::tags_ttt64;
+  header.sample_step_ps = data::sample_step_ps;
+  header.channels_size = header.n_channels * sizeof(uint8_t);
+  header.trigger_tags_size = (uint64_t)header.n_events * sizeof(uint64_t) * 2;
+  header.start_cells_size = (uint64_t)header.n_events * sizeof(uint16_t) * 2;
+  header.data_size = (uint64_t)data::buffer_size * sizeof(float);
+  header.host_ns = data::host_ns;
+}
+
+void
+record_loop()
+{
+  rt::scope_t rt_scope(RT);
+  if (RT.enabled) rt::prefault(DGZ.buffer, DGZ.allocated_size, RT.hugepages);
+  rec::writer_t writer;
+  if (!rec::open(writer, RECORD.path, REC)) {
+    std::lock_guard<std::mutex> lock(RECORD.mutex);
+    RECORD.outcome = "failed: cannot open file";
+    RECORD.running = false;
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(RECORD.mutex);
+    RECORD.backend = rec::backend(writer);
+  }
+  log("recording to " << RECORD.path << " (" << RECORD.backend << ")");
+
+  std::string outcome = "completed";
+  filter::counters_t counters;
+  data::header_v2_t header;
+  while (RECORD.running) {
+    if (RECORD.max_events > 0 && RECORD.events >= RECORD.max_events) break;
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - RECORD.start).count();
+    if (RECORD.max_seconds > 0. && elapsed >= RECORD.max_seconds) break;
+    if (!dgz::event_ready(DGZ)) {
+      usleep(100);
+      continue;
+    }
+    /** dead time is sampled once per block, when the board is about to be read **/
+    stats::busy(dgz::event_full(DGZ));
+    auto t_ready = std::chrono::steady_clock::now();
+    std::uint32_t buffer_size = 0, num_events = 0;
+    if (CAEN_DGTZ_ReadData(DGZ.handle, CAEN_DGTZ_SLAVE_TERMINATED_READOUT_MBLT, DGZ.buffer, &buffer_size) ||
+	CAEN_DGTZ_GetNumEvents(DGZ.handle, DGZ.buffer, buffer_size, &num_events)) {
+      outcome = "failed: readout error";
+      break;
+    }
+    auto host_ns = dgz::host_ns();
+    auto mono_ns = dgz::mono_ns();
+    stats::record(stats::stage_readout, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t_ready).count());
+    if (num_events == 0) continue;
+    stats::add(stats::counter_blocks);
+    stats::add(stats::counter_events, num_events);
+    stats::add(stats::counter_bytes_read, buffer_size);
+    auto written = writer.size;
+
+    bool ok = true;
+    int n_events = num_events;
+    if (RECORD.raw) {
+      /** the readout buffer as it comes from the board, decoded offline **/
+      rec::raw_header_t raw = { rec::raw_magic, sizeof(raw), num_events, 0, buffer_size, host_ns };
+      struct iovec iov[2] = { { &raw, sizeof(raw) }, { DGZ.buffer, buffer_size } };
+      stats::scope_t timer(stats::stage_write);
+      ok = rec::append(writer, iov, 2);
+    }
+    else {
+      if (auto what = decode_events(DGZ.buffer, buffer_size, num_events, host_ns, mono_ns, counters, n_events)) {
+	outcome = "failed: " + std::string(what);
+	break;
+      }
+      if (n_events == 0) continue;
+      fill_header_v2(header);
+      struct iovec iov[5] = {
+	{ &header, sizeof(header) },
+	{ data::channels, header.channels_size },
+	{ data::trigger_tags64, header.trigger_tags_size },
+	{ data::start_cells, header.start_cells_size },
+	{ data::buffer, header.data_size }
+      };
+      stats::scope_t timer(stats::stage_write);
+      ok = rec::append(writer, iov, 5);
+    }
+    if (!ok) {
+      outcome = "failed: write error";
+      break;
+    }
+    stats::add(stats::counter_bytes_written, writer.size - written);
+    RECORD.events += n_events;
+    ++RECORD.blocks;
+    RECORD.bytes = writer.size;
+    RECORD.stalls = writer.n_stalls;
+  }
+
+  if (!RECORD.running && outcome == "completed") outcome = "stopped";
+  if (!rec::close(writer) && outcome.find("failed") != 0) outcome = "failed: write error";
+  merge_filter_counters(counters);
+  log("recording " << outcome << ": " << RECORD.events << " events, " << RECORD.bytes << " bytes to " << RECORD.path);
+  std::lock_guard<std::mutex> lock(RECORD.mutex);
+  RECORD.outcome = outcome;
+  RECORD.running = false;
+}
+
+void
+record_stop()
+{
+  RECORD.running = false;
+  if (RECORD.thread.joinable()) RECORD.thread.join();
+}
+
+/** a new writer thread inherits the affinity of this thread, e.g. off the real-time CPU **/
+void
+restart_logger()
+{
+  logger::stop();
+  logger::start(LOG);
+}
@@ -0,0 +1,207 @@
+#include <cstring>
+#include <new>
+#include <chrono>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "rwaveshm.hh"
+#include "rwavelog.hh"
+
+namespace shm {
+
+static std::size_t
+align(std::size_t size, std::size_t alignment = 64)
+{
+  return (size + alignment - 1) / alignment * alignment;
+}
+
+static slot_t *
+slot(void *base, const ring_t *ring, uint64_t block)
+{
+  auto offset = ring->slot_offset + (block % ring->n_slots) * ring->slot_size;
+  return reinterpret_cast<slot_t *>(static_cast<char *>(base) + offset);
+}
+
+bool
+create(writer_t &w, const std::string &name, uint32_t n_slots, std::size_t payload_size)
+{
+  if (n_slots < 2) n_slots = 2;
+  auto slot_offset = align(sizeof(ring_t), 4096);
+  auto slot_size = align(sizeof(slot_t) + max_sections * 64 + payload_size, 4096);
+  w.name = name;
+  w.size = slot_offset + n_slots * slot_size;
+  shm_unlink(name.c_str());
+  w.fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+  if (w.fd < 0) {
+    error("shm_open " << name << ": " << std::strerror(errno));
+    return false;
+  }
+  if (ftruncate(w.fd, w.size)) {
+    error("ftruncate " << name << ": " << std::strerror(errno));
+    destroy(w);
+    return false;
+  }
+  w.base = mmap(nullptr, w.size, PROT_READ | PROT_WRITE, MAP_SHARED, w.fd, 0);
+  if (w.base == MAP_FAILED) {
+    error("mmap " << name << ": " << std::strerror(errno));
+    w.base = nullptr;
+    destroy(w);
+    return false;
+  }
+  w.ring = new (w.base) ring_t;
+  w.ring->n_slots = n_slots;
+  w.ring->slot_offset = slot_offset;
+  w.ring->slot_size = slot_size;
+  w.ring->write_seq.store(0);
+  for (uint32_t islot = 0; islot < n_slots; ++islot)
+    new (slot(w.base, w.ring, islot)) slot_t{};
+  w.ring->version = version;
+  std::atomic_thread_fence(std::memory_order_release);
+  w.ring->magic = magic;
+  log("shared memory ring " << name << ": " << n_slots << " slots of " << slot_size << " bytes");
+  return true;
+}
+
+bool
+destroy(writer_t &w)
+{
+  if (w.base) munmap(w.base, w.size);
+  if (w.fd >= 0) {
+    ::close(w.fd);
+    shm_unlink(w.name.c_str());
+  }
+  w.base = nullptr;
+  w.ring = nullptr;
+  w.fd = -1;
+  return true;
+}
+
+bool
+publish(writer_t &w, const struct iovec *iov, int iovcnt)
+{
+  if (!w.ring || iovcnt > max_sections) return false;
+  auto block = w.ring->write_seq.load(std::memory_order_relaxed);
+  auto s = slot(w.base, w.ring, block);
+
+  /** check that everything fits before touching the slot **/
+  std::size_t offset = align(sizeof(slot_t));
+  for (int i = 0; i < iovcnt; ++i) offset = align(offset + iov[i].iov_len);
+  if (offset > w.ring->slot_size) {
+    error("block does not fit into shared memory slot: " << offset << " bytes");
+    return false;
+  }
+
+  s->seq.store(2 * block + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  s->block = block;
+  s->timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+  s->n_sections = iovcnt;
+  offset = align(sizeof(slot_t));
+  for (int i = 0; i < iovcnt; ++i) {
+    s->offset[i] = offset;
+    s->size[i] = iov[i].iov_len;
+    std::memcpy(reinterpret_cast<char *>(s) + offset, iov[i].iov_base, iov[i].iov_len);
+    offset = align(offset + iov[i].iov_len);
+  }
+  s->seq.store(2 * block + 2, std::memory_order_release);
+  w.ring->write_seq.store(block + 1, std::memory_order_release);
+  return true;
+}
+
+bool
+open(reader_t &r, const std::string &name)
+{
+  r.fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if (r.fd < 0) {
+    error("shm_open " << name << ": " << std::strerror(errno));
+    return false;
+  }
+  struct stat st;
+  if (fstat(r.fd, &st) || st.st_size < (off_t)sizeof(ring_t)) {
+    error("invalid shared memory ring: " << name);
+    close(r);
+    return false;
+  }
+  r.size = st.st_size;
+  r.base = mmap(nullptr, r.size, PROT_READ, MAP_SHARED, r.fd, 0);
+  if (r.base == MAP_FAILED) {
+    error("mmap " << name << ": " << std::strerror(errno));
+    r.base = nullptr;
+    close(r);
+    return false;
+  }
+  r.ring = static_cast<const ring_t *>(r.base);
+  if (r.ring->magic != magic || r.ring->version != version) {
+    error("invalid shared memory ring: " << name);
+    close(r);
+    return false;
+  }
+  auto write_seq = r.ring->write_seq.load(std::memory_order_acquire);
+  r.next = write_seq > 0 ? write_seq - 1 : 0;
+  r.lost = 0;
+  return true;
+}
+
+bool
+close(reader_t &r)
+{
+  if (r.base) munmap(const_cast<void *>(r.base), r.size);
+  if (r.fd >= 0) ::close(r.fd);
+  r.base = nullptr;
+  r.ring = nullptr;
+  r.fd = -1;
+  return true;
+}
+
+bool
+next(reader_t &r, block_t &b, int timeout_ms, int poll_us)
+{
+  if (!r.ring) return false;
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  while (true) {
+    auto write_seq = r.ring->write_seq.load(std::memory_order_acquire);
+    if (r.next < write_seq) {
+      /** fell behind by more than the ring depth, skip to the oldest safe slot **/
+      if (write_seq - r.next >= r.ring->n_slots) {
+	auto oldest = write_seq - r.ring->n_slots + 1;
+	r.lost += oldest - r.next;
+	r.next = oldest;
+      }
+      auto s = slot(const_cast<void *>(r.base), r.ring, r.next);
+      auto seq = s->seq.load(std::memory_order_acquire);
+      if (seq != 2 * r.next + 2) {
+	/** overwritten in the meantime, try again with the updated write sequence **/
+	++r.lost;
+	++r.next;
+	continue;
+      }
+      b.block = r.next;
+      b.seq = seq;
+      b.timestamp = s->timestamp;
+      b.n_sections = s->n_sections;
+      for (uint32_t i = 0; i < b.n_sections && i < (uint32_t)max_sections; ++i) {
+	b.section[i] = reinterpret_cast<const char *>(s) + s->offset[i];
+	b.size[i] = s->size[i];
+      }
+      ++r.next;
+      if (!valid(r, b)) {
+	++r.lost;
+	continue;
+      }
+      return true;
+    }
+    if (std::chrono::steady_clock::now() > deadline) return false;
+    usleep(poll_us);
+  }
+}
+
+bool
+valid(const reader_t &r, const block_t &b)
+{
+  std::atomic_thread_fence(std::memory_order_acquire);
+  auto s = slot(const_cast<void *>(r.base), r.ring, b.block);
+  return s->seq.load(std::memory_order_relaxed) == b.seq;
+}
+
+}
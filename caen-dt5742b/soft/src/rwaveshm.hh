@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <sys/uio.h>
+
+/** POSIX shared-memory ring of decoded blocks.
+    the server publishes every block into the next slot, readers map the
+    ring read-only and access the slots in place. each slot is guarded by
+    a sequence lock: odd while being written, 2 * block + 2 when complete **/
+
+namespace shm {
+
+const char default_name[] = "/rwaveserver";
+const uint32_t magic = 0x4d535752; // "RWSM"
+const uint32_t version = 1;
+const int max_sections = 8;
+const int max_slots = 16;         // each slot holds a full readout block, about 64 MB
+
+struct ring_t {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t n_slots;
+  uint32_t slot_offset;            // offset of the first slot from the ring start
+  uint64_t slot_size;              // bytes per slot, including the slot header
+  std::atomic<uint64_t> write_seq; // number of blocks published so far
+};
+
+struct slot_t {
+  std::atomic<uint64_t> seq;
+  uint64_t block;                  // block sequence number
+  uint64_t timestamp;              // publication time (ns since epoch)
+  uint32_t n_sections;
+  uint32_t reserved;
+  uint64_t offset[max_sections];   // section offsets from the slot start
+  uint64_t size[max_sections];     // section sizes (bytes)
+};
+
+/** server side **/
+
+struct writer_t {
+  std::string name;
+  int fd = -1;
+  void *base = nullptr;
+  std::size_t size = 0;
+  ring_t *ring = nullptr;
+};
+
+bool create(writer_t &w, const std::string &name, uint32_t n_slots, std::size_t payload_size);
+bool destroy(writer_t &w);
+/** copy the sections into the next slot and publish it **/
+bool publish(writer_t &w, const struct iovec *iov, int iovcnt);
+
+/** client side **/
+
+struct block_t {
+  uint64_t block = 0;
+  uint64_t seq = 0;
+  uint64_t timestamp = 0;
+  uint32_t n_sections = 0;
+  const void *section[max_sections] = {nullptr};
+  uint64_t size[max_sections] = {0};
+};
+
+struct reader_t {
+  int fd = -1;
+  const void *base = nullptr;
+  std::size_t size = 0;
+  const ring_t *ring = nullptr;
+  uint64_t next = 0;  // next block to consume
+  uint64_t lost = 0;  // blocks overwritten before they could be consumed
+};
+
+/** map the ring and start from the most recent block **/
+bool open(reader_t &r, const std::string &name = default_name);
+bool close(reader_t &r);
+/** wait up to timeout_ms for the next block and return a view of it, no copy **/
+bool next(reader_t &r, block_t &b, int timeout_ms = 1000, int poll_us = 100);
+/** true if the block has not been overwritten while it was being consumed **/
+bool valid(const reader_t &r, const block_t &b);
+
+}
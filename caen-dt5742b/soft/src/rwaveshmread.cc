@@ -0,0 +1,53 @@
+#include <iostream>
+#include <chrono>
+#include <csignal>
+#include "rwaveshm.hh"
+#include "rwaveformat.hh"
+
+/** example same-host consumer: follows the rwaveserver shared-memory
+    ring and prints a summary of every block, without copying the data **/
+
+bool running = true;
+
+void handle_signal(int signal) {
+  running = false;
+}
+
+int main(int argc, char *argv[])
+{
+  std::string name = argc > 1 ? argv[1] : shm::default_name;
+  signal(SIGINT, handle_signal);
+
+  shm::reader_t reader;
+  if (!shm::open(reader, name)) return 1;
+  std::cout << " --- reading shared memory ring: " << name << std::endl;
+
+  shm::block_t block;
+  uint64_t nblocks = 0, nevents = 0, nbytes = 0;
+  auto t_start = std::chrono::steady_clock::now();
+  while (running) {
+    if (!shm::next(reader, block)) continue;
+    auto header = static_cast<const data::header_v2_t *>(block.section[0]);
+    if (header->magic != data::v2_magic) continue;
+    auto waveforms = static_cast<const float *>(block.section[4]);
+    /** first sample of the first waveform, as an example of in-place access **/
+    float first = block.size[4] > 0 ? waveforms[0] : 0.;
+    if (!shm::valid(reader, block)) continue; // overwritten while reading
+    ++nblocks;
+    nevents += header->n_events;
+    nbytes += block.size[4];
+    std::cout << " --- block " << block.block << ": "
+	      << header->n_events << " events, "
+	      << header->n_channels << " channels, "
+	      << header->record_length << " samples, "
+	      << (header->layout == data::layout_channel ? "channel" : "event") << "-major, "
+	      << "first sample " << first << std::endl;
+  }
+
+  auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+  std::cout << " --- " << nblocks << " blocks, " << nevents << " events, "
+	    << nbytes / elapsed / 1.e6 << " MB/s, "
+	    << reader.lost << " blocks lost " << std::endl;
+  shm::close(reader);
+  return 0;
+}
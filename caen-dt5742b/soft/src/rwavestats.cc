@@ -0,0 +1,315 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <condition_variable>
+#include "rwavestats.hh"
+#include "rwavelib.hh"
+
+namespace stats {
+
+const char *stage_names[n_stages] = { "wait", "readout", "decode", "fill", "resample", "send", "write" };
+const char *counter_names[n_counters] = { "triggers", "blocks", "events", "bytes_read", "bytes_sent", "bytes_written" };
+
+struct slot_t {
+  std::atomic<uint64_t> counters[n_counters] = {};
+  histogram_t stages[n_stages];
+  std::atomic<uint64_t> dead_ns{0}, sampled_ns{0};
+  uint64_t last_busy_ns = 0; // owner only
+};
+
+static std::mutex registry_mutex;
+static std::list<slot_t *> slots;
+static slot_t retired;
+static snapshot_t baseline;
+static std::atomic<uint64_t> since_ns{now()};
+
+/** single-writer increment: no locked instruction, readers may see it a little late **/
+static inline void
+bump(std::atomic<uint64_t> &a, uint64_t n)
+{
+  a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+static void
+merge(slot_t &to, const slot_t &from)
+{
+  for (int i = 0; i < n_counters; ++i) to.counters[i] += from.counters[i];
+  for (int s = 0; s < n_stages; ++s) {
+    auto &a = to.stages[s];
+    auto &b = from.stages[s];
+    for (int i = 0; i < histogram_t::n_bins; ++i) a.counts[i] += b.counts[i];
+    a.n += b.n;
+    a.sum_ns += b.sum_ns;
+    if (b.max_ns > a.max_ns) a.max_ns = b.max_ns.load();
+  }
+  to.dead_ns += from.dead_ns;
+  to.sampled_ns += from.sampled_ns;
+}
+
+/** registers the slot of the thread on first use, folds it into the retired total on exit **/
+struct owner_t {
+  slot_t *slot;
+  owner_t() : slot(new slot_t) {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    slots.push_back(slot);
+  }
+  ~owner_t() {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    merge(retired, *slot);
+    slots.remove(slot);
+    delete slot;
+  }
+};
+
+static inline slot_t &
+local()
+{
+  thread_local owner_t owner;
+  return *owner.slot;
+}
+
+void
+fill(histogram_t &h, uint64_t ns)
+{
+  int bin = ns < 2 ? 0 : 63 - __builtin_clzll(ns);
+  if (bin >= histogram_t::n_bins) bin = histogram_t::n_bins - 1;
+  bump(h.counts[bin], 1);
+  bump(h.n, 1);
+  bump(h.sum_ns, ns);
+  if (ns > h.max_ns.load(std::memory_order_relaxed)) h.max_ns.store(ns, std::memory_order_relaxed);
+}
+
+void
+add(counter_t counter, uint64_t n)
+{
+  bump(local().counters[counter], n);
+}
+
+void
+record(stage_t stage, uint64_t ns)
+{
+  fill(local().stages[stage], ns);
+}
+
+void
+busy(bool full)
+{
+  auto &slot = local();
+  auto t = now();
+  if (slot.last_busy_ns > 0) {
+    auto interval = t - slot.last_busy_ns;
+    bump(slot.sampled_ns, interval);
+    if (full) bump(slot.dead_ns, interval);
+  }
+  slot.last_busy_ns = t;
+}
+
+static void
+add_to(snapshot_t &snap, const slot_t &slot)
+{
+  for (int i = 0; i < n_counters; ++i) snap.counters[i] += slot.counters[i].load(std::memory_order_relaxed);
+  for (int s = 0; s < n_stages; ++s) {
+    auto &a = snap.stages[s];
+    auto &b = slot.stages[s];
+    for (int i = 0; i < histogram_t::n_bins; ++i) a.counts[i] += b.counts[i].load(std::memory_order_relaxed);
+    a.n += b.n.load(std::memory_order_relaxed);
+    a.sum_ns += b.sum_ns.load(std::memory_order_relaxed);
+    a.max_ns = std::max<uint64_t>(a.max_ns, b.max_ns.load(std::memory_order_relaxed));
+  }
+  snap.dead_ns += slot.dead_ns.load(std::memory_order_relaxed);
+  snap.sampled_ns += slot.sampled_ns.load(std::memory_order_relaxed);
+}
+
+/** sums since the start, registry_mutex held **/
+static void
+totals(snapshot_t &snap)
+{
+  snap = snapshot_t();
+  snap.time_ns = now();
+  add_to(snap, retired);
+  for (auto slot : slots) add_to(snap, *slot);
+}
+
+void
+snapshot(snapshot_t &snap)
+{
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  totals(snap);
+  snap.since_ns = since_ns;
+  for (int i = 0; i < n_counters; ++i) snap.counters[i] -= baseline.counters[i];
+  for (int s = 0; s < n_stages; ++s) {
+    auto &a = snap.stages[s];
+    auto &b = baseline.stages[s];
+    int top = -1;
+    for (int i = 0; i < histogram_t::n_bins; ++i)
+      if ((a.counts[i] -= b.counts[i]) > 0) top = i;
+    a.n -= b.n;
+    a.sum_ns -= b.sum_ns;
+    a.max_ns = top < 0 ? 0 : std::min<uint64_t>(a.max_ns, 2ULL << top);
+  }
+  snap.dead_ns -= baseline.dead_ns;
+  snap.sampled_ns -= baseline.sampled_ns;
+}
+
+void
+reset()
+{
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  totals(baseline);
+  since_ns = baseline.time_ns;
+}
+
+uint64_t
+percentile(const snapshot_t::stage_summary_t &stage, double q)
+{
+  uint64_t sum = 0;
+  for (int i = 0; i < histogram_t::n_bins; ++i) {
+    sum += stage.counts[i];
+    if (stage.n > 0 && sum >= q * stage.n) return std::min<uint64_t>(2ULL << i, stage.max_ns);
+  }
+  return stage.max_ns;
+}
+
+std::vector<std::pair<std::string, std::string>>
+format(const snapshot_t &snap, const snapshot_t *prev)
+{
+  std::vector<std::pair<std::string, std::string>> out;
+  auto num = [](double value, int precision) {
+    std::ostringstream ss;
+    ss << std::fixed << std::setprecision(precision) << value;
+    return ss.str();
+  };
+  double seconds = (snap.time_ns - (prev ? prev->time_ns : snap.since_ns)) * 1.e-9;
+  out.emplace_back("uptime_s", num((snap.time_ns - snap.since_ns) * 1.e-9, 1));
+  for (int i = 0; i < n_counters; ++i) {
+    auto delta = snap.counters[i] - (prev ? prev->counters[i] : 0);
+    out.emplace_back(std::string(counter_names[i]) + "_total", std::to_string(snap.counters[i]));
+    out.emplace_back(std::string(counter_names[i]) + "_per_s", num(seconds > 0. ? delta / seconds : 0., 1));
+  }
+  for (int i : { counter_bytes_read, counter_bytes_sent, counter_bytes_written }) {
+    auto delta = snap.counters[i] - (prev ? prev->counters[i] : 0);
+    std::string name = counter_names[i];
+    out.emplace_back(name.substr(6) + "_mb_per_s", num(seconds > 0. ? delta / seconds / 1.e6 : 0., 3));
+  }
+  auto dead = snap.dead_ns - (prev ? prev->dead_ns : 0), sampled = snap.sampled_ns - (prev ? prev->sampled_ns : 0);
+  out.emplace_back("dead_time_fraction", num(sampled > 0 ? (double)dead / sampled : 0., 4));
+  for (int s = 0; s < n_stages; ++s) {
+    auto &stage = snap.stages[s];
+    if (stage.n == 0) continue;
+    std::string name = std::string("stage_") + stage_names[s];
+    out.emplace_back(name + "_count", std::to_string(stage.n));
+    out.emplace_back(name + "_mean_us", num(stage.sum_ns / stage.n * 1.e-3, 1));
+    out.emplace_back(name + "_p50_us", num(percentile(stage, 0.5) * 1.e-3, 1));
+    out.emplace_back(name + "_p99_us", num(percentile(stage, 0.99) * 1.e-3, 1));
+    out.emplace_back(name + "_max_us", num(stage.max_ns * 1.e-3, 1));
+  }
+  return out;
+}
+
+std::string
+describe(const snapshot_t::stage_summary_t &stage)
+{
+  std::ostringstream ss;
+  ss << "n " << stage.n;
+  if (stage.n == 0) return ss.str();
+  ss << ", mean " << stage.sum_ns / stage.n / 1000 << " us";
+  const double quantiles[] = { 0.5, 0.99, 0.999 };
+  const char *names[] = { "p50", "p99", "p99.9" };
+  for (int q = 0; q < 3; ++q)
+    ss << ", " << names[q] << " < " << percentile(stage, quantiles[q]) / 1000 << " us";
+  ss << ", max " << stage.max_ns / 1000 << " us, bins [ns]";
+  for (int i = 0; i < histogram_t::n_bins; ++i) {
+    if (stage.counts[i] == 0) continue;
+    ss << " " << (i == 0 ? 0 : 1ULL << i) << "-" << (2ULL << i) << ":" << stage.counts[i];
+  }
+  return ss.str();
+}
+
+std::string
+describe(const snapshot_t &snap, const snapshot_t *prev)
+{
+  std::string line;
+  for (auto &kv : format(snap, prev)) {
+    if (!line.empty()) line += ", ";
+    line += kv.first + " " + kv.second;
+  }
+  return line;
+}
+
+/** periodic file writer **/
+
+static std::mutex file_mutex;
+static std::condition_variable file_cv;
+static std::thread file_thread;
+static bool file_running = false;
+static std::string path_;
+
+static bool
+write_file(const std::string &path, const snapshot_t &snap, const snapshot_t *prev)
+{
+  auto tmp = path + ".tmp";
+  {
+    std::ofstream out(tmp, std::ios::trunc);
+    if (!out) return false;
+    for (auto &kv : format(snap, prev)) out << "rwave_" << kv.first << " " << kv.second << "\n";
+    if (!out) return false;
+  }
+  return std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+bool
+start_file(const std::string &path, double seconds)
+{
+  stop_file();
+  snapshot_t first;
+  snapshot(first);
+  if (!write_file(path, first, nullptr)) {
+    error("cannot write statistics file " << path);
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(file_mutex);
+  file_running = true;
+  path_ = path;
+  file_thread = std::thread([path, seconds, first] {
+    snapshot_t prev = first, snap;
+    std::unique_lock<std::mutex> lock(file_mutex);
+    while (!file_cv.wait_for(lock, std::chrono::duration<double>(seconds), [] { return !file_running; })) {
+      lock.unlock();
+      snapshot(snap);
+      /** a reset in between re-bases the counters, the previous snapshot no longer applies **/
+      auto since_prev = prev.since_ns == snap.since_ns ? &prev : nullptr;
+      if (!write_file(path, snap, since_prev)) error("cannot write statistics file " << path);
+      prev = snap;
+      lock.lock();
+    }
+  });
+  return true;
+}
+
+void
+stop_file()
+{
+  {
+    std::lock_guard<std::mutex> lock(file_mutex);
+    file_running = false;
+    path_.clear();
+  }
+  file_cv.notify_all();
+  if (file_thread.joinable()) file_thread.join();
+}
+
+std::string
+file_path()
+{
+  std::lock_guard<std::mutex> lock(file_mutex);
+  return path_;
+}
+
+}
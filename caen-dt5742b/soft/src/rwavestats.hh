@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <utility>
+#include <vector>
+
+/** hot-path instrumentation: counters and per-stage latency histograms.
+    every thread updates its own slot with plain relaxed stores (a few ns per
+    sample, no shared cache lines); slots are summed only when a snapshot is
+    taken, and the slot of an exiting thread is folded into a retired total **/
+
+namespace stats {
+
+enum stage_t {
+  stage_wait = 0,     // waiting for event ready (poll or IRQ)
+  stage_readout,      // event ready to the end of ReadData
+  stage_decode,       // GetEventInfo and DecodeEvent of one block
+  stage_fill,         // fill_buffer / fill_output of one event
+  stage_resample,     // resampling of one block (server) or event (rwavedump)
+  stage_send,         // network send of one block
+  stage_write,        // file write of one block
+  n_stages
+};
+
+enum counter_t {
+  counter_triggers = 0,  // software triggers sent
+  counter_blocks,        // block transfers with data
+  counter_events,        // events read from the board
+  counter_bytes_read,
+  counter_bytes_sent,
+  counter_bytes_written,
+  n_counters
+};
+
+extern const char *stage_names[n_stages];
+extern const char *counter_names[n_counters];
+
+/** log2 histogram: bin i counts [2^i, 2^(i+1)) ns, bin 0 also counts 0 **/
+struct histogram_t {
+  static const int n_bins = 40;
+  std::atomic<uint64_t> counts[n_bins] = {};
+  std::atomic<uint64_t> n{0}, sum_ns{0}, max_ns{0};
+};
+
+/** single-writer histogram update **/
+void fill(histogram_t &h, uint64_t ns);
+
+inline uint64_t
+now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void add(counter_t counter, uint64_t n = 1);
+void record(stage_t stage, uint64_t ns);
+
+/** time the enclosing scope as one sample of stage **/
+struct scope_t {
+  stage_t stage;
+  uint64_t start;
+  scope_t(stage_t stage) : stage(stage), start(now()) {}
+  ~scope_t() { record(stage, now() - start); }
+};
+
+/** sample the board busy (memory full) flag; the time since the previous
+    sample of this thread is counted as dead if the board is busy now **/
+void busy(bool full);
+
+struct snapshot_t {
+  uint64_t time_ns = 0;      // monotonic time of the snapshot
+  uint64_t since_ns = 0;     // monotonic time of the last reset
+  uint64_t counters[n_counters] = {};
+  uint64_t dead_ns = 0, sampled_ns = 0;
+  struct stage_summary_t {
+    uint64_t n = 0, sum_ns = 0, max_ns = 0;
+    uint64_t counts[histogram_t::n_bins] = {};
+  } stages[n_stages];
+};
+
+/** sum all the thread slots, less the baseline of the last reset **/
+void snapshot(snapshot_t &snap);
+/** take the current sums as the baseline. the slots are only written by their
+    threads, so they are not cleared; a stage max is exact only when it comes
+    after the reset, otherwise it is capped to the upper edge of the highest bin
+    filled since **/
+void reset();
+
+/** name/value pairs: totals, rates over [prev, snap] (since the reset if prev is null),
+    dead-time fraction and per-stage count, mean, p50, p99, max in microseconds **/
+std::vector<std::pair<std::string, std::string>> format(const snapshot_t &snap, const snapshot_t *prev);
+/** the pairs joined on one line **/
+std::string describe(const snapshot_t &snap, const snapshot_t *prev);
+/** percentile upper edge (ns) of a stage **/
+uint64_t percentile(const snapshot_t::stage_summary_t &stage, double q);
+/** one-line summary of a stage: count, mean, percentiles and max (us), the non-empty bins (ns) **/
+std::string describe(const snapshot_t::stage_summary_t &stage);
+
+/** rewrite path every seconds with "name value" lines, atomically (write and rename) **/
+bool start_file(const std::string &path, double seconds);
+void stop_file();
+std::string file_path();
+
+}
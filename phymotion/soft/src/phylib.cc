@@ -0,0 +1,390 @@
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#include "phylib.hh"
+
+namespace phy {
+
+std::map<uint32_t, std::string> status_bits = {
+  { 0x00000001 , "Axis busy" } ,
+  { 0x00000002 , "Command invalid" } ,
+  { 0x00000004 , "Axis waits for synchronisation" } ,
+  { 0x00000008 , "Axis initialised" } ,
+  { 0x00000010 , "Axis limit switch +" } ,
+  { 0x00000020 , "Axis limit switch -" } ,
+  { 0x00000040 , "Axis limit switch center" } ,
+  { 0x00000080 , "Axis limit switch software +" } ,
+  { 0x00000100 , "Axis limit switch software -" } ,
+  { 0x00000200 , "Axis power stage is busy" } ,
+  { 0x00000400 , "Axis is in the ramp" } ,
+  { 0x00000800 , "Axis internal error" } ,
+  { 0x00001000 , "Axis limit switch error" } ,
+  { 0x00002000 , "Axis power stage error" } ,
+  { 0x00004000 , "Axis SFI error" } ,
+  { 0x00008000 , "Axis ENDAT error" } ,
+  { 0x00010000 , "Axis is running" } ,
+  { 0x00020000 , "Axis is in recovery time (s. parameter P13 or P16)" } ,
+  { 0x00040000 , "Axis is in stop current delay time (parameter P43)" } ,
+  { 0x00080000 , "Axis is in position" } ,
+  { 0x00100000 , "Axis APS is ready" } ,
+  { 0x00200000 , "Axis is positioning mode" } ,
+  { 0x00400000 , "Axis is in free running mode" } ,
+  { 0x00800000 , "Axis multi F run" } ,
+  { 0x01000000 , "Axis SYNC allowed" }
+};
+
+static bool
+connect_socket(controller_t &ctl, std::string &what)
+{
+  struct addrinfo hints, *res = nullptr;
+  std::memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(ctl.opt.address.c_str(), std::to_string(ctl.opt.port).c_str(), &hints, &res) || !res) {
+    what = "cannot resolve address: " + ctl.opt.address;
+    return false;
+  }
+  ctl.fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+  if (ctl.fd < 0) {
+    what = "socket creation failed";
+    freeaddrinfo(res);
+    return false;
+  }
+  if (connect(ctl.fd, res->ai_addr, res->ai_addrlen) < 0) {
+    what = "connection failed";
+    freeaddrinfo(res);
+    ::close(ctl.fd);
+    ctl.fd = -1;
+    return false;
+  }
+  freeaddrinfo(res);
+
+  /** short telegrams, do not let Nagle hold them back **/
+  int one = 1;
+  setsockopt(ctl.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  struct timeval tv;
+  tv.tv_sec = ctl.opt.timeout_ms / 1000;
+  tv.tv_usec = (ctl.opt.timeout_ms % 1000) * 1000;
+  setsockopt(ctl.fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  ctl.rxbuf.clear();
+  return true;
+}
+
+bool
+open(controller_t &ctl)
+{
+  log("connect to phyMOTION controller " << ctl.opt.address << ":" << ctl.opt.port);
+  std::string what;
+  if (!connect_socket(ctl, what)) {
+    error(what);
+    return false;
+  }
+  ctl.backoff_ms = 0;
+  ctl.status.assign(ctl.opt.axes.size(), 0);
+  ctl.position.assign(ctl.opt.axes.size(), 0.);
+  ctl.open = true;
+  return true;
+}
+
+bool
+close(controller_t &ctl)
+{
+  stop_polling(ctl);
+  if (!ctl.open) return true;
+  log("closing phyMOTION connection");
+  if (ctl.fd >= 0) ::close(ctl.fd);
+  ctl.fd = -1;
+  ctl.open = false;
+  return true;
+}
+
+static bool
+send_all(int fd, const std::string &str)
+{
+  size_t sent = 0;
+  while (sent < str.size()) {
+    auto n = ::send(fd, str.data() + sent, str.size() - sent, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    sent += n;
+  }
+  return true;
+}
+
+static std::string
+frame(const std::string &cmd)
+{
+  /** address 0, no checksum (XX) **/
+  return std::string(1, STX) + "0" + cmd + ":XX" + std::string(1, ETX);
+}
+
+static bool
+recv_reply(controller_t &ctl, reply_t &reply, std::string &what)
+{
+  char buf[256];
+  auto etx = ctl.rxbuf.find(ETX);
+  while (etx == std::string::npos) {
+    auto n = ::recv(ctl.fd, buf, sizeof(buf), 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      what = n == 0 ? "connection closed by phyMOTION controller" : "no reply from phyMOTION controller";
+      return false;
+    }
+    ctl.rxbuf.append(buf, n);
+    etx = ctl.rxbuf.find(ETX);
+  }
+  std::string telegram = ctl.rxbuf.substr(0, etx);
+  ctl.rxbuf.erase(0, etx + 1);
+  /** resync on the last STX, bytes before it are left over from an earlier telegram **/
+  auto stx = telegram.rfind(STX);
+  if (stx == std::string::npos || stx + 1 >= telegram.size()) {
+    what = "malformed reply from phyMOTION controller";
+    return false;
+  }
+  reply.ack = telegram[stx + 1] == ACK;
+  reply.data = telegram.substr(stx + 2);
+  auto colon = reply.data.rfind(':');
+  if (colon != std::string::npos) reply.data.erase(colon);
+  return true;
+}
+
+/** a late or partial reply would be taken for the answer to the next
+    command: drop the connection and what is buffered, and reconnect.
+    the wait before the next attempt doubles until a transaction succeeds,
+    only the first failure of an outage is reported **/
+static void
+backoff(controller_t &ctl)
+{
+  ctl.backoff_ms = ctl.backoff_ms == 0 ? ctl.opt.backoff_ms : std::min(2 * ctl.backoff_ms, ctl.opt.backoff_max_ms);
+  ctl.retry_at = std::chrono::steady_clock::now() + std::chrono::milliseconds(ctl.backoff_ms);
+}
+
+static void
+drop_connection(controller_t &ctl, const std::string &what)
+{
+  if (ctl.backoff_ms == 0) error(what << ", reconnecting, retrying up to every " << ctl.opt.backoff_max_ms << " ms");
+  ::close(ctl.fd);
+  ctl.fd = -1;
+  ctl.rxbuf.clear();
+  backoff(ctl);
+}
+
+static bool
+reconnect(controller_t &ctl)
+{
+  if (std::chrono::steady_clock::now() < ctl.retry_at) return false;
+  std::string what;
+  if (!connect_socket(ctl, what)) {
+    backoff(ctl);
+    return false;
+  }
+  return true;
+}
+
+bool
+transact(controller_t &ctl, const std::vector<std::string> &cmds, std::vector<reply_t> &replies)
+{
+  if (!ctl.open) return false;
+  std::lock_guard<std::mutex> lock(ctl.mutex);
+  if (ctl.fd < 0 && !reconnect(ctl)) return false;
+  std::string out;
+  for (const auto &cmd : cmds) out += frame(cmd);
+  if (!send_all(ctl.fd, out)) {
+    drop_connection(ctl, "cannot send to phyMOTION controller");
+    return false;
+  }
+  replies.resize(cmds.size());
+  std::string what;
+  for (auto &reply : replies)
+    if (!recv_reply(ctl, reply, what)) {
+      drop_connection(ctl, what);
+      return false;
+    }
+  if (ctl.backoff_ms != 0) {
+    log("phyMOTION controller " << ctl.opt.address << ":" << ctl.opt.port << " answering again");
+    ctl.backoff_ms = 0;
+  }
+  return true;
+}
+
+bool
+ask(controller_t &ctl, const std::string &cmd, reply_t &reply)
+{
+  std::vector<reply_t> replies;
+  if (!transact(ctl, { cmd }, replies)) return false;
+  reply = replies[0];
+  return true;
+}
+
+bool
+batch(controller_t &ctl, const std::vector<std::string> &cmds)
+{
+  std::string telegram;
+  for (const auto &cmd : cmds) telegram += (telegram.empty() ? "" : " ") + cmd;
+  reply_t reply;
+  if (!ask(ctl, telegram, reply)) return false;
+  if (!reply.ack) error("command not acknowledged: " << telegram);
+  return reply.ack;
+}
+
+static void
+mark_move(controller_t &ctl)
+{
+  std::lock_guard<std::mutex> lock(ctl.status_mutex);
+  ctl.move_seq = ctl.status_seq;
+}
+
+bool
+move(controller_t &ctl, const std::vector<double> &pos)
+{
+  if (pos.size() != ctl.opt.axes.size()) {
+    error("move requires " << ctl.opt.axes.size() << " coordinates");
+    return false;
+  }
+  std::vector<std::string> cmds;
+  for (size_t iax = 0; iax < pos.size(); ++iax) {
+    std::ostringstream ss;
+    ss << ctl.opt.axes[iax] << "A" << std::setprecision(10) << pos[iax];
+    cmds.push_back(ss.str());
+  }
+  if (!batch(ctl, cmds)) return false;
+  mark_move(ctl);
+  return true;
+}
+
+bool
+home(controller_t &ctl)
+{
+  std::vector<std::string> cmds;
+  for (const auto &axis : ctl.opt.axes) cmds.push_back(axis + "R-");
+  if (!batch(ctl, cmds)) return false;
+  mark_move(ctl);
+  return true;
+}
+
+bool
+activate(controller_t &ctl, bool on)
+{
+  std::vector<std::string> cmds;
+  for (const auto &axis : ctl.opt.axes) cmds.push_back(axis + (on ? "MA" : "MD"));
+  return batch(ctl, cmds);
+}
+
+bool
+read_status(controller_t &ctl, std::vector<uint32_t> &status, std::vector<double> &position)
+{
+  /** status and position of all axes in one round trip **/
+  std::vector<std::string> cmds;
+  for (const auto &axis : ctl.opt.axes) cmds.push_back("SE" + axis);
+  for (const auto &axis : ctl.opt.axes) cmds.push_back(axis + "P20R");
+  std::vector<reply_t> replies;
+  if (!transact(ctl, cmds, replies)) return false;
+  auto naxes = ctl.opt.axes.size();
+  status.resize(naxes);
+  position.resize(naxes);
+  try {
+    for (size_t iax = 0; iax < naxes; ++iax) {
+      status[iax] = std::stoul(replies[iax].data);
+      position[iax] = std::stod(replies[naxes + iax].data);
+    }
+  }
+  catch (std::exception &e) {
+    return false;
+  }
+  return true;
+}
+
+static void
+poll_loop(controller_t &ctl)
+{
+  std::vector<uint32_t> status;
+  std::vector<double> position;
+  auto period = std::chrono::milliseconds(ctl.opt.poll_ms);
+  auto next = std::chrono::steady_clock::now();
+  bool was_valid = true;
+  while (ctl.polling) {
+    bool valid = read_status(ctl, status, position);
+    /** report changes only, not every failed cycle **/
+    if (!valid && was_valid) error("status polling failed, axis status not valid until the controller answers again");
+    if (valid && !was_valid) log("status polling restored");
+    was_valid = valid;
+    {
+      std::lock_guard<std::mutex> lock(ctl.status_mutex);
+      ctl.status_valid = valid;
+      if (valid) {
+	ctl.status = status;
+	ctl.position = position;
+      }
+      ++ctl.status_seq;
+    }
+    ctl.status_cv.notify_all();
+    next += period;
+    auto now = std::chrono::steady_clock::now();
+    if (next < now) next = now;
+    std::this_thread::sleep_until(next);
+  }
+}
+
+bool
+start_polling(controller_t &ctl)
+{
+  if (!ctl.open || ctl.polling) return ctl.polling;
+  log("start status polling every " << ctl.opt.poll_ms << " ms");
+  ctl.polling = true;
+  ctl.poller = std::thread(poll_loop, std::ref(ctl));
+  return true;
+}
+
+bool
+stop_polling(controller_t &ctl)
+{
+  if (!ctl.polling) return true;
+  ctl.polling = false;
+  if (ctl.poller.joinable()) ctl.poller.join();
+  ctl.status_cv.notify_all();
+  return true;
+}
+
+bool
+is_moving(uint32_t status)
+{
+  return status & (status_busy | status_running);
+}
+
+bool
+wait_in_position(controller_t &ctl, int timeout_ms)
+{
+  if (!ctl.polling) {
+    error("status polling is not running");
+    return false;
+  }
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  std::unique_lock<std::mutex> lock(ctl.status_mutex);
+  /** the first poll cycle must have started after the move command **/
+  auto min_seq = ctl.move_seq + 2;
+  return ctl.status_cv.wait_until(lock, deadline, [&ctl, min_seq] {
+    if (!ctl.polling) return true;
+    if (ctl.status_seq < min_seq || !ctl.status_valid) return false;
+    for (auto status : ctl.status)
+      if (is_moving(status)) return false;
+    return true;
+  }) && ctl.polling;
+}
+
+std::string
+decode_status(uint32_t status)
+{
+  std::string str;
+  for (const auto &bit : status_bits)
+    if (status & bit.first) str += (str.empty() ? "" : ", ") + bit.second;
+  return str;
+}
+
+}
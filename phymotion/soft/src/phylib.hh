@@ -0,0 +1,100 @@
+#pragma once
+
+#include <iostream>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+
+#ifndef error
+#define error(msg) std::cout << " [ERROR] " << msg << std::endl
+#endif
+#ifndef log
+#define log(msg) std::cout << " --- " << msg << std::endl
+#endif
+
+namespace phy {
+
+/** phyMOTION telegram framing **/
+const char STX = 0x02;
+const char ETX = 0x03;
+const char ACK = 0x06;
+const char NAK = 0x15;
+
+/** axis status bits (SE command) **/
+const uint32_t status_busy = 0x00000001;
+const uint32_t status_invalid = 0x00000002;
+const uint32_t status_initialised = 0x00000008;
+const uint32_t status_error = 0x0000F800; // internal, limit switch, power stage, SFI, ENDAT
+const uint32_t status_running = 0x00010000;
+const uint32_t status_in_position = 0x00080000;
+
+extern std::map<uint32_t, std::string> status_bits;
+
+struct options_t {
+  std::string address = "10.0.8.16";
+  int port = 22222;
+  int timeout_ms = 1000; // reply timeout
+  int poll_ms = 10;      // status polling period
+  int backoff_ms = 100;  // first wait between reconnection attempts, doubled up to backoff_max_ms
+  int backoff_max_ms = 5000;
+  std::vector<std::string> axes = { "1.1" , "2.1" };
+};
+
+struct reply_t {
+  bool ack = false;
+  std::string data;
+};
+
+struct controller_t {
+  bool open = false;
+  int fd = -1;
+  options_t opt;
+  std::string rxbuf;
+  std::mutex mutex; // one transaction at a time on the connection
+  /** reconnection after a failed transaction (fd < 0 while open) **/
+  int backoff_ms = 0;
+  std::chrono::steady_clock::time_point retry_at;
+  /** status polling **/
+  std::thread poller;
+  std::atomic<bool> polling{false};
+  std::mutex status_mutex;
+  std::condition_variable status_cv;
+  std::vector<uint32_t> status;
+  std::vector<double> position;
+  uint64_t status_seq = 0; // incremented at every completed poll cycle
+  uint64_t move_seq = 0;   // status_seq at the time of the last move command
+  bool status_valid = false;
+};
+
+bool open(controller_t &ctl);
+bool close(controller_t &ctl);
+
+/** send one telegram per command back-to-back, then collect the replies in order **/
+bool transact(controller_t &ctl, const std::vector<std::string> &cmds, std::vector<reply_t> &replies);
+/** single command, single reply **/
+bool ask(controller_t &ctl, const std::string &cmd, reply_t &reply);
+/** several commands in one telegram, separated by blanks **/
+bool batch(controller_t &ctl, const std::vector<std::string> &cmds);
+
+/** absolute move of all axes (mm), issued as one telegram **/
+bool move(controller_t &ctl, const std::vector<double> &pos);
+bool home(controller_t &ctl);
+bool activate(controller_t &ctl, bool on);
+bool read_status(controller_t &ctl, std::vector<uint32_t> &status, std::vector<double> &position);
+
+/** background status polling **/
+bool start_polling(controller_t &ctl);
+bool stop_polling(controller_t &ctl);
+/** block until all axes are in position after the last move, or timeout (ms) **/
+bool wait_in_position(controller_t &ctl, int timeout_ms);
+
+bool is_moving(uint32_t status);
+std::string decode_status(uint32_t status);
+
+}
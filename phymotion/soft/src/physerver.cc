@@ -0,0 +1,345 @@
+#include <iostream>
+#include <cstring>
+#include <csignal>
+#include <sstream>
+#include <vector>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <boost/program_options.hpp>
+
+#define BUFFER_SIZE 1024
+
+#include "phylib.hh"
+
+void message(int fd, std::string msg) {
+  log(msg);
+  msg = msg + " \n";
+  send(fd, msg.c_str(), msg.size(), MSG_NOSIGNAL);
+}
+
+int server_fd;
+int server_port = 30002;
+phy::controller_t PHY;
+
+void handle_signal(int /* signal */) {
+  log("CTRL+C interrupt");
+  /** close controller connection **/
+  phy::close(PHY);
+  /** close server socket **/
+  log("server is shutting down, have a good day");
+  close(server_fd);
+  exit(0);
+}
+
+void process_program_options(int argc, char *argv[]);
+void process_command(int client_fd, const std::string &str);
+std::string positions();
+
+int main(int argc, char *argv[]) {
+  struct sockaddr_in address;
+  socklen_t addr_len = sizeof(address);
+  char buffer[BUFFER_SIZE] = {0};
+  std::string mystring;
+
+  process_program_options(argc, argv);
+
+  /** handle SIGINT (Ctrl+C) **/
+  signal(SIGINT, handle_signal);
+
+  /** connect to the controller and keep the connection open **/
+  if (!phy::open(PHY)) return 1;
+  phy::start_polling(PHY);
+
+  /** create socket **/
+  server_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (server_fd == -1) {
+    error("socket creation failed");
+    return 1;
+  }
+
+  /** set socket options to allow immediate address reuse **/
+  int opt = 1;
+  if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt))) {
+    error("socket options failed");
+    return 1;
+  }
+
+  /** configure server address structure **/
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = INADDR_ANY;
+  address.sin_port = htons(server_port);
+
+  /** bind socket **/
+  if (bind(server_fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+    error("bind failed");
+    close(server_fd);
+    return 1;
+  }
+
+  /** listen for incoming connections **/
+  if (listen(server_fd, 3) < 0) {
+    error("listen failed");
+    close(server_fd);
+    return 1;
+  }
+
+  mystring = "server listening on port " + std::to_string(server_port);
+  log(mystring);
+
+  while (true) {
+    int client_fd = accept(server_fd, (struct sockaddr*)&address, &addr_len);
+    if (client_fd < 0) {
+      error("accept failed");
+      continue;
+    }
+
+    log("client connected");
+    int one = 1;
+    setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    /** receive data, one command per line **/
+    std::string pending;
+    while (true) {
+      ssize_t bytes_received = recv(client_fd, buffer, BUFFER_SIZE - 1, 0);
+      if (bytes_received <= 0) {
+	log("client disconnected");
+	break;
+      }
+      pending.append(buffer, bytes_received);
+      size_t eol;
+      while ((eol = pending.find('\n')) != std::string::npos) {
+	std::string received_str = pending.substr(0, eol);
+	pending.erase(0, eol + 1);
+	received_str.erase(received_str.find_last_not_of("\r\n ") + 1);
+	if (received_str.empty()) continue;
+	log("received message from client: " << received_str);
+	process_command(client_fd, received_str);
+      }
+    }
+
+    /** close client socket **/
+    close(client_fd);
+  }
+
+  phy::close(PHY);
+  close(server_fd);
+  return 0;
+}
+
+void
+process_program_options(int argc, char *argv[])
+{
+  namespace po = boost::program_options;
+  po::options_description desc("Options");
+  try {
+    desc.add_options()
+      ("help"             , "Print help messages")
+      ("address"          , po::value<std::string>(&PHY.opt.address)->default_value("10.0.8.16"), "phyMOTION controller address")
+      ("port"             , po::value<int>(&PHY.opt.port)->default_value(22222), "phyMOTION controller port")
+      ("listen"           , po::value<int>(&server_port)->default_value(30002), "Server listening port")
+      ("poll_ms"          , po::value<int>(&PHY.opt.poll_ms)->default_value(10), "Status polling period (ms)")
+      ("timeout_ms"       , po::value<int>(&PHY.opt.timeout_ms)->default_value(1000), "Controller reply timeout (ms)")
+      ;
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+      std::cout << desc << std::endl;
+      exit(1);
+    }
+  }
+  catch(std::exception& e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    std::cout << desc << std::endl;
+    exit(1);
+  }
+}
+
+std::string
+positions()
+{
+  std::lock_guard<std::mutex> lock(PHY.status_mutex);
+  std::ostringstream ss;
+  for (size_t iax = 0; iax < PHY.position.size(); ++iax)
+    ss << (iax ? " " : "") << PHY.position[iax];
+  return ss.str();
+}
+
+void
+process_command(int client_fd, const std::string &str)
+{
+  std::string mystring;
+  std::stringstream ss(str);
+  std::string word;
+  std::vector<std::string> words;
+  while (ss >> word) words.push_back(word);
+
+  /** quit **/
+  if (str.find("quit") == 0) {
+    phy::close(PHY);
+    mystring = "server is shutting down, have a good day";
+    message(client_fd, mystring);
+    close(client_fd);
+    close(server_fd);
+    exit(0);
+  }
+
+  /** alive **/
+  if (str.find("alive") == 0) {
+    mystring = "server is alive";
+    message(client_fd, mystring);
+    return;
+  }
+
+  /**
+   ** move [x] [y] -- absolute move, returns immediately
+   ** moveto [x] [y] -- absolute move, returns when in position
+   **/
+
+  if (str.find("move") == 0) {
+    bool and_wait = words[0] == "moveto";
+    if (words.size() != PHY.opt.axes.size() + 1) {
+      mystring = "[ERROR] \'" + words[0] + "\' command requires " + std::to_string(PHY.opt.axes.size()) + " arguments";
+      message(client_fd, mystring);
+      return;
+    }
+    std::vector<double> pos;
+    try {
+      for (size_t i = 1; i < words.size(); ++i) pos.push_back(std::stod(words[i]));
+    }
+    catch (std::exception &e) {
+      mystring = "[ERROR] invalid \'" + words[0] + "\' argument, not a valid number";
+      message(client_fd, mystring);
+      return;
+    }
+    if (!phy::move(PHY, pos)) {
+      mystring = "[ERROR] move command failed";
+      message(client_fd, mystring);
+      return;
+    }
+    if (!and_wait) {
+      mystring = "moving";
+      message(client_fd, mystring);
+      return;
+    }
+    if (!phy::wait_in_position(PHY, 60000)) {
+      mystring = "[ERROR] timeout waiting for position";
+      message(client_fd, mystring);
+      return;
+    }
+    mystring = "in position: " + positions();
+    message(client_fd, mystring);
+    return;
+  }
+
+  /** wait [timeout_ms] **/
+  if (str.find("wait") == 0) {
+    int timeout_ms = 60000;
+    try {
+      if (words.size() > 1) timeout_ms = std::stoi(words[1]);
+    }
+    catch (std::exception &e) {
+      mystring = "[ERROR] invalid \'wait\' argument, not a valid integer: " + words[1];
+      message(client_fd, mystring);
+      return;
+    }
+    if (!phy::wait_in_position(PHY, timeout_ms)) {
+      mystring = "[ERROR] timeout waiting for position";
+      message(client_fd, mystring);
+      return;
+    }
+    mystring = "in position: " + positions();
+    message(client_fd, mystring);
+    return;
+  }
+
+  /** gpos -- last polled positions, no round trip to the controller **/
+  if (str.find("gpos") == 0) {
+    message(client_fd, positions());
+    return;
+  }
+
+  /** status **/
+  if (str.find("status") == 0) {
+    std::lock_guard<std::mutex> lock(PHY.status_mutex);
+    mystring.clear();
+    for (size_t iax = 0; iax < PHY.status.size(); ++iax)
+      mystring += (iax ? " | " : "") + PHY.opt.axes[iax] + ": " + phy::decode_status(PHY.status[iax]);
+    message(client_fd, mystring);
+    return;
+  }
+
+  /** home **/
+  if (str.find("home") == 0) {
+    if (!phy::home(PHY)) {
+      mystring = "[ERROR] home command failed";
+      message(client_fd, mystring);
+      return;
+    }
+    mystring = "homing";
+    message(client_fd, mystring);
+    return;
+  }
+
+  /** activate / deactivate **/
+  if (str.find("activate") == 0 || str.find("deactivate") == 0) {
+    bool on = words[0] == "activate";
+    if (!phy::activate(PHY, on)) {
+      mystring = "[ERROR] " + words[0] + " command failed";
+      message(client_fd, mystring);
+      return;
+    }
+    mystring = on ? "axes activated" : "axes deactivated";
+    message(client_fd, mystring);
+    return;
+  }
+
+  /** poll [ms] -- change status polling period **/
+  if (str.find("poll") == 0) {
+    if (words.size() != 2) {
+      mystring = "[ERROR] \'poll\' command requires one argument: \'period (ms)\'";
+      message(client_fd, mystring);
+      return;
+    }
+    int poll_ms = 0;
+    try { poll_ms = std::stoi(words[1]); }
+    catch (std::exception &e) { poll_ms = 0; }
+    if (poll_ms < 1) {
+      mystring = "[ERROR] invalid \'poll\' argument, not a valid value [>= 1]: " + words[1];
+      message(client_fd, mystring);
+      return;
+    }
+    phy::stop_polling(PHY);
+    PHY.opt.poll_ms = poll_ms;
+    phy::start_polling(PHY);
+    mystring = "status polling period configured: " + words[1];
+    message(client_fd, mystring);
+    return;
+  }
+
+  /** cmd [telegram] -- raw controller command **/
+  if (str.find("cmd") == 0) {
+    if (words.size() < 2) {
+      mystring = "[ERROR] \'cmd\' command requires one argument: \'command\'";
+      message(client_fd, mystring);
+      return;
+    }
+    phy::reply_t reply;
+    if (!phy::ask(PHY, str.substr(str.find(words[1])), reply)) {
+      mystring = "[ERROR] no reply from controller";
+      message(client_fd, mystring);
+      return;
+    }
+    mystring = std::string(reply.ack ? "ACK" : "NAK") + " " + reply.data;
+    message(client_fd, mystring);
+    return;
+  }
+
+  mystring = "[ERROR] unknown command: " + str;
+  message(client_fd, mystring);
+  return;
+}